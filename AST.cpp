@@ -7,7 +7,12 @@
 //
 
 #include "AST.h"
+
+#include <algorithm>
+#include <cassert>
+
 #include "CodeGenerator.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/raw_ostream.h"
 
 using llvm::Value;
@@ -17,6 +22,31 @@ using code_generator::CodeGenerator;
 
 namespace AST {
    
+   util::symbol_t operatorSymbol(llvm::StringRef kind, char opcode)
+   {
+      llvm::SmallString<8> name(kind);
+      name.push_back(opcode);
+      return util::intern(name);
+   }
+   
+   llvm::StringRef getReductionName(Reduction reduction)
+   {
+      switch (reduction)
+      {
+         case Reduction::Sum:
+            return "+";
+         case Reduction::Product:
+            return "*";
+         case Reduction::Min:
+            return "min";
+         case Reduction::Max:
+            return "max";
+         case Reduction::None:
+            break;
+      }
+      return "";
+   }
+   
    ///
    /// indent utility
    ///
@@ -26,11 +56,18 @@ namespace AST {
    
    
    ///
-   /// Default ExprAST constructor (it creates a instance of the code generator)
+   /// arena of the AST nodes
    ///
-   ExprAST::ExprAST(CodeGenerator& codeGenerator) :
-      codeGenerator_(codeGenerator)
-   {}
+   
+   void ASTContext::reset()
+   {
+      allocator_.Reset();
+   }
+   
+   size_t ASTContext::getBytesAllocated() const
+   {
+      return allocator_.getBytesAllocated();
+   }
    
    int ExprAST::getLine() const
    {
@@ -51,8 +88,7 @@ namespace AST {
    /// Numeric expression AST node
    ///
    
-   NumberExprAST::NumberExprAST(CodeGenerator& codeGenerator, double val):
-   ExprAST(codeGenerator),
+   NumberExprAST::NumberExprAST(double val):
    val_(val)
    {}
    
@@ -67,50 +103,63 @@ namespace AST {
    }
 
    
-   Value* NumberExprAST::codeGen() const
+   Value* NumberExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenNumberExpr(this);
+      return codeGenerator.codeGenNumberExpr(this);
    }
    
    ///
    /// Variable expression
    ///
    
-   VariableExprAST::VariableExprAST(CodeGenerator& codeGenerator, const std::string& name) :
-   ExprAST(codeGenerator),
+   VariableExprAST::VariableExprAST(util::symbol_t name) :
    name_(name)
    {}
    
-   const std::string& VariableExprAST::getName() const
+   util::symbol_t VariableExprAST::getSymbol() const
    {
       return name_;
    }
    
+   llvm::StringRef VariableExprAST::getName() const
+   {
+      return util::symbolName(name_);
+   }
+   
+   util::slot_t VariableExprAST::getSlot() const
+   {
+      return slot_;
+   }
+   
+   void VariableExprAST::setSlot(util::slot_t slot)
+   {
+      slot_ = slot;
+   }
+   
    raw_ostream &VariableExprAST::dump(raw_ostream &out, int ind)
    {
-      return ExprAST::dump(out << name_, ind);
+      return ExprAST::dump(out << getName(), ind);
    }
 
-   Value* VariableExprAST::codeGen() const
+   Value* VariableExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenVariableExpr(this);
+      return codeGenerator.codeGenVariableExpr(this);
    }
    
    ///
    /// Unary expression
    ///
    
-   UnaryExprAST::UnaryExprAST(CodeGenerator& codeGenerator, opcode_t opcode, operand_t operand) :
-   ExprAST(codeGenerator),
+   UnaryExprAST::UnaryExprAST(opcode_t opcode, operand_t operand) :
    opcode_(opcode),
-   operand_(std::move(operand))
+   operand_(operand)
    {}
    
    UnaryExprAST::opcode_t UnaryExprAST::getOpcode() const
    {
       return opcode_;
    }
-   const UnaryExprAST::operand_t& UnaryExprAST::getOperand() const
+   UnaryExprAST::operand_t UnaryExprAST::getOperand() const
    {
       return operand_;
    }
@@ -122,9 +171,9 @@ namespace AST {
       return out;
    }
    
-   llvm::Value *UnaryExprAST::codeGen() const
+   llvm::Value* UnaryExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenUnaryExpr(this);
+      return codeGenerator.codeGenUnaryExpr(this);
    }
    
    
@@ -132,11 +181,10 @@ namespace AST {
    /// Binary expression
    ///
    
-   BinaryExprAST::BinaryExprAST(CodeGenerator& codeGenerator, opcode_t opcode, operand_t lhs, operand_t rhs) :
-   ExprAST(codeGenerator),
+   BinaryExprAST::BinaryExprAST(opcode_t opcode, operand_t lhs, operand_t rhs) :
    opcode_(opcode),
-   lhs_(std::move(lhs)),
-   rhs_(std::move(rhs))
+   lhs_(lhs),
+   rhs_(rhs)
    {}
       
    BinaryExprAST::opcode_t BinaryExprAST::getOpcode() const
@@ -144,12 +192,12 @@ namespace AST {
       return opcode_;
    }
    
-   const BinaryExprAST::operand_t& BinaryExprAST::getLeftOperand() const
+   BinaryExprAST::operand_t BinaryExprAST::getLeftOperand() const
    {
       return lhs_;
    }
    
-   const BinaryExprAST::operand_t& BinaryExprAST::getRightOperand() const
+   BinaryExprAST::operand_t BinaryExprAST::getRightOperand() const
    {
       return rhs_;
    }
@@ -162,71 +210,108 @@ namespace AST {
       return out;
    }
 
-   llvm::Value* BinaryExprAST::codeGen() const
+   llvm::Value* BinaryExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenBinaryExpr(this);
+      return codeGenerator.codeGenBinaryExpr(this);
    }
    
    ///
    /// Call expression
    ///
 
-   CallExprAST::CallExprAST(CodeGenerator& codeGenerator, const std::string& callee, Args args) :
-   ExprAST(codeGenerator),
+   CallExprAST::CallExprAST(util::symbol_t callee, Args args) :
    callee_(callee),
-   args_(std::move(args))
+   args_(args)
    {}
       
-   const CallExprAST::Args& CallExprAST::getArgumentList() const
+   llvm::ArrayRef<ExprAST*> CallExprAST::getArgumentList() const
    {
       return args_;
    }
    
-   const std::string CallExprAST::getCallee() const
+   util::symbol_t CallExprAST::getCallee() const
    {
       return callee_;
    }
    
+   llvm::StringRef CallExprAST::getCalleeName() const
+   {
+      return util::symbolName(callee_);
+   }
+   
    raw_ostream &CallExprAST::dump(raw_ostream &out, int ind)
    {
-      ExprAST::dump(out << "Call" << callee_, ind);
+      ExprAST::dump(out << "Call" << getCalleeName(), ind);
       for (const auto &arg : args_)
          arg->dump( indent(out, ind+1), ind+1);
       return out;
    }
 
    
-   llvm::Value* CallExprAST::codeGen() const
+   llvm::Value* CallExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenCallExpr(this);
+      return codeGenerator.codeGenCallExpr(this);
    }
    
    ///
    /// Prototype AST
    ///
 
-   PrototypeAST::PrototypeAST( CodeGenerator& codeGenerator,
-                               std::string name,
+   PrototypeAST::PrototypeAST( util::symbol_t name,
                                PrototypeAST::Args args,
                                bool is_operator,
-                               unsigned precedence) :
-      ExprAST(codeGenerator),
-      name_(std::move(name)),
+                               unsigned precedence,
+                               PrototypeAST::ArgTypes argTypes,
+                               ValueType returnType,
+                               FloatingPointMode floatingPointMode) :
+      name_(name),
       args_(std::move(args)),
       is_operator_(is_operator),
-      precedence_(precedence)
-   {}
+      precedence_(precedence),
+      argTypes_(std::move(argTypes)),
+      returnType_(returnType),
+      floatingPointMode_(floatingPointMode)
+   {
+      assert((argTypes_.empty() || argTypes_.size() == args_.size()) && "one type per argument");
+   }
       
    const PrototypeAST::Args& PrototypeAST::getArgumentList() const
    {
       return args_;
    }
    
-   const std::string& PrototypeAST::getName() const
+   ValueType PrototypeAST::getArgumentType(size_t index) const
+   {
+      return argTypes_.empty() ? ValueType::F64 : argTypes_[index];
+   }
+   
+   ValueType PrototypeAST::getReturnType() const
+   {
+      return returnType_;
+   }
+   
+   FloatingPointMode PrototypeAST::getFloatingPointMode() const
+   {
+      return floatingPointMode_;
+   }
+   
+   bool PrototypeAST::isUntyped() const
+   {
+      return returnType_ == ValueType::F64 &&
+             std::all_of(argTypes_.begin(), argTypes_.end(),
+                         [](ValueType type) { return type == ValueType::F64; });
+   }
+   
+   util::symbol_t PrototypeAST::getSymbol() const
    {
       return name_;
    }
    
+   llvm::StringRef PrototypeAST::getName() const
+   {
+      return util::symbolName(name_);
+   }
+   
    bool PrototypeAST::isUnary() const
    {
       return is_operator_ && args_.size() == 1;
@@ -245,37 +330,40 @@ namespace AST {
    char PrototypeAST::getOperatorName() const
    {
       assert(isUnary() || isBinary());
-      return name_[name_.size()-1];
+      return getName().back();
    }
    
    
-   llvm::Function* PrototypeAST::codeGen() const
+   llvm::Function* PrototypeAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenPrototypeExpr(this);
+      return codeGenerator.codeGenPrototypeExpr(this);
    }
    
    ///
    /// FunctionAST
    ///
    
-   FunctionAST::FunctionAST(CodeGenerator& codeGenerator,
-                            FunctionAST::prototype_t prototype,
+   FunctionAST::FunctionAST(FunctionAST::prototype_t prototype,
                             FunctionAST::body_t body) :
-      ExprAST(codeGenerator),
       prototype_(std::move(prototype)),
-      body_(std::move(body))
+      body_(body)
    {}
    
    const FunctionAST::prototype_t& FunctionAST::getPrototype() const
    {
-      return std::move(prototype_);
+      return prototype_;
    } 
    
-   const FunctionAST::body_t& FunctionAST::getBody() const
+   FunctionAST::body_t FunctionAST::getBody() const
    {
       return body_;
    }
    
+   void FunctionAST::setBody(body_t body)
+   {
+      body_ = body;
+   }
+   
    raw_ostream &FunctionAST::dump(raw_ostream &out, int ind)
    {
       indent(out, ind) << "FunctionAST\n";
@@ -284,9 +372,9 @@ namespace AST {
       return body_ ? body_->dump(out, ind) : out << "null\n";
    }
    
-   llvm::Function* FunctionAST::codeGen() const
+   llvm::Function* FunctionAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenFunctionExpr(this);
+      return codeGenerator.codeGenFunctionExpr(this);
    }
    
 //   void FunctionAST::eval(llvm::Function* f)
@@ -298,27 +386,25 @@ namespace AST {
    /// IfExprAST
    ///
    
-   IfExprAST::IfExprAST(CodeGenerator& codeGenerator,
-                        condion_t c,
+   IfExprAST::IfExprAST(condion_t c,
                         then_branch_t t,
                         else_branch_t e) :
-   ExprAST(codeGenerator),
-   cond_(std::move(c)),
-   then_(std::move(t)),
-   else_(std::move(e))
+   cond_(c),
+   then_(t),
+   else_(e)
    {}
                                                    
-   const IfExprAST::condion_t& IfExprAST::getCondion() const
+   IfExprAST::condion_t IfExprAST::getCondion() const
    {
       return cond_;
    }
    
-   const IfExprAST::then_branch_t& IfExprAST::getThenBranch() const
+   IfExprAST::then_branch_t IfExprAST::getThenBranch() const
    {
       return then_;
    }
    
-   const IfExprAST::else_branch_t& IfExprAST::getElseBranch() const
+   IfExprAST::else_branch_t IfExprAST::getElseBranch() const
    {
       return else_;
    }
@@ -332,86 +418,92 @@ namespace AST {
       return out;
    }
    
-   llvm::Value* IfExprAST::codeGen() const
+   llvm::Value* IfExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenIfExpr(this);
+      return codeGenerator.codeGenIfExpr(this);
    }
    
    ///
    /// ForExprAST
    ///
    
-   ForExprAST::ForExprAST(CodeGenerator& codeGenerator,
-                       std::string keyLoop,
+   ForExprAST::ForExprAST(util::symbol_t keyLoop,
                        expression_t start,
                        expression_t end,
                        expression_t step,
-                       expression_t body) :
-   ExprAST(codeGenerator),
-   key_(std::move(keyLoop)),
-   start_(std::move(start)),
-   end_(std::move(end)),
-   step_(std::move(step)),
-   body_(std::move(body))
+                       expression_t body,
+                       Reduction reduction) :
+   key_(keyLoop),
+   start_(start),
+   end_(end),
+   step_(step),
+   body_(body),
+   reduction_(reduction)
    {}
    
-   const std::string&  ForExprAST::getKey() const
+   util::symbol_t ForExprAST::getKey() const
    {
       return key_;
    }
    
-   const ForExprAST::expression_t& ForExprAST::getStart() const
+   ForExprAST::expression_t ForExprAST::getStart() const
    {
       return start_;
    }
    
-   const ForExprAST::expression_t& ForExprAST::getEnd() const
+   ForExprAST::expression_t ForExprAST::getEnd() const
    {
       return end_;
    }
    
-   const ForExprAST::expression_t& ForExprAST::getStep() const
+   ForExprAST::expression_t ForExprAST::getStep() const
    {
       return step_;
    }
    
-   const ForExprAST::expression_t& ForExprAST::getBody() const
+   ForExprAST::expression_t ForExprAST::getBody() const
    {
       return body_;
    }
    
+   Reduction ForExprAST::getReduction() const
+   {
+      return reduction_;
+   }
+   
    raw_ostream &ForExprAST::dump(raw_ostream &out, int ind)
    {
+      if (reduction_ != Reduction::None)
+         out << "reduce " << getReductionName(reduction_) << " ";
       ExprAST::dump(out << "for", ind);
       start_->dump(indent(out, ind) << "Cond:", ind + 1);
       end_->dump(indent(out, ind) << "End:", ind + 1);
-      step_->dump(indent(out, ind) << "Step:", ind + 1);
+      if (step_)
+         step_->dump(indent(out, ind) << "Step:", ind + 1);
       body_->dump(indent(out, ind) << "Body:", ind + 1);
       return out;
    }
 
-   llvm::Value* ForExprAST::codeGen() const
+   llvm::Value* ForExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGenForExpr(this);
+      return codeGenerator.codeGenForExpr(this);
    }
    
    ///
    /// VarExprAST
    ///
    
-   VarExprAST::VarExprAST(CodeGenerator& codeGenerator,
-                          variable_names_t varNames, expression_t body) :
-   ExprAST(codeGenerator),
-   varNames_(std::move(varNames)),
-   body_(std::move(body))
+   VarExprAST::VarExprAST(variable_names_t varNames, expression_t body) :
+   varNames_(varNames),
+   body_(body)
    {}
    
-   const VarExprAST::variable_names_t& VarExprAST::getVarNames() const
+   llvm::ArrayRef<VarExprAST::variable_t> VarExprAST::getVarNames() const
    {
       return varNames_;
    }
    
-   const VarExprAST::expression_t& VarExprAST::getBody() const
+   VarExprAST::expression_t VarExprAST::getBody() const
    {
       return body_;
    }
@@ -420,15 +512,54 @@ namespace AST {
    {
       ExprAST::dump(out << "var", ind);
       for (const auto &NamedVar : varNames_)
-         NamedVar.second->dump(indent(out, ind) << NamedVar.first << ':', ind+1);
+      {
+         indent(out, ind) << util::symbolName(NamedVar.name);
+         if (NamedVar.type != ValueType::Auto)
+            out << ':' << getValueTypeName(NamedVar.type);
+         
+         if (NamedVar.init)
+            NamedVar.init->dump(out << '=', ind+1);
+         else
+            out << "\n";
+      }
       
       body_->dump(indent(out, ind) << "Body:", ind + 1);
       return out;
    }
    
-   llvm::Value* VarExprAST::codeGen() const
+   llvm::Value* VarExprAST::codeGen(CodeGenerator& codeGenerator) const
+   {
+      return codeGenerator.codeGeneVarExpr(this);
+   }
+   
+   ///
+   /// IndexExprAST
+   ///
+   
+   IndexExprAST::IndexExprAST(VariableExprAST* array, ExprAST* index) :
+   array_(array),
+   index_(index)
+   {}
+   
+   VariableExprAST* IndexExprAST::getArray() const
+   {
+      return array_;
+   }
+   
+   ExprAST* IndexExprAST::getIndex() const
+   {
+      return index_;
+   }
+   
+   raw_ostream &IndexExprAST::dump(raw_ostream &out, int ind)
+   {
+      ExprAST::dump(out << "index " << array_->getName(), ind);
+      return index_->dump(indent(out, ind) << "Index:", ind + 1);
+   }
+   
+   llvm::Value* IndexExprAST::codeGen(CodeGenerator& codeGenerator) const
    {
-      return codeGenerator_.codeGeneVarExpr(this);
+      return codeGenerator.codeGenIndexExpr(this);
    }
 
 
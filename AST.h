@@ -11,12 +11,21 @@
 #ifndef ParseTree_h
 #define ParseTree_h
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
+#include <utility>
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Value.h"
+#include "llvm/Support/Allocator.h"
+
+#include "Interner.h"
+#include "ScopedSymbolTable.h"
+#include "ValueType.h"
 
 namespace code_generator {
    class CodeGenerator;
@@ -28,26 +37,108 @@ namespace llvm{
 
 namespace AST {
    
+   ///
+   /// @brief: kind of a node, used for llvm::isa/dyn_cast on the tree and as tag of the flat nodes
+   ///
+   enum class ExprKind : std::uint8_t
+   {
+      Number,
+      Variable,
+      Unary,
+      Binary,
+      Call,
+      If,
+      For,
+      Var,
+      Index,
+      Prototype,
+      Function
+   };
+   
+   ///
+   /// @brief: symbol of the function implementing a user defined operator (i.e. "binary|")
+   ///
+   util::symbol_t operatorSymbol(llvm::StringRef kind, char opcode);
+   
+   ///
+   /// @brief: how the values of the body of a 'reduce' loop are combined, None for a plain 'for'
+   ///
+   enum class Reduction : std::uint8_t
+   {
+      None,
+      Sum,
+      Product,
+      Min,
+      Max
+   };
+   
+   llvm::StringRef getReductionName(Reduction reduction);
+   
+   ///
+   /// @brief: bump allocator for the expression nodes of a top level item (definition or expression).
+   ///         Nodes are never destroyed one by one: the whole arena is released in one shot once the
+   ///         item has been code generated, so nodes must not own any resource (children and lists
+   ///         live in the same arena)
+   ///
+   class ASTContext
+   {
+   public:
+      
+      ASTContext() = default;
+      ASTContext(const ASTContext&) = delete;
+      ASTContext& operator=(const ASTContext&) = delete;
+      
+      template <typename Node, typename... Args>
+      Node* create(Args&&... args)
+      {
+         return new (allocator_.Allocate<Node>()) Node(std::forward<Args>(args)...);
+      }
+      
+      ///
+      /// @brief: copy a list built while parsing into the arena
+      ///
+      template <typename T>
+      llvm::MutableArrayRef<T> copy(const std::vector<T>& list)
+      {
+         if (list.empty())
+            return llvm::MutableArrayRef<T>();
+         
+         auto elements = allocator_.Allocate<T>(list.size());
+         std::uninitialized_copy(list.begin(), list.end(), elements);
+         return llvm::MutableArrayRef<T>(elements, list.size());
+      }
+      
+      ///
+      /// @brief: release all the nodes allocated so far
+      ///
+      void reset();
+      
+      size_t getBytesAllocated() const;
+      
+   private:
+      llvm::BumpPtrAllocator allocator_;
+   };
  
    ///
-   /// @brief: base class to for all expression nodes
+   /// @brief: base class to for all expression nodes.
+   ///         The code generator is passed at visit time
    ///
    class ExprAST
    {
       
    public:
-      explicit ExprAST(code_generator::CodeGenerator& codeGenerator);
+      ExprAST() = default;
       
       virtual ~ExprAST() = default;
       
+      virtual ExprKind getKind() const = 0;
       int getLine() const;
       int getCol() const;
       virtual llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind);
       
-      virtual llvm::Value* codeGen() const = 0;
+      virtual llvm::Value* codeGen(code_generator::CodeGenerator& codeGenerator) const = 0;
       
    protected:
-      code_generator::CodeGenerator& codeGenerator_; //class that generates IR
       //SourceLocation location_; //debug info
    };
    
@@ -58,10 +149,14 @@ namespace AST {
    {
       
    public:
-      explicit NumberExprAST(code_generator::CodeGenerator& codeGenerator, double val);
+      explicit NumberExprAST(double val);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Number; }
+      ExprKind getKind() const override { return ExprKind::Number; }
+      
       double getVal() const;
       llvm::raw_ostream& dump(llvm::raw_ostream &out, int ind) override;
-      llvm::Value* codeGen() const override;
+      llvm::Value* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
       double val_;
@@ -74,13 +169,27 @@ namespace AST {
    {
       
    public:
-      explicit VariableExprAST(code_generator::CodeGenerator& codeGenerator, const std::string& name );
-      const std::string& getName() const;
+      explicit VariableExprAST(util::symbol_t name);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Variable; }
+      ExprKind getKind() const override { return ExprKind::Variable; }
+      
+      util::symbol_t getSymbol() const;
+      llvm::StringRef getName() const;
+      
+      ///
+      /// @brief: slot of the binding in the scopes of the function (see resolveSlots),
+      ///         noSlot when not resolved
+      ///
+      util::slot_t getSlot() const;
+      void setSlot(util::slot_t slot);
+      
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
-      llvm::Value* codeGen() const override;
+      llvm::Value* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
-      std::string name_;
+      util::symbol_t name_;
+      util::slot_t slot_ = util::noSlot;
    };
    
    ///
@@ -88,26 +197,28 @@ namespace AST {
    ///
    class IfExprAST : public ExprAST
    {
-      using condion_t = std::unique_ptr<ExprAST>;
-      using then_branch_t = std::unique_ptr<ExprAST>;
-      using else_branch_t = std::unique_ptr<ExprAST>;
+      using condion_t = ExprAST*;
+      using then_branch_t = ExprAST*;
+      using else_branch_t = ExprAST*;
       
    public:
       
-      explicit IfExprAST(code_generator::CodeGenerator& codeGenerator,
-                         condion_t c,
+      explicit IfExprAST(condion_t c,
                          then_branch_t t,
                          else_branch_t e);
       
-      const condion_t& getCondion() const;
-      const then_branch_t& getThenBranch() const;
-      const else_branch_t& getElseBranch() const;
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::If; }
+      ExprKind getKind() const override { return ExprKind::If; }
+      
+      condion_t getCondion() const;
+      then_branch_t getThenBranch() const;
+      else_branch_t getElseBranch() const;
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
       
-      llvm::Value* codeGen() const override;
+      llvm::Value* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
-      std::unique_ptr<ExprAST> cond_, then_, else_;
+      ExprAST *cond_, *then_, *else_;
       
    };
    
@@ -116,28 +227,37 @@ namespace AST {
    ///
    class ForExprAST : public ExprAST
    {
-      using expression_t = std::unique_ptr<ExprAST>;
+      using expression_t = ExprAST*;
       
    public:
-      explicit ForExprAST(code_generator::CodeGenerator& codeGenerator,
-                          std::string key,
+      ///
+      /// @brief: a 'for' evaluates to 0, a 'reduce' to the values of its body combined
+      ///         ('reduce + i = 0, i < n in a[i]')
+      ///
+      explicit ForExprAST(util::symbol_t key,
                           expression_t start,
                           expression_t end,
                           expression_t step,
-                          expression_t body);
-      
-      const std::string&  getKey() const;
-      const expression_t& getStart() const;
-      const expression_t& getEnd()   const;
-      const expression_t& getStep()  const;
-      const expression_t& getBody()  const;
+                          expression_t body,
+                          Reduction reduction = Reduction::None);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::For; }
+      ExprKind getKind() const override { return ExprKind::For; }
+      
+      util::symbol_t getKey() const;
+      expression_t getStart() const;
+      expression_t getEnd()   const;
+      expression_t getStep()  const;
+      expression_t getBody()  const;
+      Reduction getReduction() const;
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
       
-      llvm::Value* codeGen() const override;
+      llvm::Value* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
-      std::string key_;
+      util::symbol_t key_;
       expression_t start_, end_, step_, body_;
+      Reduction reduction_;
    };
    
    ///
@@ -146,16 +266,20 @@ namespace AST {
    class UnaryExprAST : public ExprAST
    {
       using opcode_t = char;
-      using operand_t = std::unique_ptr<ExprAST>;
+      using operand_t = ExprAST*;
       
    public:
       
-      explicit UnaryExprAST(code_generator::CodeGenerator& codeGenerator, opcode_t opcode, operand_t operand);
+      explicit UnaryExprAST(opcode_t opcode, operand_t operand);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Unary; }
+      ExprKind getKind() const override { return ExprKind::Unary; }
+      
       opcode_t getOpcode() const;
-      const operand_t& getOperand() const;
+      operand_t getOperand() const;
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
       
-      llvm::Value *codeGen() const override;
+      llvm::Value *codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
       opcode_t opcode_;
@@ -168,16 +292,19 @@ namespace AST {
    class BinaryExprAST : public ExprAST
    {
       using opcode_t = unsigned char;
-      using operand_t = std::unique_ptr<ExprAST>;
+      using operand_t = ExprAST*;
       
    public:
-      explicit BinaryExprAST(code_generator::CodeGenerator& codesGenerator,
-                             opcode_t opcode, operand_t lhs, operand_t rhs);
+      explicit BinaryExprAST(opcode_t opcode, operand_t lhs, operand_t rhs);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Binary; }
+      ExprKind getKind() const override { return ExprKind::Binary; }
+      
       opcode_t getOpcode() const;
-      const operand_t& getLeftOperand() const;
-      const operand_t& getRightOperand() const;
+      operand_t getLeftOperand() const;
+      operand_t getRightOperand() const;
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
-      llvm::Value* codeGen() const override;
+      llvm::Value* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
       opcode_t opcode_;
@@ -185,21 +312,36 @@ namespace AST {
       
    };
    
+   ///
+   /// @brief: name bound by a 'var', with its initializer (nullptr for 0.0) and its type
+   ///
+   struct VarBinding
+   {
+      util::symbol_t name;
+      ExprAST* init;
+      ValueType type;
+   };
+   
    ///
    /// @brief: var/in representation
    ///
    class VarExprAST : public ExprAST
    {
-      using variable_names_t = std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>>;
-      using expression_t = std::unique_ptr<ExprAST>;
+   public:
+      using variable_t = VarBinding;
+      using variable_names_t = llvm::MutableArrayRef<variable_t>;
+      using expression_t = ExprAST*;
       
    public:
-      VarExprAST(code_generator::CodeGenerator& codesGenerator,
-                 variable_names_t varNames, expression_t body);
-      const variable_names_t& getVarNames() const;
-      const expression_t& getBody() const;
+      VarExprAST(variable_names_t varNames, expression_t body);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Var; }
+      ExprKind getKind() const override { return ExprKind::Var; }
+      
+      llvm::ArrayRef<variable_t> getVarNames() const;
+      expression_t getBody() const;
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
-      llvm::Value *codeGen() const override;
+      llvm::Value *codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
       variable_names_t varNames_;
@@ -207,6 +349,29 @@ namespace AST {
    };
    
    
+   ///
+   /// @brief: element of an array variable or lane of a vector variable, 'array[index]'.
+   ///         Also the destination of '='
+   ///
+   class IndexExprAST : public ExprAST
+   {
+   public:
+      IndexExprAST(VariableExprAST* array, ExprAST* index);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Index; }
+      ExprKind getKind() const override { return ExprKind::Index; }
+      
+      VariableExprAST* getArray() const;
+      ExprAST* getIndex() const;
+      llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
+      llvm::Value *codeGen(code_generator::CodeGenerator& codeGenerator) const override;
+      
+   private:
+      VariableExprAST* array_;
+      ExprAST* index_;
+   };
+   
+   
    ///
    /// functions
    ///
@@ -216,63 +381,98 @@ namespace AST {
    ///
    class CallExprAST : public ExprAST
    {
-      using Args = std::vector<std::unique_ptr<ExprAST>>;
+      using Args = llvm::MutableArrayRef<ExprAST*>;
       
    public:
-      explicit CallExprAST(code_generator::CodeGenerator& codesGenerator, const std::string& callee, Args args);
-      const Args& getArgumentList() const;
-      const std::string getCallee() const;
+      explicit CallExprAST(util::symbol_t callee, Args args);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Call; }
+      ExprKind getKind() const override { return ExprKind::Call; }
+      
+      llvm::ArrayRef<ExprAST*> getArgumentList() const;
+      util::symbol_t getCallee() const;
+      llvm::StringRef getCalleeName() const;
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
-      llvm::Value* codeGen() const override;
+      llvm::Value* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
-      std::string callee_;
+      util::symbol_t callee_;
       Args args_;
    };
    
    ///
-   ///@brief: class to represent a prototype of a function
+   ///@brief: class to represent a prototype of a function.
+   ///        Prototypes outlive the arena of their item (they are cached by the code generator)
+   ///        so they are heap allocated
    ///
    class PrototypeAST : public ExprAST
    {
-      using Args = std::vector<std::string>;
+      using Args = std::vector<util::symbol_t>;
+      using ArgTypes = std::vector<ValueType>;
       
    public:
-      explicit PrototypeAST(code_generator::CodeGenerator& codesGenerator,
-                            std::string name,
+      ///
+      /// @brief: argTypes is empty or has a type for every argument, missing types are f64
+      ///
+      explicit PrototypeAST(util::symbol_t name,
                             Args args,
                             bool is_operator = false,
-                            unsigned precedence = 0);
+                            unsigned precedence = 0,
+                            ArgTypes argTypes = ArgTypes(),
+                            ValueType returnType = ValueType::F64,
+                            FloatingPointMode floatingPointMode = FloatingPointMode::Session);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Prototype; }
+      ExprKind getKind() const override { return ExprKind::Prototype; }
       
       const Args& getArgumentList() const;
-      const std::string& getName() const;
+      ValueType getArgumentType(size_t index) const;
+      ValueType getReturnType() const;
+      FloatingPointMode getFloatingPointMode() const;
+      
+      ///
+      /// @brief: every argument and the return value are f64
+      ///
+      bool isUntyped() const;
+      
+      util::symbol_t getSymbol() const;
+      llvm::StringRef getName() const;
       bool isUnary() const;
       bool isBinary() const;
       unsigned getBinaryPrecedence() const;
       char getOperatorName() const;
       
-      llvm::Function* codeGen() const override;
+      llvm::Function* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       
    private:
-      std::string name_;
+      util::symbol_t name_;
       Args args_;
       bool is_operator_;
       unsigned precedence_;
+      ArgTypes argTypes_;
+      ValueType returnType_;
+      FloatingPointMode floatingPointMode_;
    };
    
    ///
-   ///@brief: representation function definition itself
+   ///@brief: representation function definition itself.
+   ///        The function owns its prototype, the body lives in the arena of the item
    ///
    class FunctionAST : public ExprAST
    {
       using prototype_t = std::unique_ptr<PrototypeAST>;
-      using body_t = std::unique_ptr<ExprAST>;
+      using body_t = ExprAST*;
       
    public:
-      explicit FunctionAST(code_generator::CodeGenerator& codesGenerator, prototype_t prototype, body_t body);
+      explicit FunctionAST(prototype_t prototype, body_t body);
+      
+      static bool classof(const ExprAST* node) { return node->getKind() == ExprKind::Function; }
+      ExprKind getKind() const override { return ExprKind::Function; }
+      
       const prototype_t& getPrototype() const;
-      const body_t& getBody() const;
-      llvm::Function* codeGen() const override;
+      body_t getBody() const;
+      void setBody(body_t body);
+      llvm::Function* codeGen(code_generator::CodeGenerator& codeGenerator) const override;
       llvm::raw_ostream &dump(llvm::raw_ostream &out, int ind) override;
       
       //void eval(llvm::Function* f); //add jit compilation for functions
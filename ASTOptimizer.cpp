@@ -0,0 +1,779 @@
+//
+//  ASTOptimizer.cpp
+//  Kaleidoscope-LLVM
+//
+//  simplification of the expression tree between parsing and code generation:
+//  constant folding, constant conditions, dead 'var' bindings, loops running once and
+//  inline expansion of user defined operators
+//
+
+#include "ASTOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "llvm/Support/Casting.h"
+
+using namespace AST;
+
+namespace optimizer
+{
+   namespace
+   {
+      //compile time evaluation limits: operators can be recursive
+      const unsigned maxEvaluationDepth = 32;
+      const unsigned maxEvaluationSteps = 10000;
+      
+      const NumberExprAST* asNumber(const ExprAST* expression)
+      {
+         return llvm::dyn_cast_or_null<NumberExprAST>(expression);
+      }
+      
+      ///
+      /// @brief: truth value of a condition, as emitted by the code generator (fcmp one 0.0)
+      ///
+      bool isTrue(double value)
+      {
+         return value != 0.0 && !std::isnan(value);
+      }
+      
+      bool isBuiltinOperator(unsigned char op)
+      {
+         return op == '+' || op == '-' || op == '*' || op == '<';
+      }
+      
+      ///
+      /// @brief: builtin binary operators, with the semantic of the IR emitted for them
+      ///
+      double evaluateBuiltin(unsigned char op, double lhs, double rhs)
+      {
+         switch (op)
+         {
+            case '+':
+               return lhs + rhs;
+            case '-':
+               return lhs - rhs;
+            case '*':
+               return lhs * rhs;
+            default:
+               //fcmp ult: true when unordered
+               return (lhs < rhs || std::isnan(lhs) || std::isnan(rhs)) ? 1.0 : 0.0;
+         }
+      }
+      
+      ExprAST* cloneExpression(ASTContext& context, const ExprAST* expression)
+      {
+         if (!expression)
+            return nullptr;
+         
+         switch (expression->getKind())
+         {
+            case ExprKind::Number:
+               return context.create<NumberExprAST>(llvm::cast<NumberExprAST>(expression)->getVal());
+            
+            case ExprKind::Variable:
+               return context.create<VariableExprAST>(llvm::cast<VariableExprAST>(expression)->getSymbol());
+            
+            case ExprKind::Unary:
+            {
+               auto unary = llvm::cast<UnaryExprAST>(expression);
+               return context.create<UnaryExprAST>(unary->getOpcode(), cloneExpression(context, unary->getOperand()));
+            }
+            
+            case ExprKind::Binary:
+            {
+               auto binary = llvm::cast<BinaryExprAST>(expression);
+               return context.create<BinaryExprAST>(binary->getOpcode(),
+                                                    cloneExpression(context, binary->getLeftOperand()),
+                                                    cloneExpression(context, binary->getRightOperand()));
+            }
+            
+            case ExprKind::Call:
+            {
+               auto call = llvm::cast<CallExprAST>(expression);
+               std::vector<ExprAST*> args;
+               for (auto arg : call->getArgumentList())
+                  args.push_back(cloneExpression(context, arg));
+               return context.create<CallExprAST>(call->getCallee(), context.copy(args));
+            }
+            
+            case ExprKind::If:
+            {
+               auto ifExpr = llvm::cast<IfExprAST>(expression);
+               return context.create<IfExprAST>(cloneExpression(context, ifExpr->getCondion()),
+                                                cloneExpression(context, ifExpr->getThenBranch()),
+                                                cloneExpression(context, ifExpr->getElseBranch()));
+            }
+            
+            case ExprKind::For:
+            {
+               auto forExpr = llvm::cast<ForExprAST>(expression);
+               return context.create<ForExprAST>(forExpr->getKey(),
+                                                 cloneExpression(context, forExpr->getStart()),
+                                                 cloneExpression(context, forExpr->getEnd()),
+                                                 cloneExpression(context, forExpr->getStep()),
+                                                 cloneExpression(context, forExpr->getBody()),
+                                                 forExpr->getReduction());
+            }
+            
+            case ExprKind::Var:
+            {
+               auto varExpr = llvm::cast<VarExprAST>(expression);
+               std::vector<VarExprAST::variable_t> variables;
+               for (const auto& variable : varExpr->getVarNames())
+                  variables.push_back(VarExprAST::variable_t{variable.name, cloneExpression(context, variable.init),
+                                                             variable.type});
+               return context.create<VarExprAST>(context.copy(variables), cloneExpression(context, varExpr->getBody()));
+            }
+            
+            case ExprKind::Index:
+            {
+               auto index = llvm::cast<IndexExprAST>(expression);
+               return context.create<IndexExprAST>(llvm::cast<VariableExprAST>(cloneExpression(context, index->getArray())),
+                                                   cloneExpression(context, index->getIndex()));
+            }
+            
+            case ExprKind::Prototype:
+            case ExprKind::Function:
+               break;
+         }
+         
+         return nullptr;
+      }
+      
+      ///
+      /// @brief: the expression reads or assigns a variable bound neither in bound nor by one of
+      ///         its 'var' and 'for' expressions. bound is left as passed
+      ///
+      bool hasFreeVariables(const ExprAST* expression, std::vector<util::symbol_t>& bound)
+      {
+         if (!expression)
+            return false;
+         
+         switch (expression->getKind())
+         {
+            case ExprKind::Number:
+               return false;
+            
+            case ExprKind::Variable:
+               return std::find(bound.begin(), bound.end(), llvm::cast<VariableExprAST>(expression)->getSymbol()) == bound.end();
+            
+            case ExprKind::Unary:
+               return hasFreeVariables(llvm::cast<UnaryExprAST>(expression)->getOperand(), bound);
+            
+            case ExprKind::Binary:
+            {
+               auto binary = llvm::cast<BinaryExprAST>(expression);
+               return hasFreeVariables(binary->getLeftOperand(), bound) || hasFreeVariables(binary->getRightOperand(), bound);
+            }
+            
+            case ExprKind::Call:
+               for (auto arg : llvm::cast<CallExprAST>(expression)->getArgumentList())
+                  if (hasFreeVariables(arg, bound))
+                     return true;
+               return false;
+            
+            case ExprKind::If:
+            {
+               auto ifExpr = llvm::cast<IfExprAST>(expression);
+               return hasFreeVariables(ifExpr->getCondion(), bound) || hasFreeVariables(ifExpr->getThenBranch(), bound) ||
+                      hasFreeVariables(ifExpr->getElseBranch(), bound);
+            }
+            
+            //the variable of a loop is visible after its start
+            case ExprKind::For:
+            {
+               auto forExpr = llvm::cast<ForExprAST>(expression);
+               if (hasFreeVariables(forExpr->getStart(), bound))
+                  return true;
+               bound.push_back(forExpr->getKey());
+               const bool found = hasFreeVariables(forExpr->getEnd(), bound) || hasFreeVariables(forExpr->getStep(), bound) ||
+                                  hasFreeVariables(forExpr->getBody(), bound);
+               bound.pop_back();
+               return found;
+            }
+            
+            //every initializer sees the variables before it
+            case ExprKind::Var:
+            {
+               auto varExpr = llvm::cast<VarExprAST>(expression);
+               const auto outer = bound.size();
+               bool found = false;
+               for (const auto& variable : varExpr->getVarNames())
+               {
+                  found = found || hasFreeVariables(variable.init, bound);
+                  bound.push_back(variable.name);
+               }
+               found = found || hasFreeVariables(varExpr->getBody(), bound);
+               bound.resize(outer);
+               return found;
+            }
+            
+            case ExprKind::Index:
+            {
+               auto index = llvm::cast<IndexExprAST>(expression);
+               return hasFreeVariables(index->getArray(), bound) || hasFreeVariables(index->getIndex(), bound);
+            }
+            
+            case ExprKind::Prototype:
+            case ExprKind::Function:
+               break;
+         }
+         
+         return false;
+      }
+   }
+   
+   bool isPure(const ExprAST* expression)
+   {
+      if (!expression)
+         return true;
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+         case ExprKind::Variable:
+            return true;
+         
+         case ExprKind::Binary:
+         {
+            //user defined operators are function calls
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            return isBuiltinOperator(binary->getOpcode()) &&
+                   isPure(binary->getLeftOperand()) && isPure(binary->getRightOperand());
+         }
+         
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            return isPure(ifExpr->getCondion()) && isPure(ifExpr->getThenBranch()) &&
+                   isPure(ifExpr->getElseBranch());
+         }
+         
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            for (const auto& variable : varExpr->getVarNames())
+               if (!isPure(variable.init))
+                  return false;
+            return isPure(varExpr->getBody());
+         }
+         
+         //calls, loops (might not terminate), user defined unary operators and array accesses
+         //(memory, bounds checks)
+         default:
+            return false;
+      }
+   }
+   
+   bool mentions(const ExprAST* expression, util::symbol_t symbol)
+   {
+      if (!expression)
+         return false;
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+            return false;
+         
+         case ExprKind::Variable:
+            return llvm::cast<VariableExprAST>(expression)->getSymbol() == symbol;
+         
+         case ExprKind::Unary:
+            return mentions(llvm::cast<UnaryExprAST>(expression)->getOperand(), symbol);
+         
+         case ExprKind::Binary:
+         {
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            return mentions(binary->getLeftOperand(), symbol) || mentions(binary->getRightOperand(), symbol);
+         }
+         
+         case ExprKind::Call:
+            for (auto arg : llvm::cast<CallExprAST>(expression)->getArgumentList())
+               if (mentions(arg, symbol))
+                  return true;
+            return false;
+         
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            return mentions(ifExpr->getCondion(), symbol) || mentions(ifExpr->getThenBranch(), symbol) ||
+                   mentions(ifExpr->getElseBranch(), symbol);
+         }
+         
+         case ExprKind::For:
+         {
+            auto forExpr = llvm::cast<ForExprAST>(expression);
+            return forExpr->getKey() == symbol || mentions(forExpr->getStart(), symbol) ||
+                   mentions(forExpr->getEnd(), symbol) || mentions(forExpr->getStep(), symbol) ||
+                   mentions(forExpr->getBody(), symbol);
+         }
+         
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            for (const auto& variable : varExpr->getVarNames())
+               if (variable.name == symbol || mentions(variable.init, symbol))
+                  return true;
+            return mentions(varExpr->getBody(), symbol);
+         }
+         
+         case ExprKind::Index:
+         {
+            auto index = llvm::cast<IndexExprAST>(expression);
+            return mentions(index->getArray(), symbol) || mentions(index->getIndex(), symbol);
+         }
+         
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      return false;
+   }
+   
+   void ASTOptimizer::optimize(FunctionAST& function)
+   {
+      nodes_.reset();
+      
+      //an operator calls itself, not the body of a previous definition
+      const auto& prototype = function.getPrototype();
+      function_ = prototype->getSymbol();
+      const bool isOperator = prototype->isUnary() || prototype->isBinary();
+      if (isOperator)
+         expanding_.push_back(prototype->getSymbol());
+      function.setBody(simplify(function.getBody()));
+      if (isOperator)
+         expanding_.pop_back();
+   }
+   
+   void ASTOptimizer::prepareOperator(const FunctionAST& function)
+   {
+      discardOperator();
+      const auto& prototype = function.getPrototype();
+      if (!prototype->isUnary() && !prototype->isBinary())
+         return;
+      pendingOperator_ = prototype->getSymbol();
+      
+      //the evaluation works on doubles only. A body expanded in its callers would take their
+      //floating point mode: an operator with a mode of its own is called
+      if (!prototype->isUntyped() || prototype->getFloatingPointMode() != FloatingPointMode::Session)
+         return;
+      
+      auto bound = prototype->getArgumentList();
+      if (hasFreeVariables(function.getBody(), bound))
+         return;
+      
+      pendingDefinition_ = OperatorDefinition{prototype->getArgumentList(), cloneExpression(operators_, function.getBody())};
+   }
+   
+   void ASTOptimizer::addOperator()
+   {
+      if (pendingOperator_ == util::StringInterner::invalidSymbol)
+         return;
+      
+      if (pendingDefinition_)
+         operatorDefinitions_[pendingOperator_] = *pendingDefinition_;
+      else
+         operatorDefinitions_.erase(pendingOperator_);
+      discardOperator();
+   }
+   
+   void ASTOptimizer::discardOperator()
+   {
+      pendingOperator_ = util::StringInterner::invalidSymbol;
+      pendingDefinition_ = llvm::None;
+   }
+   
+   void ASTOptimizer::setCallEvaluator(call_evaluator_t evaluator)
+   {
+      callEvaluator_ = std::move(evaluator);
+   }
+   
+   ExprAST* ASTOptimizer::simplify(ExprAST* expression)
+   {
+      if (!expression)
+         return nullptr;
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+         case ExprKind::Variable:
+            return expression;
+         
+         case ExprKind::Unary:
+         {
+            auto unary = llvm::cast<UnaryExprAST>(expression);
+            auto operand = simplify(unary->getOperand());
+            
+            const auto name = operatorSymbol("unary", unary->getOpcode());
+            if (auto number = asNumber(operand))
+               if (auto value = foldOperator(name, number->getVal()))
+                  return nodes_.create<NumberExprAST>(*value);
+            
+            if (auto expansion = expandOperator(name, operand))
+               return expansion;
+            
+            if (operand == unary->getOperand())
+               return expression;
+            return nodes_.create<UnaryExprAST>(unary->getOpcode(), operand);
+         }
+         
+         case ExprKind::Binary:
+            return simplifyBinary(llvm::cast<BinaryExprAST>(expression));
+         
+         case ExprKind::Call:
+         {
+            auto call = llvm::cast<CallExprAST>(expression);
+            std::vector<ExprAST*> args;
+            bool changed = false;
+            for (auto arg : call->getArgumentList())
+            {
+               args.push_back(simplify(arg));
+               changed |= args.back() != arg;
+            }
+            
+            //a call to the function being defined runs the new body, not compiled yet
+            if (callEvaluator_ && call->getCallee() != function_)
+            {
+               std::vector<double> constants;
+               for (auto arg : args)
+                  if (auto number = asNumber(arg))
+                     constants.push_back(number->getVal());
+               if (constants.size() == args.size())
+                  if (auto value = callEvaluator_(call->getCallee(), constants))
+                     return nodes_.create<NumberExprAST>(*value);
+            }
+            
+            if (!changed)
+               return expression;
+            return nodes_.create<CallExprAST>(call->getCallee(), nodes_.copy(args));
+         }
+         
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            auto cond = simplify(ifExpr->getCondion());
+            
+            //only the branch taken is emitted
+            if (auto number = asNumber(cond))
+               return simplify(isTrue(number->getVal()) ? ifExpr->getThenBranch() : ifExpr->getElseBranch());
+            
+            auto thenBranch = simplify(ifExpr->getThenBranch());
+            auto elseBranch = simplify(ifExpr->getElseBranch());
+            if (cond == ifExpr->getCondion() && thenBranch == ifExpr->getThenBranch() &&
+                elseBranch == ifExpr->getElseBranch())
+               return expression;
+            return nodes_.create<IfExprAST>(cond, thenBranch, elseBranch);
+         }
+         
+         case ExprKind::For:
+            return simplifyFor(llvm::cast<ForExprAST>(expression));
+         
+         case ExprKind::Var:
+            return simplifyVar(llvm::cast<VarExprAST>(expression));
+         
+         case ExprKind::Index:
+         {
+            auto index = llvm::cast<IndexExprAST>(expression);
+            auto position = simplify(index->getIndex());
+            if (position == index->getIndex())
+               return expression;
+            return nodes_.create<IndexExprAST>(index->getArray(), position);
+         }
+         
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      return expression;
+   }
+   
+   ExprAST* ASTOptimizer::simplifyBinary(BinaryExprAST* binary)
+   {
+      const auto op = binary->getOpcode();
+      
+      //the destination of an assignment stays a variable (or an array element)
+      auto lhs = op == '=' && !llvm::isa<IndexExprAST>(binary->getLeftOperand()) ? binary->getLeftOperand()
+                                                                                  : simplify(binary->getLeftOperand());
+      auto rhs = simplify(binary->getRightOperand());
+      auto leftNumber = asNumber(lhs);
+      auto rightNumber = asNumber(rhs);
+      
+      if (leftNumber && rightNumber)
+      {
+         if (isBuiltinOperator(op))
+            return nodes_.create<NumberExprAST>(evaluateBuiltin(op, leftNumber->getVal(), rightNumber->getVal()));
+         
+         double operands[] = {leftNumber->getVal(), rightNumber->getVal()};
+         if (auto value = foldOperator(operatorSymbol("binary", op), operands))
+            return nodes_.create<NumberExprAST>(*value);
+      }
+      
+      if (op != '=' && !isBuiltinOperator(op))
+      {
+         ExprAST* operands[] = {lhs, rhs};
+         if (auto expansion = expandOperator(operatorSymbol("binary", op), operands))
+            return expansion;
+      }
+      
+      //identities holding for every double, signed zeros and NaNs included
+      if (rightNumber)
+      {
+         const double value = rightNumber->getVal();
+         if ((op == '*' && value == 1.0) ||
+             (op == '-' && value == 0.0 && !std::signbit(value)) ||
+             (op == '+' && value == 0.0 && std::signbit(value)))
+            return lhs;
+      }
+      
+      if (leftNumber)
+      {
+         const double value = leftNumber->getVal();
+         if ((op == '*' && value == 1.0) || (op == '+' && value == 0.0 && std::signbit(value)))
+            return rhs;
+      }
+      
+      if (lhs == binary->getLeftOperand() && rhs == binary->getRightOperand())
+         return binary;
+      return nodes_.create<BinaryExprAST>(op, lhs, rhs);
+   }
+   
+   ExprAST* ASTOptimizer::simplifyFor(ForExprAST* forExpr)
+   {
+      auto start = simplify(forExpr->getStart());
+      auto end = simplify(forExpr->getEnd());
+      auto step = simplify(forExpr->getStep());
+      auto body = simplify(forExpr->getBody());
+      
+      //the end condition is tested after the body: a false constant runs the body (and the step) once.
+      //var key = start, $body = body, $step = step in 0.0 evaluates them in the same order
+      //(in $body for a reduction: one value combined with the identity is the value itself)
+      if (auto number = asNumber(end))
+      {
+         if (!isTrue(number->getVal()))
+         {
+            const auto bodyName = util::intern("$body");
+            std::vector<VarExprAST::variable_t> variables {
+               VarExprAST::variable_t{forExpr->getKey(), start, ValueType::Auto},
+               VarExprAST::variable_t{bodyName, body, ValueType::Auto}
+            };
+            if (step)
+               variables.push_back(VarExprAST::variable_t{util::intern("$step"), step, ValueType::Auto});
+            
+            ExprAST* value = nodes_.create<NumberExprAST>(0.0);
+            if (forExpr->getReduction() != Reduction::None)
+               value = nodes_.create<VariableExprAST>(bodyName);
+            auto once = nodes_.create<VarExprAST>(nodes_.copy(variables), value);
+            return simplifyVar(once);
+         }
+      }
+      
+      if (start == forExpr->getStart() && end == forExpr->getEnd() && step == forExpr->getStep() &&
+          body == forExpr->getBody())
+         return forExpr;
+      return nodes_.create<ForExprAST>(forExpr->getKey(), start, end, step, body, forExpr->getReduction());
+   }
+   
+   ExprAST* ASTOptimizer::simplifyVar(VarExprAST* varExpr)
+   {
+      const auto variables = varExpr->getVarNames();
+      
+      std::vector<VarExprAST::variable_t> simplified;
+      bool changed = false;
+      for (const auto& variable : variables)
+      {
+         simplified.push_back(VarExprAST::variable_t{variable.name, simplify(variable.init), variable.type});
+         changed |= simplified.back().init != variable.init;
+      }
+      
+      auto body = simplify(varExpr->getBody());
+      changed |= body != varExpr->getBody();
+      
+      //a binding is dead when nothing after it refers to its name and its init has no side effect.
+      //Walk backward so that the inits of dead bindings do not keep the previous ones alive
+      std::vector<VarExprAST::variable_t> live;
+      for (size_t i = simplified.size(); i-- > 0; )
+      {
+         const auto name = simplified[i].name;
+         bool used = mentions(body, name);
+         for (size_t j = 0; j < live.size() && !used; ++j)
+            used = mentions(live[j].init, name);
+         
+         if (used || !isPure(simplified[i].init))
+            live.push_back(simplified[i]);
+      }
+      std::reverse(live.begin(), live.end());
+      
+      if (live.empty())
+         return body;
+      
+      if (!changed && live.size() == simplified.size())
+         return varExpr;
+      return nodes_.create<VarExprAST>(nodes_.copy(live), body);
+   }
+   
+   llvm::Optional<double> ASTOptimizer::foldOperator(util::symbol_t name, llvm::ArrayRef<double> operands)
+   {
+      auto definition = operatorDefinitions_.find(name);
+      if (definition == operatorDefinitions_.end() || definition->second.args.size() != operands.size())
+         return llvm::None;
+      
+      if (evaluationDepth_ == 0)
+         evaluationSteps_ = 0;
+      if (evaluationDepth_ == maxEvaluationDepth)
+         return llvm::None;
+      
+      //the body of the operator only sees its arguments
+      const auto savedFrameBase = frameBase_;
+      const auto savedSize = environment_.size();
+      frameBase_ = savedSize;
+      for (size_t i = 0; i < operands.size(); ++i)
+         environment_.push_back(std::make_pair(definition->second.args[i], operands[i]));
+      
+      ++evaluationDepth_;
+      auto value = evaluate(definition->second.body);
+      --evaluationDepth_;
+      
+      environment_.resize(savedSize);
+      frameBase_ = savedFrameBase;
+      return value;
+   }
+   
+   ExprAST* ASTOptimizer::expandOperator(util::symbol_t name, llvm::ArrayRef<ExprAST*> operands)
+   {
+      auto definition = operatorDefinitions_.find(name);
+      if (definition == operatorDefinitions_.end() || definition->second.args.size() != operands.size() ||
+          std::find(expanding_.begin(), expanding_.end(), name) != expanding_.end())
+         return nullptr;
+      
+      //a call evaluates the operands in order, converted to double, then the body in a scope of
+      //its own. Binding a parameter before evaluating the next operand would let the operand see
+      //it: all the operands but the last are evaluated in '$' names first, out of reach of the
+      //source. The value converted to double keeps the type of the call:
+      //var $0:f64 = lhs, b:f64 = rhs, a:f64 = $0, $result:f64 = body in $result
+      const auto& args = definition->second.args;
+      std::vector<VarExprAST::variable_t> variables;
+      for (size_t i = 0; i + 1 < operands.size(); ++i)
+         variables.push_back(VarExprAST::variable_t{util::intern("$" + std::to_string(i)), operands[i],
+                                                    ValueType::F64});
+      variables.push_back(VarExprAST::variable_t{args.back(), operands.back(), ValueType::F64});
+      for (size_t i = 0; i + 1 < operands.size(); ++i)
+         variables.push_back(VarExprAST::variable_t{args[i], nodes_.create<VariableExprAST>(variables[i].name),
+                                                    ValueType::F64});
+      
+      //the body is simplified with its operator out of reach: a recursive operator is called
+      expanding_.push_back(name);
+      const auto resultName = util::intern("$result");
+      variables.push_back(VarExprAST::variable_t{resultName, simplify(cloneExpression(nodes_, definition->second.body)),
+                                                 ValueType::F64});
+      expanding_.pop_back();
+      
+      return nodes_.create<VarExprAST>(nodes_.copy(variables), nodes_.create<VariableExprAST>(resultName));
+   }
+   
+   llvm::Optional<double> ASTOptimizer::evaluate(const ExprAST* expression)
+   {
+      if (!expression || ++evaluationSteps_ > maxEvaluationSteps)
+         return llvm::None;
+      
+      auto lookup = [this](util::symbol_t symbol) -> binding_t* {
+         for (auto i = environment_.size(); i > frameBase_; --i)
+            if (environment_[i - 1].first == symbol)
+               return &environment_[i - 1];
+         return nullptr;
+      };
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+            return llvm::cast<NumberExprAST>(expression)->getVal();
+         
+         case ExprKind::Variable:
+         {
+            auto binding = lookup(llvm::cast<VariableExprAST>(expression)->getSymbol());
+            if (!binding)
+               return llvm::None;
+            return binding->second;
+         }
+         
+         case ExprKind::Unary:
+         {
+            auto unary = llvm::cast<UnaryExprAST>(expression);
+            auto operand = evaluate(unary->getOperand());
+            if (!operand)
+               return llvm::None;
+            return foldOperator(operatorSymbol("unary", unary->getOpcode()), *operand);
+         }
+         
+         case ExprKind::Binary:
+         {
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            const auto op = binary->getOpcode();
+            
+            if (op == '=')
+            {
+               auto destination = llvm::dyn_cast<VariableExprAST>(binary->getLeftOperand());
+               auto value = evaluate(binary->getRightOperand());
+               auto binding = destination ? lookup(destination->getSymbol()) : nullptr;
+               if (!value || !binding)
+                  return llvm::None;
+               binding->second = *value;
+               return value;
+            }
+            
+            auto lhs = evaluate(binary->getLeftOperand());
+            if (!lhs)
+               return llvm::None;
+            auto rhs = evaluate(binary->getRightOperand());
+            if (!rhs)
+               return llvm::None;
+            
+            if (isBuiltinOperator(op))
+               return evaluateBuiltin(op, *lhs, *rhs);
+            
+            double operands[] = {*lhs, *rhs};
+            return foldOperator(operatorSymbol("binary", op), operands);
+         }
+         
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            auto cond = evaluate(ifExpr->getCondion());
+            if (!cond)
+               return llvm::None;
+            return evaluate(isTrue(*cond) ? ifExpr->getThenBranch() : ifExpr->getElseBranch());
+         }
+         
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            const auto savedSize = environment_.size();
+            
+            llvm::Optional<double> value;
+            for (const auto& variable : varExpr->getVarNames())
+            {
+               //only doubles are evaluated
+               if (variable.type != ValueType::Auto && variable.type != ValueType::F64)
+                  break;
+               auto init = variable.init ? evaluate(variable.init) : llvm::Optional<double>(0.0);
+               if (!init)
+                  break;
+               environment_.push_back(std::make_pair(variable.name, *init));
+            }
+            
+            if (environment_.size() - savedSize == varExpr->getVarNames().size())
+               value = evaluate(varExpr->getBody());
+            
+            environment_.resize(savedSize);
+            return value;
+         }
+         
+         //calls have side effects (or are unknown), loops are left to the code generator
+         default:
+            return llvm::None;
+      }
+   }
+}
@@ -0,0 +1,122 @@
+//
+//  ASTOptimizer.h
+//  Kaleidoscope-LLVM
+//
+//  simplification of the expression tree between parsing and code generation:
+//  constant folding, constant conditions, dead 'var' bindings, loops running once and
+//  inline expansion of user defined operators
+//
+
+#ifndef ASTOptimizer_h
+#define ASTOptimizer_h
+
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/Optional.h"
+
+#include "AST.h"
+#include "Interner.h"
+
+namespace optimizer
+{
+   ///
+   /// @brief: rewrites a function body into a simpler tree computing the same value with the
+   ///         same side effects. New nodes are allocated in an arena of the optimizer, untouched
+   ///         nodes are shared with the tree passed.
+   ///         User defined operators are folded when their operands are constant and their body
+   ///         can be evaluated without side effects (no calls, no loops), otherwise their body
+   ///         is expanded at the use site. Calls to other functions with constant arguments are
+   ///         folded by the call evaluator, if any
+   ///
+   class ASTOptimizer
+   {
+   public:
+      
+      ASTOptimizer() = default;
+      ASTOptimizer(const ASTOptimizer&) = delete;
+      ASTOptimizer& operator=(const ASTOptimizer&) = delete;
+      
+      ///
+      /// @brief: simplify the body of the function passed. The nodes created for the previous
+      ///         function are released, so its body must have been code generated already
+      ///
+      void optimize(AST::FunctionAST& function);
+      
+      ///
+      /// @brief: remember the body of a user defined operator to evaluate it at compile time
+      ///         and expand it in the next functions. The body is copied before the code
+      ///         generation, which takes the prototype, and used once the operator is generated:
+      ///         addOperator then, discardOperator when the generation failed. A redefinition
+      ///         replaces the previous one. A body naming variables other than its parameters
+      ///         and its own 'var' and 'for' variables stays a call: expanded, it would read the
+      ///         variables of its caller
+      ///
+      void prepareOperator(const AST::FunctionAST& function);
+      void addOperator();
+      void discardOperator();
+      
+      AST::ExprAST* simplify(AST::ExprAST* expression);
+      
+      ///
+      /// @brief: value of callee(arguments) known at compile time, None to keep the call
+      ///
+      using call_evaluator_t = std::function<llvm::Optional<double>(util::symbol_t callee, llvm::ArrayRef<double> arguments)>;
+      void setCallEvaluator(call_evaluator_t evaluator);
+   
+   private:
+      
+      struct OperatorDefinition
+      {
+         std::vector<util::symbol_t> args;
+         const AST::ExprAST* body;
+      };
+      
+      using binding_t = std::pair<util::symbol_t, double>;
+      
+      AST::ASTContext nodes_;      //nodes of the function being optimized
+      AST::ASTContext operators_;  //bodies of the operators, live for the whole session
+      std::unordered_map<util::symbol_t, OperatorDefinition> operatorDefinitions_;
+      util::symbol_t pendingOperator_ = util::StringInterner::invalidSymbol; //operator being generated
+      llvm::Optional<OperatorDefinition> pendingDefinition_; //its body, None when it is called
+      std::vector<util::symbol_t> expanding_; //operators whose body is being simplified in place
+      util::symbol_t function_ = util::StringInterner::invalidSymbol; //function being optimized
+      call_evaluator_t callEvaluator_;
+      
+      //compile time evaluation state
+      std::vector<binding_t> environment_;
+      size_t frameBase_ = 0;
+      unsigned evaluationDepth_ = 0;
+      unsigned evaluationSteps_ = 0;
+      
+      AST::ExprAST* simplifyBinary(AST::BinaryExprAST* binary);
+      AST::ExprAST* simplifyFor(AST::ForExprAST* forExpr);
+      AST::ExprAST* simplifyVar(AST::VarExprAST* varExpr);
+      
+      ///
+      /// @brief: value of a call to a user defined operator with constant operands, if any
+      ///
+      llvm::Optional<double> foldOperator(util::symbol_t name, llvm::ArrayRef<double> operands);
+      
+      ///
+      /// @brief: the body of a user defined operator in place of its call, nullptr when the
+      ///         operator is unknown (or typed) or already being expanded (recursion)
+      ///
+      AST::ExprAST* expandOperator(util::symbol_t name, llvm::ArrayRef<AST::ExprAST*> operands);
+      llvm::Optional<double> evaluate(const AST::ExprAST* expression);
+   };
+   
+   ///
+   /// @brief: the expression has no side effects and always terminates
+   ///
+   bool isPure(const AST::ExprAST* expression);
+   
+   ///
+   /// @brief: the symbol is read or assigned somewhere in the expression
+   ///
+   bool mentions(const AST::ExprAST* expression, util::symbol_t symbol);
+}
+
+#endif /* ASTOptimizer_h */
@@ -0,0 +1,28 @@
+//
+//  Builtins.cpp
+//  Kaleidoscope-LLVM
+//
+//  functions provided by the compiler, emitted inline by the code generator
+//
+
+#include "Builtins.h"
+
+#include "llvm/ADT/StringSwitch.h"
+
+namespace AST
+{
+   Builtin getBuiltin(util::symbol_t name)
+   {
+      return llvm::StringSwitch<Builtin>(util::symbolName(name))
+         .Case("len", Builtin::Len)
+         .Case("vec2", Builtin::Vec2)
+         .Case("vec4", Builtin::Vec4)
+         .Case("vec8", Builtin::Vec8)
+         .Case("select", Builtin::Select)
+         .Case("shuffle", Builtin::Shuffle)
+         .Case("hadd", Builtin::HorizontalAdd)
+         .Case("hmin", Builtin::HorizontalMin)
+         .Case("hmax", Builtin::HorizontalMax)
+         .Default(Builtin::None);
+   }
+}
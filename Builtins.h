@@ -0,0 +1,43 @@
+//
+//  Builtins.h
+//  Kaleidoscope-LLVM
+//
+//  functions provided by the compiler, emitted inline by the code generator
+//
+
+#ifndef Builtins_h
+#define Builtins_h
+
+#include <cstdint>
+
+#include "Interner.h"
+
+namespace AST
+{
+   ///
+   /// @brief: builtin functions. A builtin is called like a function and is only used
+   ///         when the program doesn't define or declare a function of the same name.
+   ///         len(array):               number of elements of an array
+   ///         vec2/vec4/vec8(x...):     vector of its lanes, or of one value repeated
+   ///         select(mask, a, b):       lane-wise a where the mask is not zero, b elsewhere
+   ///         shuffle(v, lane...):      vector of the lanes of v picked by constant indices
+   ///         hadd/hmin/hmax(v):        sum, minimum, maximum of the lanes of a vector
+   ///
+   enum class Builtin : std::uint8_t
+   {
+      None,
+      Len,
+      Vec2,
+      Vec4,
+      Vec8,
+      Select,
+      Shuffle,
+      HorizontalAdd,
+      HorizontalMin,
+      HorizontalMax
+   };
+   
+   Builtin getBuiltin(util::symbol_t name);
+}
+
+#endif /* Builtins_h */
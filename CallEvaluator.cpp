@@ -0,0 +1,189 @@
+//
+//  CallEvaluator.cpp
+//  Kaleidoscope-LLVM
+//
+//  compile time evaluation of calls to pure definitions with constant arguments, through the jit
+//
+
+#include "CallEvaluator.h"
+
+#include <vector>
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace jit
+{
+   namespace
+   {
+      ///
+      /// @brief: the calls run on the stack of the compiler, a few hundred kilobytes at most
+      ///
+      const std::int64_t maxDepth = 10000;
+      
+      ///
+      /// @brief: the counters of an evaluation: steps left, calls in progress, most calls in
+      ///         progress at once
+      ///
+      struct Counters
+      {
+         llvm::GlobalVariable* budget;
+         llvm::GlobalVariable* depth;
+         llvm::GlobalVariable* deepest;
+      };
+      
+      ///
+      /// @brief: the budget left after the step built by the caller before the insertion point,
+      ///         returning at once (any value, the call isn't folded) when it is negative
+      ///
+      void emitStep(llvm::Instruction* position, llvm::function_ref<llvm::Value*(llvm::IRBuilder<>&)> step)
+      {
+         auto block = position->getParent();
+         auto& function = *block->getParent();
+         auto rest = block->splitBasicBlock(position, block->getName() + ".step");
+         auto exhausted = llvm::BasicBlock::Create(function.getContext(), "exhausted", &function);
+         
+         llvm::IRBuilder<> builder(block->getTerminator());
+         auto left = step(builder);
+         builder.CreateCondBr(builder.CreateICmpSLT(left, builder.getInt64(0)), exhausted, rest);
+         block->getTerminator()->eraseFromParent();
+         
+         builder.SetInsertPoint(exhausted);
+         if (function.getReturnType()->isVoidTy())
+            builder.CreateRetVoid();
+         else
+            builder.CreateRet(llvm::UndefValue::get(function.getReturnType()));
+      }
+      
+      ///
+      /// @brief: budget -= 1
+      ///
+      llvm::Value* emitIteration(llvm::IRBuilder<>& builder, const Counters& counters)
+      {
+         auto left = builder.CreateSub(builder.CreateLoad(counters.budget), builder.getInt64(1));
+         builder.CreateStore(left, counters.budget);
+         return left;
+      }
+      
+      ///
+      /// @brief: budget -= 1, depth += 1. Past maxDepth the budget is spent: the calls in progress
+      ///         return at their next step
+      ///
+      llvm::Value* emitEntry(llvm::IRBuilder<>& builder, const Counters& counters)
+      {
+         auto depth = builder.CreateAdd(builder.CreateLoad(counters.depth), builder.getInt64(1));
+         builder.CreateStore(depth, counters.depth);
+         auto deepest = builder.CreateLoad(counters.deepest);
+         builder.CreateStore(builder.CreateSelect(builder.CreateICmpSGT(depth, deepest), depth, deepest), counters.deepest);
+         
+         auto left = builder.CreateSub(builder.CreateLoad(counters.budget), builder.getInt64(1));
+         left = builder.CreateSelect(builder.CreateICmpSGT(depth, builder.getInt64(maxDepth)), builder.getInt64(-1), left);
+         builder.CreateStore(left, counters.budget);
+         return left;
+      }
+      
+      ///
+      /// @brief: a step at the entry and at the back-edges (branches to a block dominating the
+      ///         branch), depth -= 1 at the returns
+      ///
+      void instrumentSteps(llvm::Function& function, const Counters& counters)
+      {
+         llvm::DominatorTree dominators(function);
+         std::vector<llvm::Instruction*> latches;
+         std::vector<llvm::Instruction*> returns;
+         for (auto& block : function)
+         {
+            if (llvm::isa<llvm::ReturnInst>(block.getTerminator()))
+               returns.push_back(block.getTerminator());
+            for (auto successor : llvm::successors(&block))
+               if (dominators.dominates(successor, &block))
+               {
+                  latches.push_back(block.getTerminator());
+                  break;
+               }
+         }
+         
+         for (auto latch : latches)
+            emitStep(latch, [&](llvm::IRBuilder<>& builder) { return emitIteration(builder, counters); });
+         emitStep(&*function.getEntryBlock().getFirstInsertionPt(),
+                  [&](llvm::IRBuilder<>& builder) { return emitEntry(builder, counters); });
+         
+         for (auto ret : returns)
+         {
+            llvm::IRBuilder<> builder(ret);
+            builder.CreateStore(builder.CreateSub(builder.CreateLoad(counters.depth), builder.getInt64(1)), counters.depth);
+         }
+      }
+   }
+   
+   CallEvaluator::CallEvaluator(JIT& jit, std::uint64_t budget) :
+   jit_(jit),
+   budget_(budget),
+   evaluations_(0)
+   {}
+   
+   llvm::Optional<double> CallEvaluator::evaluate(std::unique_ptr<llvm::Module> module, const std::string& name,
+                                                  llvm::ArrayRef<double> arguments)
+   {
+      auto callee = module->getFunction(name);
+      if (!callee || callee->isDeclaration() || callee->arg_size() != arguments.size() ||
+          !callee->getReturnType()->isDoubleTy())
+         return llvm::None;
+      for (const auto& argument : callee->args())
+         if (!argument.getType()->isDoubleTy())
+            return llvm::None;
+      
+      //the copies stay private to the module: the definitions of the session keep their symbols
+      const auto prefix = "__const_eval." + std::to_string(++evaluations_);
+      auto& context = module->getContext();
+      auto int64 = llvm::Type::getInt64Ty(context);
+      const auto counter = [&](const char* name, std::uint64_t value) {
+         return new llvm::GlobalVariable(*module, int64, false, llvm::GlobalValue::ExternalLinkage,
+                                         llvm::ConstantInt::get(int64, value), prefix + name);
+      };
+      const Counters counters{counter(".budget", budget_), counter(".depth", 0), counter(".deepest", 0)};
+      for (auto& function : *module)
+         if (!function.isDeclaration())
+         {
+            function.setLinkage(llvm::GlobalValue::InternalLinkage);
+            instrumentSteps(function, counters);
+         }
+      
+      //double prefix(): the call with its constant arguments
+      auto entry = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getDoubleTy(context), false),
+                                          llvm::Function::ExternalLinkage, prefix, module.get());
+      llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", entry));
+      std::vector<llvm::Value*> constants;
+      for (const auto argument : arguments)
+         constants.push_back(llvm::ConstantFP::get(builder.getDoubleTy(), argument));
+      builder.CreateRet(builder.CreateCall(callee, constants));
+      
+      auto handle = jit_.addModule(module);
+      auto call = reinterpret_cast<double (*)()>(jit_.getSymbolAddress(prefix));
+      const auto value = call();
+      const auto left = *reinterpret_cast<const std::int64_t*>(jit_.getSymbolAddress(prefix + ".budget"));
+      const auto deepest = *reinterpret_cast<const std::int64_t*>(jit_.getSymbolAddress(prefix + ".deepest"));
+      jit_.removeModule(handle);
+      
+      llvm::errs() << "note: " << name << "(";
+      for (size_t i = 0; i < arguments.size(); ++i)
+         llvm::errs() << (i ? ", " : "") << arguments[i];
+      if (deepest > maxDepth)
+      {
+         llvm::errs() << ") not folded: more than " << maxDepth << " nested calls\n";
+         return llvm::None;
+      }
+      if (left < 0)
+      {
+         llvm::errs() << ") not folded: more than " << budget_ << " steps\n";
+         return llvm::None;
+      }
+      llvm::errs() << ") folded to " << value << " in " << budget_ - left << " steps\n";
+      return value;
+   }
+}
@@ -0,0 +1,61 @@
+//
+//  CallEvaluator.h
+//  Kaleidoscope-LLVM
+//
+//  compile time evaluation of calls to pure definitions with constant arguments, through the jit
+//
+
+#ifndef CallEvaluator_h
+#define CallEvaluator_h
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+
+#include "JIT.h"
+
+namespace llvm {
+   class Module;
+}
+
+namespace jit
+{
+   ///
+   /// @brief: runs a call with constant arguments on a copy of the callee and of the definitions
+   ///         it calls, compiled apart. Purity doesn't prove termination: every copy counts its
+   ///         entries and loop iterations in a shared budget of steps and returns at once when the
+   ///         budget is spent, the call is not folded then. The calls run on the stack of the
+   ///         compiler: the nested ones are limited too, a deep recursion spends the budget.
+   ///         Every call folded or not is reported
+   ///
+   class CallEvaluator
+   {
+   public:
+      
+      ///
+      /// @brief: budget up to INT64_MAX steps, the globals counting them are signed
+      ///
+      explicit CallEvaluator(JIT& jit, std::uint64_t budget);
+      CallEvaluator(const CallEvaluator&) = delete;
+      CallEvaluator& operator=(const CallEvaluator&) = delete;
+      
+      ///
+      /// @brief: value of name(arguments), the definitions of module (see CodeGenerator::extractDefinition).
+      ///         None when the signature isn't doubles to double, the budget runs out or
+      ///         the calls nest too deep
+      ///
+      llvm::Optional<double> evaluate(std::unique_ptr<llvm::Module> module, const std::string& name,
+                                      llvm::ArrayRef<double> arguments);
+   
+   private:
+      
+      JIT& jit_;
+      const std::uint64_t budget_;
+      unsigned evaluations_;
+   };
+}
+
+#endif /* CallEvaluator_h */
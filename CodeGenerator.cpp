@@ -8,6 +8,8 @@
 
 #include "CodeGenerator.h"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 #include <map>
 #include <string>
@@ -15,13 +17,22 @@
 
 #include "Parser.h"
 #include "AST.h"
+#include "Builtins.h"
 #include "JIT.h"
+#include "FlatAST.h"
+#include "Purity.h"
 
+#include "llvm/ADT/APSInt.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/Support/raw_ostream.h"
 
 
 using llvm::Value;
@@ -33,6 +44,185 @@ using namespace AST;
 
 namespace code_generator
 {
+   namespace
+   {
+      ///
+      /// @brief: the constant keeps its value in the type passed
+      ///
+      bool isRepresentable(const llvm::Constant* constant, const llvm::Type* type)
+      {
+         if (!type->isIntegerTy())
+            return true;
+         
+         const auto bits = type->getIntegerBitWidth();
+         if (auto integer = llvm::dyn_cast<llvm::ConstantInt>(constant))
+            return integer->getValue().getMinSignedBits() <= bits;
+         
+         auto number = llvm::dyn_cast<llvm::ConstantFP>(constant);
+         if (!number || !number->getValueAPF().isInteger())
+            return false;
+         
+         llvm::APSInt value(bits, false);
+         bool isExact = false;
+         return number->getValueAPF().convertToInteger(value, llvm::APFloat::rmTowardZero, &isExact) ==
+                llvm::APFloat::opOK;
+      }
+      
+      ///
+      /// @brief: the bound of an end condition 'variable < bound', nullptr for other conditions
+      ///
+      const ExprAST* getUpperBound(const ForExprAST* forExpr)
+      {
+         auto compare = llvm::dyn_cast<BinaryExprAST>(forExpr->getEnd());
+         if (!compare || compare->getOpcode() != '<')
+            return nullptr;
+         
+         auto variable = llvm::dyn_cast<VariableExprAST>(compare->getLeftOperand());
+         if (!variable || variable->getSymbol() != forExpr->getKey())
+            return nullptr;
+         return compare->getRightOperand();
+      }
+      
+      ///
+      /// @brief: name of the builtin length of an array, 'len(array)'
+      ///
+      util::symbol_t lenSymbol()
+      {
+         static const auto symbol = util::intern("len");
+         return symbol;
+      }
+      
+      ///
+      /// @brief: the array of a bound 'len(array)' or 'len(array) - offset', with offset a literal
+      ///
+      const VariableExprAST* getBoundArray(const ExprAST* bound, double& offset)
+      {
+         offset = 0.0;
+         if (auto difference = llvm::dyn_cast_or_null<BinaryExprAST>(bound))
+         {
+            auto number = llvm::dyn_cast<NumberExprAST>(difference->getRightOperand());
+            if (difference->getOpcode() != '-' || !number)
+               return nullptr;
+            offset = number->getVal();
+            bound = difference->getLeftOperand();
+         }
+         
+         auto call = llvm::dyn_cast_or_null<CallExprAST>(bound);
+         if (!call || getBuiltin(call->getCallee()) != Builtin::Len || call->getArgumentList().size() != 1)
+            return nullptr;
+         return llvm::dyn_cast<VariableExprAST>(call->getArgumentList()[0]);
+      }
+      
+      ///
+      /// @brief: the calls whose value is the value of the expression: the expression itself,
+      ///         the branches of an 'if' and the body of a 'var' in tail position
+      ///
+      void collectTailCalls(const ExprAST* expression, llvm::DenseSet<const void*>& calls)
+      {
+         if (!expression)
+            return;
+         
+         if (auto ifExpr = llvm::dyn_cast<IfExprAST>(expression))
+         {
+            collectTailCalls(ifExpr->getThenBranch(), calls);
+            collectTailCalls(ifExpr->getElseBranch(), calls);
+         }
+         else if (auto varExpr = llvm::dyn_cast<VarExprAST>(expression))
+            collectTailCalls(varExpr->getBody(), calls);
+         else if (llvm::isa<CallExprAST>(expression))
+            calls.insert(expression);
+      }
+      
+      ///
+      /// @brief: PurityAnalysis::getSpeculationCost of a flat node
+      ///
+      llvm::Optional<unsigned> getSpeculationCost(const FlatAST& flat, node_index_t index,
+                                                  const optimizer::PurityAnalysis& purity)
+      {
+         if (index == FlatAST::noNode)
+            return 0u;
+         
+         const auto& node = flat.getNode(index);
+         auto operands = flat.getOperands(index);
+         llvm::Optional<unsigned> cost;
+         switch (node.kind)
+         {
+            case ExprKind::Number:
+               return 0u;
+            
+            case ExprKind::Variable:
+               return 1u;
+            
+            case ExprKind::Unary:
+               cost = purity.getSpeculatedCallCost(operatorSymbol("unary", node.opcode));
+               break;
+            
+            case ExprKind::Binary:
+               if (node.opcode == '=')
+                  return llvm::None;
+               if (node.opcode == '+' || node.opcode == '-' || node.opcode == '*' || node.opcode == '<')
+                  cost = 1u;
+               else
+                  cost = purity.getSpeculatedCallCost(operatorSymbol("binary", node.opcode));
+               break;
+            
+            case ExprKind::Call:
+               cost = purity.getSpeculatedCallCost(flat.getSymbol(index));
+               break;
+            
+            case ExprKind::If:
+               cost = 1u;
+               break;
+            
+            //[name, type, init]... [body]: only the initializers and the body are nodes
+            case ExprKind::Var:
+            {
+               cost = 0u;
+               std::vector<node_index_t> nodes;
+               for (size_t i = 0; i + 1 < operands.size(); i += 3)
+                  nodes.push_back(operands[i + 2]);
+               nodes.push_back(operands.back());
+               for (auto operand : nodes)
+               {
+                  auto operandCost = getSpeculationCost(flat, operand, purity);
+                  if (!operandCost)
+                     return llvm::None;
+                  *cost += *operandCost;
+               }
+               return cost;
+            }
+            
+            default:
+               return llvm::None;
+         }
+         
+         if (!cost)
+            return llvm::None;
+         for (auto operand : operands)
+         {
+            auto operandCost = getSpeculationCost(flat, operand, purity);
+            if (!operandCost)
+               return llvm::None;
+            *cost += *operandCost;
+         }
+         return cost;
+      }
+      
+      void collectTailCalls(const FlatAST& flat, node_index_t index, llvm::DenseSet<const void*>& calls)
+      {
+         const auto& node = flat.getNode(index);
+         const auto operands = flat.getOperands(index);
+         if (node.kind == ExprKind::If)
+         {
+            collectTailCalls(flat, operands[1], calls);
+            collectTailCalls(flat, operands[2], calls);
+         }
+         else if (node.kind == ExprKind::Var)
+            collectTailCalls(flat, operands.back(), calls);
+         else if (node.kind == ExprKind::Call)
+            calls.insert(&node);
+      }
+   }
    
    ///
    /// return a reference to the internal map that holds all the operators
@@ -60,7 +250,7 @@ namespace code_generator
    }
    
    
-   void CodeGeneratorImpl::addProtypeCache(const std::string& key, std::unique_ptr<PrototypeAST>& prototype)
+   void CodeGeneratorImpl::addProtypeCache(util::symbol_t key, std::unique_ptr<PrototypeAST>& prototype)
    {
       //mmm... hugly
       prototypeCache_[key] = std::move(prototype);
@@ -69,11 +259,9 @@ namespace code_generator
    void CodeGeneratorImpl::InitializeModuleAndPassManager()
    {
       module_ = std::make_unique<llvm::Module>("hacking", context_);
-      optimizer_->enablePrematureOptimization(module_.get());
-
       module_->setDataLayout(jitCompiler_.getTargetMachine().createDataLayout());
    }
-
+   
    ///
    /// ctor of the code generator
    ///
@@ -83,11 +271,36 @@ namespace code_generator
       jitCompiler_(jitCompiler),
       module_(nullptr),
       builder_(context_),
-      optimizer_(std::make_unique<optimizer::Optimizer>())
+      optimizer_(std::make_unique<optimizer::Optimizer>(optimizer::OptimizationLevel::O2,
+                                                        &jitCompiler.getTargetMachine()))
    {
       //InitializeModuleAndPassManager();
    }
    
+   void CodeGeneratorImpl::exportDefinition(const Function& definition)
+   {
+      library_.add(definition);
+   }
+   
+   std::unique_ptr<llvm::Module> CodeGeneratorImpl::extractDefinition(const std::string& name) const
+   {
+      auto module = library_.extract(name);
+      if (module)
+         module->setDataLayout(jitCompiler_.getTargetMachine().createDataLayout());
+      return module;
+   }
+   
+   void CodeGeneratorImpl::setOptimizationLevel(optimizer::OptimizationLevel level)
+   {
+      if (level != optimizer_->getLevel())
+         optimizer_ = std::make_unique<optimizer::Optimizer>(level, &jitCompiler_.getTargetMachine());
+   }
+   
+   bool CodeGeneratorImpl::optimizeModule()
+   {
+      return optimizer_->optimizeModule(*module_);
+   }
+   
    Value* CodeGeneratorImpl::errorV(const std::string& errorMsg) const
    {
       std::cerr << errorMsg << std::endl;
@@ -96,121 +309,598 @@ namespace code_generator
    
    Value* CodeGeneratorImpl::codeGenNumberExpr(const NumberExprAST* numExpr)
    {
-      return llvm::ConstantFP::get(context_, llvm::APFloat(numExpr->getVal()));
+      return emitNumber(numExpr->getVal());
    }
    
    Value* CodeGeneratorImpl::codeGenVariableExpr(const VariableExprAST* variableExpr)
    {
-      auto v = namedValues_.find(variableExpr->getName());
-      if( v == namedValues_.end() )
-      {
-         return errorV( std::string("Unknown variable name : ") + variableExpr->getName());
-      }
-      
-      return builder_.CreateLoad(v->second, variableExpr->getName());
-      return v->second;
+      return memoize(variableExpr, isShared(variableExpr),
+                     [&] { return emitVariable(variableExpr->getSymbol(), variableExpr->getSlot()); });
    }
    
    Value* CodeGeneratorImpl::codeGenUnaryExpr(const UnaryExprAST* unaryExpr)
    {
-      auto operandValue = unaryExpr->getOperand()->codeGen();
-      if (!operandValue)
-         return nullptr;
-      
-      auto functionValue = getFunction(std::string("unary") +  unaryExpr->getOpcode());
-      if (!functionValue)
-         return errorV("Unknown unary operator");
-      
-      return builder_.CreateCall(functionValue, operandValue, "unop");
+      return memoize(unaryExpr, isShared(unaryExpr), [&]() -> Value* {
+         auto operandValue = unaryExpr->getOperand()->codeGen(*this);
+         if (!operandValue)
+            return nullptr;
+         
+         return emitUnary(unaryExpr->getOpcode(), operandValue);
+      });
    }
-
+   
    Value* CodeGeneratorImpl::codeGenBinaryExpr(const BinaryExprAST* binaryExpr)
    { auto op = binaryExpr->getOpcode();
-
+      
       if( op == '=')
       {
          return manageAssignment(binaryExpr);
       }
       else
       {
-         const auto& lhs = binaryExpr->getLeftOperand();
-         const auto& rhs = binaryExpr->getRightOperand();
+         const auto lhs = binaryExpr->getLeftOperand();
+         const auto rhs = binaryExpr->getRightOperand();
          
          if( lhs == nullptr || rhs == nullptr )
             return nullptr;
-
          
-         //evaluete operands
-         auto leftValue  = lhs->codeGen();
-         auto rightValue = rhs->codeGen();
          
-         if(leftValue == nullptr || rightValue == nullptr)
+         return memoize(binaryExpr, isShared(binaryExpr), [&]() -> Value* {
+            //evaluete operands
+            auto leftValue  = lhs->codeGen(*this);
+            auto rightValue = rhs->codeGen(*this);
+            
+            if(leftValue == nullptr || rightValue == nullptr)
+               return nullptr;
+            
+            return emitBinary(op, leftValue, rightValue);
+         });
+      }
+   
+   
+   }
+   
+   Value* CodeGeneratorImpl::codeGenCallExpr(const CallExprAST* callExpr)
+   {
+      const auto& args = callExpr->getArgumentList();
+      return memoize(callExpr, isShared(callExpr), [&] {
+         return emitCall(callExpr->getCallee(), args.size(),
+                         [&](size_t i) { return args[i]->codeGen(*this); }, tailCalls_.count(callExpr));
+      });
+   }
+   
+   Value* CodeGeneratorImpl::codeGenIfExpr(const IfExprAST* ifExpr)
+   {
+      if(!ifExpr)
+         return nullptr;
+      
+      const bool select = purity_ && lowersToSelect(purity_->getSpeculationCost(ifExpr->getThenBranch()),
+                                                    purity_->getSpeculationCost(ifExpr->getElseBranch()));
+      return emitIf([&] { return ifExpr->getCondion()->codeGen(*this); },
+                    [&] { return ifExpr->getThenBranch()->codeGen(*this); },
+                    [&] { return ifExpr->getElseBranch()->codeGen(*this); }, select);
+   }
+   
+   Value* CodeGeneratorImpl::codeGenForExpr(const ForExprAST* forExpr)
+   {
+      const auto Step = forExpr->getStep();
+      const auto Bound = getUpperBound(forExpr);
+      
+      LoopShape shape;
+      if (!Step)
+         shape.constantStep = 1.0;
+      else if (auto number = llvm::dyn_cast<NumberExprAST>(Step))
+         shape.constantStep = number->getVal();
+      shape.endIsUpperBound = Bound != nullptr;
+      if (auto array = getBoundArray(Bound, shape.boundOffset))
+      {
+         shape.boundArray = array->getSymbol();
+         shape.boundArraySlot = array->getSlot();
+      }
+      
+      return emitFor(forExpr->getKey(),
+                     [&] { return forExpr->getStart()->codeGen(*this); },
+                     [&] { return forExpr->getEnd()->codeGen(*this); },
+                     [&] { return Step ? Step->codeGen(*this) : emitNumber(1.0); },
+                     [&] { return forExpr->getBody()->codeGen(*this); },
+                     shape,
+                     [&] { return Bound->codeGen(*this); },
+                     forExpr->getReduction());
+   }
+   
+   
+   Function* CodeGeneratorImpl::codeGenPrototypeExpr(const PrototypeAST* protoExpr)
+   {
+      auto argList = protoExpr->getArgumentList();
+      
+      //an array argument is passed as the pointer to its elements followed by their count
+      std::vector<llvm::Type*> args;
+      for (size_t i = 0; i != argList.size(); ++i)
+      {
+         auto type = getType(protoExpr->getArgumentType(i));
+         if (isArray(type))
+         {
+            args.push_back(type->getStructElementType(0));
+            args.push_back(type->getStructElementType(1));
+         }
+         else
+            args.push_back(type);
+      }
+      
+      llvm::FunctionType* functionType = llvm::FunctionType::get(getType(protoExpr->getReturnType()),
+                                                                 args,
+                                                                 false);
+      llvm::Function* f = llvm::Function::Create(functionType,
+                                                 llvm::Function::ExternalLinkage,
+                                                 protoExpr->getName(),
+                                                 module_.get());
+      //arrays of different arguments never overlap
+      auto arg = f->arg_begin();
+      for (size_t i = 0; i != argList.size(); ++i)
+      {
+         const auto name = util::symbolName(argList[i]);
+         if (isArrayType(protoExpr->getArgumentType(i)))
+         {
+            f->addParamAttr(arg->getArgNo(), llvm::Attribute::NoAlias);
+            (arg++)->setName(name);
+            (arg++)->setName(name + ".len");
+         }
+         else
+            (arg++)->setName(name);
+      }
+      
+      //operators are expanded in the tree, the calls left (recursion, no AST optimization) are
+      //inlined by the jit
+      if (protoExpr->isUnary() || protoExpr->isBinary())
+         f->addFnAttr(llvm::Attribute::AlwaysInline);
+      
+      return f;
+   }
+   
+   Function* CodeGeneratorImpl::codeGenFunctionExpr(const FunctionAST* functExpr)
+   {
+      tailCalls_.clear();
+      collectTailCalls(functExpr->getBody(), tailCalls_);
+      return emitFunction(functExpr, [&] { return functExpr->getBody()->codeGen(*this); });
+   }
+   
+   Function* CodeGeneratorImpl::codeGenFlatFunction(const FunctionAST* functExpr, const FlatAST& body)
+   {
+      tailCalls_.clear();
+      collectTailCalls(body, body.getRoot(), tailCalls_);
+      return emitFunction(functExpr, [&] { return codeGenFlat(body, body.getRoot()); });
+   }
+   
+   void CodeGeneratorImpl::setSharedExpressions(const llvm::DenseSet<const ExprAST*>* shared)
+   {
+      sharedExpressions_ = shared;
+   }
+   
+   void CodeGeneratorImpl::setBoundsChecks(bool enabled)
+   {
+      boundsChecks_ = enabled;
+   }
+   
+   void CodeGeneratorImpl::setFloatingPointMode(FloatingPointMode mode)
+   {
+      floatingPointMode_ = mode;
+   }
+   
+   void CodeGeneratorImpl::setSelectLowering(const optimizer::PurityAnalysis* purity, unsigned threshold)
+   {
+      purity_ = purity;
+      selectThreshold_ = threshold;
+   }
+   
+   Value* CodeGeneratorImpl::codeGeneVarExpr(const VarExprAST* variableExpr)
+   {
+      const auto& variableNames = variableExpr->getVarNames();
+      
+      return emitVar(variableNames.size(),
+                     [&](size_t i) { return variableNames[i].name; },
+                     [&](size_t i) { return variableNames[i].type; },
+                     [&](size_t i) {
+                        const auto init = variableNames[i].init;
+                        return init ? init->codeGen(*this) : emitNumber(0.0);
+                     },
+                     [&] { return variableExpr->getBody()->codeGen(*this); });
+   }
+   
+   Value* CodeGeneratorImpl::codeGenIndexExpr(const IndexExprAST* indexExpr)
+   {
+      const auto array = indexExpr->getArray();
+      auto alloca = lookupVariable(array->getSymbol(), array->getSlot());
+      if (!alloca)
+         return errorV(std::string("Unknown variable name : ") + util::symbolName(array->getSymbol()).str());
+      
+      auto index = indexExpr->getIndex()->codeGen(*this);
+      if (!index)
+         return nullptr;
+      
+      AllocaInst* indexVariable = nullptr;
+      if (auto variable = llvm::dyn_cast<VariableExprAST>(indexExpr->getIndex()))
+         indexVariable = lookupVariable(variable->getSymbol(), variable->getSlot());
+      return emitIndex(alloca, index, indexVariable);
+   }
+   
+   ///
+   /// @brief: switch based walk of the flat representation, no virtual dispatch per node
+   ///
+   Value* CodeGeneratorImpl::codeGenFlat(const FlatAST& flat, node_index_t index)
+   {
+      const auto& node = flat.getNode(index);
+      if (node.flags & FlatNode::sharedFlag)
+         return memoize(&node, true, [&] { return codeGenFlatNode(flat, index); });
+      
+      return codeGenFlatNode(flat, index);
+   }
+   
+   Value* CodeGeneratorImpl::codeGenFlatNode(const FlatAST& flat, node_index_t index)
+   {
+      const auto& node = flat.getNode(index);
+      const auto operands = flat.getOperands(index);
+      
+      switch (node.kind)
+      {
+         case ExprKind::Number:
+            return emitNumber(flat.getNumber(index));
+         
+         case ExprKind::Variable:
+            return emitVariable(flat.getSymbol(index), flat.getSlot(index));
+         
+         case ExprKind::Unary:
+         {
+            auto operandValue = codeGenFlat(flat, operands[0]);
+            if (!operandValue)
+               return nullptr;
+            return emitUnary(node.opcode, operandValue);
+         }
+         
+         case ExprKind::Binary:
+         {
+            if (node.opcode == '=')
+            {
+               const auto destination = flat.getNode(operands[0]).kind;
+               if (destination == ExprKind::Index)
+               {
+                  AllocaInst* array = nullptr;
+                  AllocaInst* indexVariable = nullptr;
+                  auto position = codeGenFlatIndex(flat, operands[0], array, indexVariable);
+                  auto value = position ? codeGenFlat(flat, operands[1]) : nullptr;
+                  if (!value)
+                     return nullptr;
+                  return emitIndexAssignment(array, position, indexVariable, value);
+               }
+               
+               if (destination != ExprKind::Variable)
+                  return errorV("destination of '=' must be a variable");
+               
+               auto value = codeGenFlat(flat, operands[1]);
+               if (!value)
+                  return nullptr;
+               return emitAssignment(flat.getSymbol(operands[0]), flat.getSlot(operands[0]), value);
+            }
+            
+            auto leftValue  = codeGenFlat(flat, operands[0]);
+            auto rightValue = codeGenFlat(flat, operands[1]);
+            if(leftValue == nullptr || rightValue == nullptr)
+               return nullptr;
+            return emitBinary(node.opcode, leftValue, rightValue);
+         }
+         
+         case ExprKind::Call:
+            return emitCall(flat.getSymbol(index), operands.size(),
+                            [&](size_t i) { return codeGenFlat(flat, operands[i]); }, tailCalls_.count(&node));
+         
+         case ExprKind::If:
+         {
+            const bool select = purity_ && lowersToSelect(getSpeculationCost(flat, operands[1], *purity_),
+                                                          getSpeculationCost(flat, operands[2], *purity_));
+            return emitIf([&] { return codeGenFlat(flat, operands[0]); },
+                          [&] { return codeGenFlat(flat, operands[1]); },
+                          [&] { return codeGenFlat(flat, operands[2]); }, select);
+         }
+         
+         case ExprKind::For:
+         {
+            LoopShape shape;
+            if (operands[2] == FlatAST::noNode)
+               shape.constantStep = 1.0;
+            else if (flat.getNode(operands[2]).kind == ExprKind::Number)
+               shape.constantStep = flat.getNumber(operands[2]);
+            
+            //end condition 'variable < bound'
+            const auto& end = flat.getNode(operands[1]);
+            const auto endOperands = flat.getOperands(operands[1]);
+            shape.endIsUpperBound = end.kind == ExprKind::Binary && end.opcode == '<' &&
+                                    flat.getNode(endOperands[0]).kind == ExprKind::Variable &&
+                                    flat.getSymbol(endOperands[0]) == flat.getSymbol(index);
+            
+            //bound 'len(array)' or 'len(array) - offset'
+            if (shape.endIsUpperBound)
+            {
+               auto bound = endOperands[1];
+               const auto& difference = flat.getNode(bound);
+               if (difference.kind == ExprKind::Binary && difference.opcode == '-' &&
+                   flat.getNode(flat.getOperands(bound)[1]).kind == ExprKind::Number)
+               {
+                  shape.boundOffset = flat.getNumber(flat.getOperands(bound)[1]);
+                  bound = flat.getOperands(bound)[0];
+               }
+               
+               const auto& call = flat.getNode(bound);
+               if (call.kind == ExprKind::Call && getBuiltin(flat.getSymbol(bound)) == Builtin::Len &&
+                   flat.getOperands(bound).size() == 1 &&
+                   flat.getNode(flat.getOperands(bound)[0]).kind == ExprKind::Variable)
+               {
+                  shape.boundArray = flat.getSymbol(flat.getOperands(bound)[0]);
+                  shape.boundArraySlot = flat.getSlot(flat.getOperands(bound)[0]);
+               }
+            }
+            
+            return emitFor(flat.getSymbol(index),
+                           [&] { return codeGenFlat(flat, operands[0]); },
+                           [&] { return codeGenFlat(flat, operands[1]); },
+                           [&] {
+                              return operands[2] != FlatAST::noNode ? codeGenFlat(flat, operands[2])
+                                                                    : emitNumber(1.0);
+                           },
+                           [&] { return codeGenFlat(flat, operands[3]); },
+                           shape,
+                           [&] { return codeGenFlat(flat, endOperands[1]); },
+                           static_cast<Reduction>(node.opcode));
+         }
+         
+         case ExprKind::Var:
+            return emitVar(operands.size() / 3,
+                           [&](size_t i) { return operands[3 * i]; },
+                           [&](size_t i) { return static_cast<ValueType>(operands[3 * i + 1]); },
+                           [&](size_t i) {
+                              const auto init = operands[3 * i + 2];
+                              return init != FlatAST::noNode ? codeGenFlat(flat, init) : emitNumber(0.0);
+                           },
+                           [&] { return codeGenFlat(flat, operands.back()); });
+         
+         case ExprKind::Index:
+         {
+            AllocaInst* array = nullptr;
+            AllocaInst* indexVariable = nullptr;
+            auto position = codeGenFlatIndex(flat, index, array, indexVariable);
+            if (!position)
+               return nullptr;
+            return emitIndex(array, position, indexVariable);
+         }
+         
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      return errorV("unexpected node in flat expression");
+   }
+   
+   Value* CodeGeneratorImpl::codeGenFlatIndex(const FlatAST& flat, node_index_t index,
+                                              AllocaInst*& array, AllocaInst*& indexVariable)
+   {
+      const auto operands = flat.getOperands(index);
+      array = lookupVariable(flat.getSymbol(operands[0]), flat.getSlot(operands[0]));
+      if (!array)
+         return errorV(std::string("Unknown variable name : ") + util::symbolName(flat.getSymbol(operands[0])).str());
+      
+      if (flat.getNode(operands[1]).kind == ExprKind::Variable)
+         indexVariable = lookupVariable(flat.getSymbol(operands[1]), flat.getSlot(operands[1]));
+      return codeGenFlat(flat, operands[1]);
+   }
+   
+   Value* CodeGeneratorImpl::memoize(const void* node, bool shared, gen_value_t emit)
+   {
+      if (!shared)
+         return emit();
+      
+      auto value = sharedValues_.find(node);
+      if (value != sharedValues_.end() && value->second.first == builder_.GetInsertBlock())
+         return value->second.second;
+      
+      auto emitted = emit();
+      if (emitted)
+         sharedValues_[node] = std::make_pair(builder_.GetInsertBlock(), emitted);
+      return emitted;
+   }
+   
+   bool CodeGeneratorImpl::isShared(const ExprAST* node) const
+   {
+      return sharedExpressions_ && sharedExpressions_->count(node);
+   }
+   
+   ///
+   /// emitters shared by the tree and the flat code generation
+   ///
+   
+   Value* CodeGeneratorImpl::emitNumber(double value)
+   {
+      return llvm::ConstantFP::get(context_, llvm::APFloat(value));
+   }
+   
+   Value* CodeGeneratorImpl::emitVariable(util::symbol_t name, util::slot_t slot)
+   {
+      auto alloca = lookupVariable(name, slot);
+      if( alloca == nullptr )
+      {
+         return errorV( std::string("Unknown variable name : ") + util::symbolName(name).str());
+      }
+      
+      return builder_.CreateLoad(alloca, util::symbolName(name));
+   }
+   
+   Value* CodeGeneratorImpl::emitUnary(unsigned char opcode, Value* operandValue)
+   {
+      auto functionValue = getCallee(operatorSymbol("unary", opcode));
+      if (!functionValue)
+         return errorV("Unknown unary operator");
+      
+      operandValue = convert(operandValue, functionValue->getFunctionType()->getParamType(0));
+      if (!operandValue)
+         return nullptr;
+      return builder_.CreateCall(functionValue, operandValue, "unop");
+   }
+   
+   Value* CodeGeneratorImpl::emitBinary(unsigned char op, Value* leftValue, Value* rightValue)
+   {
+      if (op == '+' || op == '-' || op == '*' || op == '<')
+      {
+         if (isArray(leftValue->getType()) || isArray(rightValue->getType()))
+            return errorV("arrays can only be indexed");
+         
+         auto type = getCommonType(leftValue, rightValue);
+         leftValue = convert(leftValue, type);
+         rightValue = convert(rightValue, type);
+         if (!leftValue || !rightValue)
             return nullptr;
+         const bool integer = type->isIntegerTy();
          
          switch (op)
          {
             case '+':
-               return builder_.CreateFAdd(leftValue, rightValue, "addtmp");
+               return integer ? builder_.CreateAdd(leftValue, rightValue, "addtmp")
+                              : builder_.CreateFAdd(leftValue, rightValue, "addtmp");
             case '-':
-               return builder_.CreateFSub(leftValue, rightValue, "subtmp");
+               return integer ? builder_.CreateSub(leftValue, rightValue, "subtmp")
+                              : builder_.CreateFSub(leftValue, rightValue, "subtmp");
             case '*':
-               return builder_.CreateFMul(leftValue, rightValue, "multmp");
-            case '<':
-               leftValue = builder_.CreateFCmpULT(leftValue, rightValue, "cmptmp");
-               // Convert bool to double
-               return builder_.CreateUIToFP(leftValue,
-                                            llvm::Type::getDoubleTy(context_),
-                                            "booltmp");
+               return integer ? builder_.CreateMul(leftValue, rightValue, "multmp")
+                              : builder_.CreateFMul(leftValue, rightValue, "multmp");
             default:
                break;
          }
          
-         auto function = getFunction(std::string("binary") + (char)op);
-         assert(function != nullptr && "binary function not found");
+         // Convert bool to 0 or 1 of the type of the operands
+         if (integer)
+            return builder_.CreateZExt(builder_.CreateICmpSLT(leftValue, rightValue, "cmptmp"),
+                                       type, "booltmp");
          
-         Value* ops[] = {leftValue, rightValue};
-         return builder_.CreateCall(function, ops, "binop");
+         leftValue = builder_.CreateFCmpULT(leftValue, rightValue, "cmptmp");
+         return builder_.CreateUIToFP(leftValue, type, "booltmp");
       }
       
-     
+      auto function = getCallee(operatorSymbol("binary", (char)op));
+      assert(function != nullptr && "binary function not found");
+      
+      auto functionType = function->getFunctionType();
+      Value* ops[] = {convert(leftValue, functionType->getParamType(0)),
+                      convert(rightValue, functionType->getParamType(1))};
+      if (!ops[0] || !ops[1])
+         return nullptr;
+      return builder_.CreateCall(function, ops, "binop");
    }
    
-   Value* CodeGeneratorImpl::codeGenCallExpr(const CallExprAST* callExpr)
+   Value* CodeGeneratorImpl::emitAssignment(util::symbol_t name, util::slot_t slot, Value* value)
+   {
+      // Look-up the name.
+      auto alloca = lookupVariable(name, slot);
+      if (!alloca)
+         return errorV("Unknown variable name");
+      
+      //array bindings are fixed: their length and alias scope hold for the whole function
+      if (isArray(alloca->getAllocatedType()))
+         return errorV("arrays can't be assigned, assign their elements");
+      
+      value = convert(value, alloca->getAllocatedType());
+      if (!value)
+         return nullptr;
+      builder_.CreateStore(value, alloca);
+      return value;
+   }
+   
+   Value* CodeGeneratorImpl::emitCall(util::symbol_t callee, size_t argCount,
+                                      llvm::function_ref<Value*(size_t)> genArg, bool tail)
    {
-      Function* function = getFunction(callExpr->getCallee());
+      Function* function = getCallee(callee);
+      
+      //builtins, unless the program defines or declares a function of the same name
+      if( function == nullptr ) {
+         const auto builtin = getBuiltin(callee);
+         if( builtin != Builtin::None )
+            return emitBuiltin(builtin, argCount, genArg);
+      }
+      
       if( function == nullptr ) {
          errorV("Unknown function referenced");
          return nullptr;
       }
       
-      const auto& args = callExpr->getArgumentList();
-      if( function->arg_size() != args.size())
+      //an array takes two parameters, the pointer to its elements and their count
+      const auto functionType = function->getFunctionType();
+      const auto arrayCount = std::count_if(functionType->param_begin(), functionType->param_end(),
+                                            [](const llvm::Type* type) { return type->isPointerTy(); });
+      if( function->arg_size() - arrayCount != argCount)
          errorV("Incorrect number of parameters passed");
       
       std::vector<Value*> argsV; //list of arguments evalueted
-      for( const auto& arg : args ) {
-         argsV.push_back(arg->codeGen());
-         if( args.back() == nullptr )
+      for( size_t i = 0; i != argCount; ++i ) {
+         auto value = genArg(i);
+         if( value == nullptr )
+            return nullptr;
+         
+         if( argsV.size() >= function->arg_size() ) {
+            argsV.push_back(value);
+            continue;
+         }
+         
+         auto paramType = functionType->getParamType(argsV.size());
+         if( paramType->isPointerTy() ) {
+            if( value->getType() != llvm::StructType::get(context_, {paramType, builder_.getInt64Ty()}) )
+               return errorV("array of a different type passed");
+            argsV.push_back(builder_.CreateExtractValue(value, 0));
+            argsV.push_back(builder_.CreateExtractValue(value, 1));
+            continue;
+         }
+         
+         argsV.push_back(convert(value, paramType));
+         if( argsV.back() == nullptr )
             return nullptr;
       }
       
-      return builder_.CreateCall(function, argsV, "calltmp");
+      //a call in tail position reads no memory of the caller (arrays belong to its callers):
+      //the back end can reuse the frame, TRE turns self calls into a loop
+      auto call = builder_.CreateCall(function, argsV, "calltmp");
+      if( tail )
+         call->setTailCall();
+      return call;
    }
    
-   Value* CodeGeneratorImpl::codeGenIfExpr(const IfExprAST* ifExpr)
+   bool CodeGeneratorImpl::lowersToSelect(llvm::Optional<unsigned> thenCost, llvm::Optional<unsigned> elseCost) const
    {
-      if(!ifExpr)
+      return selectThreshold_ != 0 && thenCost && elseCost && *thenCost + *elseCost <= selectThreshold_;
+   }
+   
+   Value* CodeGeneratorImpl::emitIf(gen_value_t genCond, gen_value_t genThen, gen_value_t genElse, bool select)
+   {
+      //resolve cond
+      auto CondV = genCond();
+      if (!CondV)
          return nullptr;
       
-      //resolve cond
-      auto CondV = ifExpr->getCondion()->codeGen();
+      // convert to bool comparing false to 0
+      CondV = emitIsTrue(CondV, "ifcond");
       if (!CondV)
          return nullptr;
       
-      // convert to bool comparing false to 0.0 (only doubles are supported)
-      CondV = builder_.CreateFCmpONE(CondV,
-                                     llvm::ConstantFP::get(context_,
-                                                           llvm::APFloat(0.0)), "ifcond");
+      //both branches evaluated in the current block: no branch to mispredict, and a loop
+      //body without control flow can be vectorized
+      if (select)
+      {
+         auto ThenV = genThen();
+         auto ElseV = genElse();
+         if (!ThenV || !ElseV)
+            return nullptr;
+         
+         auto type = getCommonType(ThenV, ElseV);
+         ThenV = convert(ThenV, type);
+         ElseV = convert(ElseV, type);
+         if (!ThenV || !ElseV)
+            return nullptr;
+         return builder_.CreateSelect(CondV, ThenV, ElseV, "iftmp");
+      }
       
       auto TheFunction = builder_.GetInsertBlock()->getParent();
       
@@ -224,7 +914,7 @@ namespace code_generator
       builder_.SetInsertPoint(ThenBB);
       
       //resolve 'then' branch
-      auto ThenV = ifExpr->getThenBranch()->codeGen();
+      auto ThenV = genThen();
       if (!ThenV)
          return nullptr;
       
@@ -236,7 +926,7 @@ namespace code_generator
       TheFunction->getBasicBlockList().push_back(ElseBB);
       builder_.SetInsertPoint(ElseBB);
       
-      auto ElseV = ifExpr->getElseBranch()->codeGen();
+      auto ElseV = genElse();
       if (!ElseV)
          return nullptr;
       
@@ -244,22 +934,34 @@ namespace code_generator
       // Codegen of 'Else' can change the current block, update ElseBB for the PHI.
       ElseBB = builder_.GetInsertBlock();
       
+      // Branches of different types meet in their common type, converted at the end of each branch.
+      auto type = getCommonType(ThenV, ElseV);
+      builder_.SetInsertPoint(ThenBB->getTerminator());
+      ThenV = convert(ThenV, type);
+      builder_.SetInsertPoint(ElseBB->getTerminator());
+      ElseV = convert(ElseV, type);
+      if (!ThenV || !ElseV)
+         return nullptr;
+      
       // Emit merge block.
       TheFunction->getBasicBlockList().push_back(MergeBB);
       builder_.SetInsertPoint(MergeBB);
       
-      llvm::PHINode *PN = builder_.CreatePHI(llvm::Type::getDoubleTy(context_), 2, "iftmp");
+      llvm::PHINode *PN = builder_.CreatePHI(type, 2, "iftmp");
       PN->addIncoming(ThenV, ThenBB);
       PN->addIncoming(ElseV, ElseBB);
       return PN;
-      
    }
    
-   Value* CodeGeneratorImpl::codeGenForExpr(const ForExprAST* forExpr)
+   Value* CodeGeneratorImpl::emitFor(util::symbol_t varName, gen_value_t genStart, gen_value_t genEnd,
+                                     gen_value_t genStep, gen_value_t genBody,
+                                     const LoopShape& shape, gen_value_t genBound, Reduction reduction)
    {
-      auto StartVal = forExpr->getStart()->codeGen();
+      auto StartVal = genStart();
       if (!StartVal)
          return nullptr;
+      if (isArray(StartVal->getType()) || StartVal->getType()->isVectorTy())
+         return errorV("the variable of a 'for' must be a number");
       
       // Make the new basic block for the loop header, inserting after current
       // block.
@@ -273,51 +975,109 @@ namespace code_generator
       // Start insertion in LoopBB.
       builder_.SetInsertPoint(LoopBB);
       
+      // The variable has the type of Start. Integral constant start and step on a floating point
+      // variable are counted by an i64 induction variable (countable for ScalarEvolution): the
+      // floating point value is only materialized for the body, dead conversions are removed later.
+      auto VariableType = StartVal->getType();
+      auto CounterType = VariableType;
+      auto Int64Type = llvm::Type::getInt64Ty(context_);
+      if (VariableType->isFloatingPointTy() && shape.constantStep &&
+          llvm::isa<llvm::Constant>(StartVal) &&
+          isRepresentable(llvm::cast<llvm::Constant>(StartVal), Int64Type) &&
+          isRepresentable(llvm::ConstantFP::get(context_, llvm::APFloat(*shape.constantStep)), Int64Type))
+         CounterType = Int64Type;
+      
       // Start the PHI node with an entry for Start.
-      auto Variable = builder_.CreatePHI(llvm::Type::getDoubleTy(context_),
-                                            2, forExpr->getKey().c_str());
+      auto Variable = builder_.CreatePHI(CounterType, 2, util::symbolName(varName));
       
-      Variable->addIncoming(StartVal, PreheaderBB);
+      Variable->addIncoming(convert(StartVal, CounterType), PreheaderBB);
       
-      // Within the loop, the variable is defined equal to the PHI node.  If it
-      // shadows an existing variable, we have to restore it, so save it now.
-      const auto& varName = forExpr->getKey();
-      auto OldVal = namedValues_[varName];
-      namedValues_[varName] = CreateEntryBlockAlloca(TheFunction, varName);
+      // Within the loop, the variable lives in its own scope, initialized with the PHI node.
+      // Shadowed bindings become visible again when the scope is closed.
+      auto Alloca = CreateEntryBlockAlloca(TheFunction, util::symbolName(varName), VariableType);
+      auto InitStore = builder_.CreateStore(convert(Variable, VariableType), Alloca);
+      namedValues_.pushScope();
+      namedValues_.bind(varName, Alloca);
+      
+      // Arrays indexed by the variable of a counted loop use the counter directly, when the
+      // body doesn't assign the variable (known after the body is emitted).
+      // A counter starting at s >= 0, incremented by step > 0 while below len(array) - k with
+      // k >= step, only indexes the array in [s, len(array) - k + step): array[variable] needs
+      // no check in the body when s < len(array), checked once before the loop. The check of s
+      // fails where the original would only when an access runs on every iteration.
+      AllocaInst* BoundArray = nullptr;
+      auto Start = llvm::dyn_cast<llvm::ConstantInt>(Variable->getIncomingValueForBlock(PreheaderBB));
+      if (boundsChecks_ && CounterType == Int64Type && Start && !Start->isNegative() &&
+          shape.boundArray != util::StringInterner::invalidSymbol && !getFunction(lenSymbol()) &&
+          *shape.constantStep > 0 && shape.boundOffset >= *shape.constantStep)
+      {
+         BoundArray = lookupVariable(shape.boundArray, shape.boundArraySlot);
+         if (!BoundArray || !isArray(BoundArray->getAllocatedType()))
+            BoundArray = nullptr;
+      }
+      if (CounterType == Int64Type)
+         countedLoops_.push_back(CountedLoop{Alloca, Variable, BoundArray, {}, {}});
       
       // Emit the body of the loop.  This, like any other expr, can change the
       // current BB.  Note that we ignore the value computed by the body, but don't
       // allow an error.
-      if (!forExpr->getBody()->codeGen())
+      auto BodyVal = genBody();
+      if (!BodyVal)
+         return nullptr;
+      
+      // A reduction combines the values of the body in an accumulator carried by a PHI node.
+      // The combination is reassociable: the loop vectorizer splits the accumulator in vector
+      // lanes and interleaved partial accumulators, combined horizontally after the loop.
+      // Hand rotated accumulators would be a recurrence it can't vectorize.
+      llvm::PHINode* Accumulator = nullptr;
+      Value* Combined = nullptr;
+      if (reduction != Reduction::None)
+      {
+         auto Type = BodyVal->getType();
+         if (isArray(Type))
+            return errorV("only numbers and vectors can be reduced");
+         
+         Accumulator = llvm::PHINode::Create(Type, 2, "acc", &LoopBB->front());
+         Accumulator->addIncoming(getReductionIdentity(reduction, Type), PreheaderBB);
+         Combined = emitCombine(reduction, Accumulator, BodyVal);
+      }
+      
+      // Emit the step value (1.0 if not specified).
+      auto StepVal = genStep();
+      if (!StepVal)
+         return nullptr;
+      
+      auto NextVar = emitBinary('+', Variable, StepVal);
+      if (!NextVar)
          return nullptr;
+      NextVar = convert(NextVar, CounterType);
+      
+      // Compute the end condition. 'variable < bound' compares the counter directly
+      // when the body never assigns the variable (it only reads the value stored above).
+      const bool assigned = std::any_of(Alloca->user_begin(), Alloca->user_end(), [&](const llvm::User* user) {
+         return llvm::isa<llvm::StoreInst>(user) && user != InitStore;
+      });
       
-      // Emit the step value.
-      const auto& Step = forExpr->getStep();
-      llvm::Value* StepVal = nullptr;
-      if (Step)
+      Value* EndCond = nullptr;
+      if (shape.endIsUpperBound && !assigned)
       {
-         StepVal = Step->codeGen();
-         if (!StepVal)
+         auto BoundVal = genBound();
+         if (!BoundVal)
             return nullptr;
+         EndCond = emitBinary('<', Variable, BoundVal);
       }
       else
       {
-         // If not specified, use 1.0.
-         StepVal = llvm::ConstantFP::get(context_, llvm::APFloat(1.0));
+         EndCond = genEnd();
+         if (!EndCond)
+            return nullptr;
       }
       
-      auto NextVar = builder_.CreateFAdd(Variable, StepVal, "nextvar");
-      
-      // Compute the end condition.
-      auto EndCond = forExpr->getEnd()->codeGen();
+      // Convert condition to a bool by comparing equal to 0.
+      EndCond = emitIsTrue(EndCond, "loopcond");
       if (!EndCond)
          return nullptr;
       
-      // Convert condition to a bool by comparing equal to 0.0.
-      EndCond = builder_.CreateFCmpONE(EndCond,
-                                       llvm::ConstantFP::get(context_,
-                                                             llvm::APFloat(0.0)), "loopcond");
-      
       // Create the "after loop" block and insert it.
       auto LoopEndBB = builder_.GetInsertBlock();
       auto AfterBB = llvm::BasicBlock::Create(context_, "afterloop", TheFunction);
@@ -331,78 +1091,182 @@ namespace code_generator
       // Add a new entry to the PHI node for the backedge.
       Variable->addIncoming(NextVar, LoopEndBB);
       
+      // The indices converted back from the variable are the counter (an index beyond 2^53,
+      // where the conversions round, addresses no array). The checks of array[variable] in
+      // the body are replaced by the check of the start when one of them runs on every iteration
+      // (its block dominates the back-edge): the first iteration, always run, fails on the start
+      // then. Otherwise they stay, an iteration may not index the array.
+      if (CounterType == Int64Type)
+      {
+         auto Loop = std::move(countedLoops_.back());
+         countedLoops_.pop_back();
+         if (!assigned)
+            for (auto Index : Loop.indices)
+            {
+               Index->replaceAllUsesWith(Variable);
+               Index->eraseFromParent();
+            }
+         
+         bool Unconditional = false;
+         if (BoundArray && !assigned && !Loop.checks.empty())
+         {
+            llvm::DominatorTree Dominators(*TheFunction);
+            Unconditional = std::any_of(Loop.checks.begin(), Loop.checks.end(), [&](const llvm::BranchInst* check) {
+               return Dominators.dominates(check->getParent(), LoopEndBB);
+            });
+         }
+         
+         if (Unconditional)
+         {
+            for (auto check : Loop.checks)
+               check->setCondition(builder_.getFalse());
+            
+            auto Entry = PreheaderBB->getTerminator();
+            builder_.SetInsertPoint(Entry);
+            auto Length = builder_.CreateExtractValue(builder_.CreateLoad(BoundArray, BoundArray->getName()), 1, "len");
+            auto StartInBounds = builder_.CreateICmpULT(Variable->getIncomingValueForBlock(PreheaderBB),
+                                                        Length, "startinbounds");
+            builder_.CreateCondBr(StartInBounds, LoopBB, getBoundsFailBlock());
+            Entry->eraseFromParent();
+            builder_.SetInsertPoint(AfterBB);
+         }
+      }
+      
+      if (Accumulator)
+         Accumulator->addIncoming(Combined, LoopEndBB);
+      
       // Restore the unshadowed variable.
-      if (OldVal)
-         namedValues_[varName] = OldVal;
-      else
-         namedValues_.erase(varName);
+      namedValues_.popScope();
+      
+      // reduce evaluates to the combined values of its body
+      if (Accumulator)
+         return Combined;
       
       // for expr always returns 0.0.
       return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(context_));
    }
-
-
-   Function* CodeGeneratorImpl::codeGenPrototypeExpr(const PrototypeAST* protoExpr)
+   
+   Value* CodeGeneratorImpl::emitVar(size_t count, llvm::function_ref<util::symbol_t(size_t)> getName,
+                                     llvm::function_ref<ValueType(size_t)> getVarType,
+                                     llvm::function_ref<Value*(size_t)> genInit, gen_value_t genBody)
    {
-      auto argList = protoExpr->getArgumentList();
+      Function *function = builder_.GetInsertBlock()->getParent();
+      namedValues_.pushScope();
       
-      std::vector<llvm::Type*> args { argList.size(),
-         llvm::Type::getDoubleTy(context_)};
+      for (size_t i = 0; i != count; ++i)
+      {
+         const auto varName = getName(i);
+         
+         //emit init (0.0 when not specified)
+         Value *initVal = genInit(i);
+         if (!initVal)
+            return nullptr;
+         
+         //without annotation the variable has the type of its init
+         const auto type = getVarType(i);
+         if (type != ValueType::Auto)
+            initVal = convert(initVal, getType(type));
+         if (!initVal)
+            return nullptr;
+         
+         auto alloca = CreateEntryBlockAlloca(function, util::symbolName(varName), initVal->getType());
+         builder_.CreateStore(initVal, alloca);
+         
+         // Remember this binding, visible to the next initializers.
+         namedValues_.bind(varName, alloca);
+      }
       
-      llvm::FunctionType* functionType = llvm::FunctionType::get(llvm::Type::getDoubleTy(context_),
-                                                                 args,
-                                                                 false);
-      llvm::Function* f = llvm::Function::Create(functionType,
-                                                 llvm::Function::ExternalLinkage,
-                                                 protoExpr->getName(),
-                                                 module_.get());
-      unsigned i = 0;
-      for(auto& arg: f->args())
-         arg.setName(argList[i++]);
+      // Codegen the body, now that all vars are in scope.
+      auto bodyVal = genBody();
+      if (!bodyVal)
+         return nullptr;
       
-      return f;
+      // Pop all our variables from scope.
+      namedValues_.popScope();
+      
+      // Return the body computation.
+      return bodyVal;
    }
    
-   Function* CodeGeneratorImpl::codeGenFunctionExpr(const FunctionAST* functExpr)
+   Function* CodeGeneratorImpl::emitFunction(const FunctionAST* functExpr, gen_value_t genBody)
    {
       const auto& prototype = functExpr->getPrototype();
-      const auto& body = functExpr->getBody();
       
       //search for function declared by previous 'extern'
-      auto name = prototype->getName();
-      llvm::Function* f = getFunction(prototype->getName());
+      llvm::Function* f = getFunction(prototype->getSymbol());
       
       if( f == nullptr )
-         f = prototype->codeGen();
+         f = prototype->codeGen(*this);
       
       if(prototype->isBinary())
          binaryOperationPrecedence_[prototype->getOperatorName()] = prototype->getBinaryPrecedence();
       
       llvm::BasicBlock* bb = llvm::BasicBlock::Create(context_, "entry", f);
       builder_.SetInsertPoint(bb);
+      setFunctionFloatingPointMode(f, prototype->getFloatingPointMode() == FloatingPointMode::Session
+                                         ? floatingPointMode_
+                                         : prototype->getFloatingPointMode());
       namedValues_.clear();
-      for( auto& arg : f->args())
+      sharedValues_.clear();
+      arrayScopes_.clear();
+      countedLoops_.clear();
+      boundsFailBlock_ = nullptr;
+      
+      const auto& argNames = prototype->getArgumentList();
+      std::vector<AllocaInst*> arrays;
+      auto arg = f->arg_begin();
+      for( size_t i = 0; i != argNames.size(); ++i )
+      {
+         const auto name = util::symbolName(argNames[i]);
+         Value* value = &*arg++;
+         
+         //the two parameters of an array are packed back in one value
+         const auto type = getType(prototype->getArgumentType(i));
+         if (isArray(type))
+         {
+            value = builder_.CreateInsertValue(llvm::UndefValue::get(type), value, 0);
+            value = builder_.CreateInsertValue(value, &*arg++, 1);
+         }
+         
+         AllocaInst *alloca = CreateEntryBlockAlloca(f, name, type);
+         builder_.CreateStore(value, alloca);
+         namedValues_.bind(argNames[i], alloca);
+         if (isArray(type))
+            arrays.push_back(alloca);
+      }
+      
+      //every argument array is in its own alias scope, its accesses don't alias the other arrays
+      if (arrays.size() > 1)
       {
-         AllocaInst *alloca = CreateEntryBlockAlloca(f, arg.getName());
-         builder_.CreateStore(&arg, alloca);
-         namedValues_[arg.getName()] = alloca;
+         llvm::MDBuilder metadata(context_);
+         auto domain = metadata.createAnonymousAliasScopeDomain(f->getName());
+         std::vector<llvm::Metadata*> scopes;
+         for (auto array : arrays)
+            scopes.push_back(metadata.createAnonymousAliasScope(domain, array->getName()));
+         
+         for (size_t i = 0; i != arrays.size(); ++i)
+         {
+            std::vector<llvm::Metadata*> others(scopes);
+            others.erase(others.begin() + i);
+            arrayScopes_[arrays[i]] = std::make_pair(llvm::MDNode::get(context_, scopes[i]),
+                                                     llvm::MDNode::get(context_, others));
+         }
       }
-
-      auto returnValue = body->codeGen();
+      
+      auto returnValue = genBody();
       
       //incredible hack to move in the ptr!!! work this out in some way that's better
       auto& p = const_cast<std::unique_ptr<PrototypeAST>&>(prototype);
       std::unique_ptr<PrototypeAST> ptr;
       ptr.reset(p.release());
-      prototypeCache_[ptr->getName()] = std::move(ptr);
+      prototypeCache_[ptr->getSymbol()] = std::move(ptr);
+      
+      if(returnValue != nullptr)
+         returnValue = convert(returnValue, f->getReturnType());
       
       if(returnValue != nullptr)
       {
          builder_.CreateRet(returnValue);
-         if(!llvm::verifyFunction(*f)) {
-            //eager optimization peephole
-            optimizer_->runLocalFunctionOptimization(f);
-         }
          return f;
       }
       
@@ -411,57 +1275,341 @@ namespace code_generator
       return nullptr;
    }
    
-   Value* CodeGeneratorImpl::codeGeneVarExpr(const VarExprAST* variableExpr)
+   Value* CodeGeneratorImpl::emitBuiltin(Builtin builtin, size_t argCount,
+                                         llvm::function_ref<Value*(size_t)> genArg)
    {
-      std::vector<AllocaInst *> oldBindings;
-      Function *function = builder_.GetInsertBlock()->getParent();
-      
-      const auto& variableNames = variableExpr->getVarNames();
+      std::vector<Value*> args;
+      for (size_t i = 0; i != argCount; ++i)
+      {
+         args.push_back(genArg(i));
+         if (!args.back())
+            return nullptr;
+      }
       
-      for (unsigned i = 0, e = variableNames.size(); i != e; ++i)
+      switch (builtin)
       {
-         const auto& varName = variableNames[i].first;
-         const auto& init = variableNames[i].second;
+         case Builtin::Len:
+            if (args.size() != 1 || !isArray(args[0]->getType()))
+               return errorV("len expects an array");
+            return builder_.CreateExtractValue(args[0], 1, "len");
+         
+         case Builtin::Vec2:
+         case Builtin::Vec4:
+         case Builtin::Vec8:
+         {
+            auto type = getType(builtin == Builtin::Vec2 ? ValueType::Vec2 :
+                                builtin == Builtin::Vec4 ? ValueType::Vec4 : ValueType::Vec8);
+            if (args.size() == 1)
+               return convert(args[0], type);
+            
+            const auto lanes = llvm::cast<llvm::VectorType>(type)->getNumElements();
+            if (args.size() != lanes)
+               return errorV("a vector is built from one value or from all its lanes");
+            
+            Value* vector = llvm::UndefValue::get(type);
+            for (unsigned i = 0; i != lanes; ++i)
+            {
+               auto lane = convert(args[i], type->getScalarType());
+               if (!lane)
+                  return nullptr;
+               vector = builder_.CreateInsertElement(vector, lane, builder_.getInt32(i), "vec");
+            }
+            return vector;
+         }
          
-         //emit init
-         Value *initVal;
-         if (init)
+         case Builtin::Select:
          {
-            initVal = init->codeGen();
-            if (!initVal)
+            if (args.size() != 3)
+               return errorV("select expects a mask and two values");
+            
+            // a vector mask selects lane by lane, the values are repeated in the lanes when needed
+            auto mask = args[0];
+            auto type = getCommonType(args[1], args[2]);
+            Value* condition = nullptr;
+            if (mask->getType()->isVectorTy())
+            {
+               type = mask->getType();
+               condition = builder_.CreateFCmpONE(mask, llvm::Constant::getNullValue(type), "mask");
+            }
+            else
+               condition = emitIsTrue(mask, "mask");
+            
+            auto trueValue = condition ? convert(args[1], type) : nullptr;
+            auto falseValue = trueValue ? convert(args[2], type) : nullptr;
+            if (!falseValue)
                return nullptr;
+            return builder_.CreateSelect(condition, trueValue, falseValue, "select");
          }
-         else
+         
+         case Builtin::Shuffle:
          {
-            initVal = llvm::ConstantFP::get(context_, llvm::APFloat(0.0));
+            const auto count = args.size() - 1;
+            if (args.empty() || !args[0]->getType()->isVectorTy() || (count != 2 && count != 4 && count != 8))
+               return errorV("shuffle expects a vector and the indices of 2, 4 or 8 lanes");
+            
+            const auto lanes = llvm::cast<llvm::VectorType>(args[0]->getType())->getNumElements();
+            std::vector<llvm::Constant*> indices;
+            for (size_t i = 1; i != args.size(); ++i)
+            {
+               auto constant = llvm::dyn_cast<llvm::Constant>(args[i]);
+               if (!constant || !isRepresentable(constant, builder_.getInt32Ty()))
+                  return errorV("the lanes of a shuffle must be integral constants");
+               
+               auto index = llvm::dyn_cast<llvm::ConstantInt>(convert(constant, builder_.getInt32Ty()));
+               if (!index || !index->getValue().ult(lanes))
+                  return errorV("lane index out of the vector");
+               indices.push_back(index);
+            }
+            return builder_.CreateShuffleVector(args[0], llvm::UndefValue::get(args[0]->getType()),
+                                                llvm::ConstantVector::get(indices), "shuffle");
          }
          
-         auto alloca = CreateEntryBlockAlloca(function, varName);
-         builder_.CreateStore(initVal, alloca);
+         case Builtin::HorizontalAdd:
+         case Builtin::HorizontalMin:
+         case Builtin::HorizontalMax:
+            if (args.size() != 1 || !args[0]->getType()->isVectorTy())
+               return errorV("hadd, hmin and hmax reduce a vector");
+            return emitReduction(builtin, args[0]);
          
-         //memorize bind
-         oldBindings.push_back(namedValues_[varName]);
+         case Builtin::None:
+            break;
+      }
+      return errorV("Unknown function referenced");
+   }
+   
+   Value* CodeGeneratorImpl::emitReduction(Builtin builtin, Value* vector)
+   {
+      const auto reduction = builtin == Builtin::HorizontalMin ? Reduction::Min :
+                             builtin == Builtin::HorizontalMax ? Reduction::Max : Reduction::Sum;
+      auto combine = [&](Value* left, Value* right) { return emitCombine(reduction, left, right); };
+      
+      // the two halves are combined lane by lane down to two lanes: log2(lanes) operations
+      for (auto lanes = llvm::cast<llvm::VectorType>(vector->getType())->getNumElements(); lanes > 2; )
+      {
+         lanes /= 2;
+         std::vector<llvm::Constant*> lowLanes, highLanes;
+         for (unsigned i = 0; i != lanes; ++i)
+         {
+            lowLanes.push_back(builder_.getInt32(i));
+            highLanes.push_back(builder_.getInt32(lanes + i));
+         }
          
-         // Remember this binding.
-         namedValues_[varName] = alloca;
+         auto undef = llvm::UndefValue::get(vector->getType());
+         vector = combine(builder_.CreateShuffleVector(vector, undef, llvm::ConstantVector::get(lowLanes), "low"),
+                          builder_.CreateShuffleVector(vector, undef, llvm::ConstantVector::get(highLanes), "high"));
+      }
+      return combine(builder_.CreateExtractElement(vector, builder_.getInt32(0), "low"),
+                     builder_.CreateExtractElement(vector, builder_.getInt32(1), "high"));
+   }
+   
+   void CodeGeneratorImpl::setFunctionFloatingPointMode(Function* function, FloatingPointMode mode)
+   {
+      llvm::FastMathFlags flags;
+      switch (mode)
+      {
+         case FloatingPointMode::Fast:
+            flags.setFast();
+            break;
+         case FloatingPointMode::Contract:
+            flags.setAllowContract(true);
+            break;
+         case FloatingPointMode::Strict:
+         case FloatingPointMode::Session:
+            break;
       }
+      builder_.setFastMathFlags(flags);
       
-      // Codegen the body, now that all vars are in scope.
-      auto bodyVal = variableExpr->getBody()->codeGen();
-      if (!bodyVal)
+      //the attributes of a function redefined in the session may come from another mode
+      const bool fast = mode == FloatingPointMode::Fast;
+      for (auto attribute : {"unsafe-fp-math", "no-nans-fp-math", "no-infs-fp-math", "no-signed-zeros-fp-math"})
+         function->addFnAttr(attribute, fast ? "true" : "false");
+      function->addFnAttr("less-precise-fpmad", mode == FloatingPointMode::Strict ? "false" : "true");
+   }
+   
+   Value* CodeGeneratorImpl::emitCombine(Reduction reduction, Value* left, Value* right)
+   {
+      const bool integer = left->getType()->isIntegerTy();
+      Value* combined = nullptr;
+      switch (reduction)
+      {
+         case Reduction::Min:
+            return builder_.CreateSelect(integer ? builder_.CreateICmpSLT(left, right)
+                                                 : builder_.CreateFCmpOLT(left, right), left, right, "min");
+         case Reduction::Max:
+            return builder_.CreateSelect(integer ? builder_.CreateICmpSGT(left, right)
+                                                 : builder_.CreateFCmpOGT(left, right), left, right, "max");
+         case Reduction::Product:
+            if (integer)
+               return builder_.CreateMul(left, right, "product");
+            combined = builder_.CreateFMul(left, right, "product");
+            break;
+         case Reduction::Sum:
+         case Reduction::None:
+            if (integer)
+               return builder_.CreateAdd(left, right, "sum");
+            combined = builder_.CreateFAdd(left, right, "sum");
+            break;
+      }
+      
+      //on top of the flags of the mode of the function
+      if (auto instruction = llvm::dyn_cast<llvm::Instruction>(combined))
+      {
+         auto flags = builder_.getFastMathFlags();
+         flags.setAllowReassoc();
+         instruction->setFastMathFlags(flags);
+      }
+      return combined;
+   }
+   
+   llvm::Constant* CodeGeneratorImpl::getReductionIdentity(Reduction reduction, llvm::Type* type)
+   {
+      const bool integer = type->isIntegerTy();
+      switch (reduction)
+      {
+         case Reduction::Product:
+            return integer ? llvm::ConstantInt::get(type, 1) : llvm::ConstantFP::get(type, 1.0);
+         case Reduction::Min:
+            return integer ? llvm::ConstantInt::get(type, llvm::APInt::getSignedMaxValue(type->getIntegerBitWidth()))
+                           : llvm::ConstantFP::get(type, std::numeric_limits<double>::infinity());
+         case Reduction::Max:
+            return integer ? llvm::ConstantInt::get(type, llvm::APInt::getSignedMinValue(type->getIntegerBitWidth()))
+                           : llvm::ConstantFP::get(type, -std::numeric_limits<double>::infinity());
+         case Reduction::Sum:
+         case Reduction::None:
+            break;
+      }
+      
+      // -0.0 is the identity of the floating point sum: -0.0 + x is x for every x, -0.0 included
+      return integer ? llvm::ConstantInt::get(type, 0) : llvm::ConstantFP::getNegativeZero(type);
+   }
+   
+   Value* CodeGeneratorImpl::emitIndex(AllocaInst* array, Value* index, AllocaInst* indexVariable)
+   {
+      if (array->getAllocatedType()->isVectorTy())
+      {
+         index = emitLaneIndex(array, index);
+         if (!index)
+            return nullptr;
+         return builder_.CreateExtractElement(builder_.CreateLoad(array, array->getName()), index, "lane");
+      }
+      
+      auto address = emitElementAddress(array, index, indexVariable);
+      if (!address)
          return nullptr;
       
-      // Pop all our variables from scope.
-      for (unsigned i = 0, e = variableNames.size(); i != e; ++i)
-         namedValues_[variableNames[i].first] = oldBindings[i];
+      auto element = builder_.CreateLoad(address, "element");
+      addAliasScopes(element, array);
+      return element;
+   }
+   
+   Value* CodeGeneratorImpl::emitIndexAssignment(AllocaInst* array, Value* index, AllocaInst* indexVariable,
+                                                 Value* value)
+   {
+      // a lane is stored by storing the whole vector
+      if (array->getAllocatedType()->isVectorTy())
+      {
+         index = emitLaneIndex(array, index);
+         value = index ? convert(value, array->getAllocatedType()->getScalarType()) : nullptr;
+         if (!value)
+            return nullptr;
+         auto vector = builder_.CreateLoad(array, array->getName());
+         builder_.CreateStore(builder_.CreateInsertElement(vector, value, index, "vec"), array);
+         return value;
+      }
       
-      // Return the body computation.
-      return bodyVal;
-
+      auto address = emitElementAddress(array, index, indexVariable);
+      if (!address)
+         return nullptr;
+      
+      value = convert(value, address->getType()->getPointerElementType());
+      if (!value)
+         return nullptr;
+      addAliasScopes(builder_.CreateStore(value, address), array);
+      return value;
    }
-
    
-
+   Value* CodeGeneratorImpl::emitElementAddress(AllocaInst* array, Value* index, AllocaInst* indexVariable)
+   {
+      if (!isArray(array->getAllocatedType()))
+         return errorV("only arrays and vectors can be indexed");
+      
+      index = convert(index, builder_.getInt64Ty());
+      if (!index)
+         return nullptr;
+      
+      // the loop counting the index variable replaces the conversion and removes the check
+      // when it qualifies
+      CountedLoop* loop = nullptr;
+      for (auto& counted : countedLoops_)
+         if (indexVariable && counted.counter == indexVariable)
+            loop = &counted;
+      if (loop && llvm::isa<llvm::FPToSIInst>(index))
+         loop->indices.push_back(llvm::cast<llvm::Instruction>(index));
+      
+      auto arrayValue = builder_.CreateLoad(array, array->getName());
+      auto elements = builder_.CreateExtractValue(arrayValue, 0, "elements");
+      
+      if (boundsChecks_)
+      {
+         auto check = emitBoundsCheck(index, builder_.CreateExtractValue(arrayValue, 1, "len"));
+         if (loop && loop->array == array)
+            loop->checks.push_back(check);
+      }
+      
+      return builder_.CreateInBoundsGEP(elements, index, "address");
+   }
+   
+   Value* CodeGeneratorImpl::emitLaneIndex(AllocaInst* vector, Value* index)
+   {
+      index = convert(index, builder_.getInt64Ty());
+      if (!index)
+         return nullptr;
+      
+      // the lanes are known: constant indices are checked now, the others like array indices
+      const auto lanes = llvm::cast<llvm::VectorType>(vector->getAllocatedType())->getNumElements();
+      if (auto constant = llvm::dyn_cast<llvm::ConstantInt>(index))
+         return constant->getValue().ult(lanes) ? index : errorV("lane index out of the vector");
+      
+      if (boundsChecks_)
+         emitBoundsCheck(index, builder_.getInt64(lanes));
+      return index;
+   }
+   
+   llvm::BranchInst* CodeGeneratorImpl::emitBoundsCheck(Value* index, Value* length)
+   {
+      // unsigned comparison: negative indices are out of bounds too
+      auto outOfBounds = builder_.CreateICmpUGE(index, length, "outofbounds");
+      auto InBoundsBB = llvm::BasicBlock::Create(context_, "inbounds", builder_.GetInsertBlock()->getParent());
+      auto check = builder_.CreateCondBr(outOfBounds, getBoundsFailBlock(), InBoundsBB);
+      builder_.SetInsertPoint(InBoundsBB);
+      return check;
+   }
+   
+   void CodeGeneratorImpl::addAliasScopes(llvm::Instruction* access, const AllocaInst* array)
+   {
+      auto scopes = arrayScopes_.find(array);
+      if (scopes == arrayScopes_.end())
+         return;
+      
+      access->setMetadata(llvm::LLVMContext::MD_alias_scope, scopes->second.first);
+      access->setMetadata(llvm::LLVMContext::MD_noalias, scopes->second.second);
+   }
+   
+   llvm::BasicBlock* CodeGeneratorImpl::getBoundsFailBlock()
+   {
+      // one trap per function, shared by all its checks
+      if (!boundsFailBlock_)
+      {
+         auto function = builder_.GetInsertBlock()->getParent();
+         boundsFailBlock_ = llvm::BasicBlock::Create(context_, "boundsfail", function);
+         llvm::IRBuilder<> TrapB(boundsFailBlock_);
+         TrapB.CreateCall(llvm::Intrinsic::getDeclaration(module_.get(), llvm::Intrinsic::trap));
+         TrapB.CreateUnreachable();
+      }
+      return boundsFailBlock_;
+   }
+   
+   
    ///
    /// Jit compilation test
    ///
@@ -478,37 +1626,166 @@ namespace code_generator
    /// private interface
    ///
    
-   AllocaInst* CodeGeneratorImpl::CreateEntryBlockAlloca(Function *function, const std::string &variableName)
+   AllocaInst* CodeGeneratorImpl::CreateEntryBlockAlloca(Function *function, llvm::StringRef variableName,
+                                                         llvm::Type* type)
    {
       llvm::IRBuilder<> TmpB(&function->getEntryBlock(), function->getEntryBlock().begin());
-      return TmpB.CreateAlloca(llvm::Type::getDoubleTy(context_), 0, variableName.c_str());
+      return TmpB.CreateAlloca(type, 0, variableName);
+   }
+   
+   llvm::Type* CodeGeneratorImpl::getType(ValueType type)
+   {
+      switch (type)
+      {
+         case ValueType::F32:
+            return llvm::Type::getFloatTy(context_);
+         case ValueType::I64:
+            return llvm::Type::getInt64Ty(context_);
+         case ValueType::I32:
+            return llvm::Type::getInt32Ty(context_);
+         case ValueType::Vec2:
+         case ValueType::Vec4:
+         case ValueType::Vec8:
+            return llvm::VectorType::get(llvm::Type::getDoubleTy(context_), getVectorWidth(type));
+         case ValueType::F64Array:
+         case ValueType::F32Array:
+         case ValueType::I64Array:
+         case ValueType::I32Array:
+            return llvm::StructType::get(context_, {getType(getElementType(type))->getPointerTo(),
+                                                    llvm::Type::getInt64Ty(context_)});
+         case ValueType::F64:
+         case ValueType::Auto:
+            break;
+      }
+      return llvm::Type::getDoubleTy(context_);
+   }
+   
+   bool CodeGeneratorImpl::isArray(const llvm::Type* type) const
+   {
+      return type->isStructTy();
+   }
+   
+   Value* CodeGeneratorImpl::convert(Value* value, llvm::Type* type)
+   {
+      const auto from = value->getType();
+      if (from == type)
+         return value;
+      
+      if (isArray(from) || isArray(type))
+         return errorV(isArray(from) ? "an array is used as a number" : "a number is used as an array");
+      
+      // a number is repeated in every lane of a vector
+      if (type->isVectorTy())
+      {
+         if (from->isVectorTy())
+            return errorV("vectors of different widths");
+         auto lane = convert(value, type->getScalarType());
+         return builder_.CreateVectorSplat(llvm::cast<llvm::VectorType>(type)->getNumElements(), lane, "splat");
+      }
+      if (from->isVectorTy())
+         return errorV("a vector is used as a number, reduce it first");
+      
+      if (from->isIntegerTy())
+         return type->isIntegerTy() ? builder_.CreateSExtOrTrunc(value, type, "conv")
+                                    : builder_.CreateSIToFP(value, type, "conv");
+      
+      return type->isIntegerTy() ? builder_.CreateFPToSI(value, type, "conv")
+                                 : builder_.CreateFPCast(value, type, "conv");
+   }
+   
+   llvm::Type* CodeGeneratorImpl::getCommonType(Value* left, Value* right)
+   {
+      const auto leftType = left->getType(), rightType = right->getType();
+      if (leftType == rightType)
+         return leftType;
+      
+      //numbers are repeated in the lanes of a vector
+      if (leftType->isVectorTy() || rightType->isVectorTy())
+         return leftType->isVectorTy() ? leftType : rightType;
+      
+      //literals adapt to the other operand
+      auto leftLiteral = llvm::dyn_cast<llvm::Constant>(left);
+      auto rightLiteral = llvm::dyn_cast<llvm::Constant>(right);
+      if (leftLiteral && !rightLiteral && isRepresentable(leftLiteral, rightType))
+         return rightType;
+      if (rightLiteral && !leftLiteral && isRepresentable(rightLiteral, leftType))
+         return leftType;
+      
+      if (leftType->isIntegerTy() == rightType->isIntegerTy())
+         return leftType->getPrimitiveSizeInBits() >= rightType->getPrimitiveSizeInBits() ? leftType : rightType;
+      
+      return leftType->isIntegerTy() ? rightType : leftType;
+   }
+   
+   Value* CodeGeneratorImpl::emitIsTrue(Value* value, const llvm::Twine& name)
+   {
+      if (isArray(value->getType()))
+         return errorV("an array is used as a condition");
+      if (value->getType()->isVectorTy())
+         return errorV("a vector is used as a condition, reduce it or use select");
+      
+      if (value->getType()->isIntegerTy())
+         return builder_.CreateICmpNE(value, llvm::ConstantInt::get(value->getType(), 0), name);
+      
+      return builder_.CreateFCmpONE(value, llvm::ConstantFP::get(value->getType(), 0.0), name);
+   }
+   
+   AllocaInst* CodeGeneratorImpl::lookupVariable(util::symbol_t name, util::slot_t slot)
+   {
+      slot = namedValues_.lookup(name, slot);
+      return slot != util::noSlot ? namedValues_.getValue(slot) : nullptr;
    }
    
    ///
    ///
    ///
-   Function* CodeGeneratorImpl::getFunction(const std::string& name) const
+   Function* CodeGeneratorImpl::getFunction(util::symbol_t name)
    {
-      if( auto f = module_->getFunction(name) )
+      if( auto f = module_->getFunction(util::symbolName(name)) )
          return f;
       
       auto fi = prototypeCache_.find(name);
       if ( fi != prototypeCache_.end())
-         return fi->second->codeGen();
+         return fi->second->codeGen(*this);
       
       return nullptr;
    }
-
+   
+   Function* CodeGeneratorImpl::getCallee(util::symbol_t name)
+   {
+      auto function = getFunction(name);
+      if( function && function->isDeclaration() )
+         library_.import(*function);
+      return function;
+   }
+   
    
    ///
    /// @brief: manage assigment
    ///
    llvm::Value* CodeGeneratorImpl::manageAssignment(const BinaryExprAST* binaryExpression)
    {
-      using variable_expression_t = const std::unique_ptr<VariableExprAST>&;
-      //bit hacky here...
-      const auto& lhs = reinterpret_cast<variable_expression_t>(binaryExpression->getLeftOperand());
-      const auto& rhs = binaryExpression->getRightOperand();
+      const auto lhs = llvm::dyn_cast<VariableExprAST>(binaryExpression->getLeftOperand());
+      const auto rhs = binaryExpression->getRightOperand();
+      
+      //store to an array element
+      if (auto element = llvm::dyn_cast<IndexExprAST>(binaryExpression->getLeftOperand()))
+      {
+         const auto array = element->getArray();
+         auto alloca = lookupVariable(array->getSymbol(), array->getSlot());
+         if (!alloca)
+            return errorV("Unknown variable name");
+         
+         auto index = element->getIndex()->codeGen(*this);
+         auto value = index ? rhs->codeGen(*this) : nullptr;
+         if (!value)
+            return nullptr;
+         
+         AllocaInst* indexVariable = nullptr;
+         if (auto variable = llvm::dyn_cast<VariableExprAST>(element->getIndex()))
+            indexVariable = lookupVariable(variable->getSymbol(), variable->getSlot());
+         return emitIndexAssignment(alloca, index, indexVariable, value);
+      }
       
       if (!lhs)
          return errorV("destination of '=' must be a variable");
@@ -516,16 +1793,10 @@ namespace code_generator
       if(!rhs)
          return errorV("expression to evaluate to the right of '=' must be valid");
       
-      auto value = rhs->codeGen();
+      auto value = rhs->codeGen(*this);
       if (!value)
          return nullptr;
       
-      // Look-up the name.
-      auto variable = namedValues_[lhs->getName()];
-      if (!variable)
-         return errorV("Unknown variable name");
-      
-      builder_.CreateStore(value, variable);
-      return value;
+      return emitAssignment(lhs->getSymbol(), lhs->getSlot(), value);
    }
 }
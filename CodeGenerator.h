@@ -13,11 +13,21 @@
 #include <unordered_map>
 #include <map>
 #include <memory>
+#include <cstdint>
 
 #include "llvm/IR/Module.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Optional.h"
 #include "Optimizer.h"
+#include "Builtins.h"
+#include "DefinitionLibrary.h"
+#include "Interner.h"
+#include "ScopedSymbolTable.h"
+#include "ValueType.h"
 
 
 namespace llvm
@@ -29,6 +39,7 @@ namespace llvm
 
 namespace AST
 {
+   class ExprAST;
    class NumberExprAST;
    class VariableExprAST;
    class UnaryExprAST;
@@ -39,6 +50,10 @@ namespace AST
    class IfExprAST;
    class ForExprAST;
    class VarExprAST;
+   class IndexExprAST;
+   class FlatAST;
+   enum class Reduction : std::uint8_t;
+   using node_index_t = std::uint32_t;
 };
 
 namespace parser
@@ -50,6 +65,11 @@ namespace jit {
    class JIT;
 }
 
+namespace optimizer
+{
+   class PurityAnalysis;
+}
+
 using namespace AST;
 using namespace parser;
 using llvm::Value;
@@ -59,7 +79,7 @@ using llvm::AllocaInst;
 namespace code_generator
 {
    using precedence_tree_t = std::map<unsigned char, int>;
-   using prototype_cache_t = std::unordered_map<std::string, std::unique_ptr<PrototypeAST>>;
+   using prototype_cache_t = std::unordered_map<util::symbol_t, std::unique_ptr<PrototypeAST>>;
    
    ///
    /// @brief: custom exception thrown by code generator
@@ -102,7 +122,36 @@ namespace code_generator
       virtual Function* codeGenPrototypeExpr(const PrototypeAST*) = 0;
       virtual Function* codeGenFunctionExpr(const FunctionAST*) = 0;
       virtual Value* codeGeneVarExpr(const VarExprAST*) = 0;
+      virtual Value* codeGenIndexExpr(const IndexExprAST*) = 0;
       
+      ///
+      /// @brief: emit a function whose body has been linearized in a FlatAST
+      ///
+      virtual Function* codeGenFlatFunction(const FunctionAST*, const FlatAST&) = 0;
+      
+      ///
+      /// @brief: nodes with more than one parent (hash consing) in the next function generated:
+      ///         their value is emitted once per basic block. nullptr when nothing is shared
+      ///
+      virtual void setSharedExpressions(const llvm::DenseSet<const ExprAST*>* shared) = 0;
+      
+      ///
+      /// @brief: check the indices of the array accesses, out of bounds accesses trap
+      ///
+      virtual void setBoundsChecks(bool enabled) = 0;
+      
+      ///
+      /// @brief: floating point mode of the functions without a mode annotation
+      ///
+      virtual void setFloatingPointMode(FloatingPointMode mode) = 0;
+      
+      ///
+      /// @brief: an 'if' whose branches can be evaluated unconditionally and cost at most threshold
+      ///         together (PurityAnalysis::getSpeculationCost) evaluates both and selects the value,
+      ///         without branching. No purity analysis or a threshold of 0 keep every 'if' a branch
+      ///
+      virtual void setSelectLowering(const optimizer::PurityAnalysis* purity, unsigned threshold) = 0;
+   
    public:
       
       //adding new symbols and/or process new prototypes
@@ -111,13 +160,32 @@ namespace code_generator
       virtual const prototype_cache_t& getProtypeCache() const = 0;
       
       virtual void setOperatorPrecedence(unsigned char token, int value) = 0;
-      virtual void addProtypeCache(const std::string& key, std::unique_ptr<PrototypeAST>& prototype) = 0;
+      virtual void addProtypeCache(util::symbol_t key, std::unique_ptr<PrototypeAST>& prototype) = 0;
       
       //virtual hack to get the module
       virtual void getModule(std::unique_ptr<llvm::Module>& module) = 0;
       //hack to initialize the module and pass manager
       virtual void InitializeModuleAndPassManager() = 0;
       
+      ///
+      /// @brief: keep the optimized body of a definition handed to the jit, later modules calling
+      ///         it import the body for inlining
+      ///
+      virtual void exportDefinition(const Function& definition) = 0;
+      
+      ///
+      /// @brief: a module with the exported definition of the name passed and the ones it calls,
+      ///         to run them apart (compile time evaluation), null when not exported
+      ///
+      virtual std::unique_ptr<llvm::Module> extractDefinition(const std::string& name) const = 0;
+      
+      ///
+      /// @brief: pipeline the modules go through, once, before they are handed to the jit.
+      ///         False when the module doesn't verify: it must not reach the jit
+      ///
+      virtual void setOptimizationLevel(optimizer::OptimizationLevel level) = 0;
+      virtual bool optimizeModule() = 0;
+   
    };
    
    ///
@@ -127,9 +195,9 @@ namespace code_generator
    class CodeGeneratorImpl : public CodeGenerator
    {
    public:
-    
+      
       explicit CodeGeneratorImpl(jit::JIT& jitCompiler);
-
+      
       //concrete impleentation for generatring IR
       
       virtual Value* errorV(const std::string&) const override;
@@ -143,32 +211,69 @@ namespace code_generator
       virtual Function* codeGenPrototypeExpr(const PrototypeAST*) override;
       virtual Function* codeGenFunctionExpr(const FunctionAST*) override;
       virtual Value* codeGeneVarExpr(const VarExprAST*) override;
-
+      virtual Value* codeGenIndexExpr(const IndexExprAST*) override;
+      virtual Function* codeGenFlatFunction(const FunctionAST*, const FlatAST&) override;
+      virtual void setSharedExpressions(const llvm::DenseSet<const ExprAST*>* shared) override;
+      virtual void setBoundsChecks(bool enabled) override;
+      virtual void setFloatingPointMode(FloatingPointMode mode) override;
+      virtual void setSelectLowering(const optimizer::PurityAnalysis* purity, unsigned threshold) override;
+   
    public:
       
       //concrete implementation for adding new prototypes/symbols
       virtual int getOperatorPrecedence(unsigned char token) const override;
       virtual const prototype_cache_t& getProtypeCache() const override;
       virtual void setOperatorPrecedence(unsigned char token, int value) override;
-      virtual void addProtypeCache(const std::string& key, std::unique_ptr<PrototypeAST>& prototype) override;
-
+      virtual void addProtypeCache(util::symbol_t key, std::unique_ptr<PrototypeAST>& prototype) override;
+      
       //hack to retrieve the module
       virtual void getModule( std::unique_ptr<llvm::Module>& module) override { module = std::move(module_); }
       virtual void InitializeModuleAndPassManager() override;
-
-      
+      virtual void exportDefinition(const Function& definition) override;
+      virtual std::unique_ptr<llvm::Module> extractDefinition(const std::string& name) const override;
+      virtual void setOptimizationLevel(optimizer::OptimizationLevel level) override;
+      virtual bool optimizeModule() override;
+   
+   
    private:
       
       llvm::LLVMContext context_;
       llvm::IRBuilder<> builder_;
       std::unique_ptr<llvm::Module> module_;
       std::unique_ptr<optimizer::Optimizer> optimizer_;
-      std::unordered_map<std::string, llvm::AllocaInst*> namedValues_;
+      DefinitionLibrary library_{context_}; //definitions of the previous modules
+      util::ScopedSymbolTable<llvm::AllocaInst*> namedValues_; //allocas of the variables in scope
       precedence_tree_t binaryOperationPrecedence_;
       prototype_cache_t prototypeCache_;
       
-      jit::JIT& jitCompiler_;
+      //values of the shared nodes (tree or flat) with the block they have been emitted in
+      const llvm::DenseSet<const ExprAST*>* sharedExpressions_ = nullptr;
+      llvm::DenseMap<const void*, std::pair<llvm::BasicBlock*, Value*>> sharedValues_;
+      
+      //calls (tree or flat nodes) in tail position in the current function
+      llvm::DenseSet<const void*> tailCalls_;
+      
+      //arrays: the argument arrays of the current function with their alias scopes and the
+      //enclosing loops counted by an i64 induction variable, indexing arrays with their variable
+      struct CountedLoop
+      {
+         AllocaInst* counter;
+         llvm::PHINode* induction;
+         AllocaInst* array;                     //array the counter is proven in the bounds of
+         std::vector<llvm::BranchInst*> checks; //checks of array[counter] in the body
+         std::vector<llvm::Instruction*> indices; //indices converted back from the variable
+      };
+      
+      FloatingPointMode floatingPointMode_ = FloatingPointMode::Strict;
+      const optimizer::PurityAnalysis* purity_ = nullptr;
+      unsigned selectThreshold_ = 0;
+      bool boundsChecks_ = false;
+      llvm::BasicBlock* boundsFailBlock_ = nullptr;
+      llvm::DenseMap<const AllocaInst*, std::pair<llvm::MDNode*, llvm::MDNode*>> arrayScopes_;
+      std::vector<CountedLoop> countedLoops_;
       
+      jit::JIT& jitCompiler_;
+   
    private:
       
       //private interface
@@ -177,13 +282,47 @@ namespace code_generator
       /// @brief: create an alloca instruction at the entry of the block for the function passed
       ///         as argument. Used for mutable variables
       ///
-      AllocaInst *CreateEntryBlockAlloca(Function *function, const std::string &variableName);
-
+      AllocaInst *CreateEntryBlockAlloca(Function *function, llvm::StringRef variableName, llvm::Type* type);
+      
+      ///
+      /// @brief: numeric types. Values are converted like in C (sign extension, truncation toward zero)
+      ///
+      llvm::Type* getType(ValueType type);
+      Value* convert(Value* value, llvm::Type* type);
+      
+      ///
+      /// @brief: an array is the value {element*, i64 length}, passed to functions as two arguments
+      ///
+      bool isArray(const llvm::Type* type) const;
+      
+      ///
+      /// @brief: type two operands are computed in. A literal (constant) takes the type of the other
+      ///         operand when it is exactly representable in it, otherwise the wider type wins and
+      ///         floating point wins over integer
+      ///
+      llvm::Type* getCommonType(Value* left, Value* right);
+      
+      ///
+      /// @brief: i1 set when the value is not zero
+      ///
+      Value* emitIsTrue(Value* value, const llvm::Twine& name);
+      
+      ///
+      /// @brief: alloca of a variable in scope, nullptr when it is not bound
+      ///
+      AllocaInst* lookupVariable(util::symbol_t name, util::slot_t slot);
+      
       
       ///
       /// @brief: retrieve a function either from the current module or run the code genetor for it
       ///
-      Function* getFunction(const std::string& name) const;
+      Function* getFunction(util::symbol_t name);
+      
+      ///
+      /// @brief: the function called by name, with the body of its definition in a previous
+      ///         module imported (available_externally) when small enough to be inlined
+      ///
+      Function* getCallee(util::symbol_t name);
       
       
       ///
@@ -191,8 +330,95 @@ namespace code_generator
       ///
       Value* manageAssignment(const BinaryExprAST*);
       
-   };
+      ///
+      /// @brief: switch based code generation for a node of a flat expression
+      ///
+      Value* codeGenFlat(const FlatAST& flat, node_index_t index);
+      Value* codeGenFlatNode(const FlatAST& flat, node_index_t index);
+      
+      ///
+      /// @brief: index of a flat Index node, with the alloca of its array and of its index variable
+      ///
+      Value* codeGenFlatIndex(const FlatAST& flat, node_index_t index,
+                              AllocaInst*& array, AllocaInst*& indexVariable);
+      
+      ///
+      /// @brief: emitters shared by the tree and the flat representation, children
+      ///         are produced by the callbacks passed
+      ///
+      using gen_value_t = llvm::function_ref<Value*()>;
+      
+      ///
+      /// @brief: what the tree tells about a 'for' before it is generated
+      ///
+      struct LoopShape
+      {
+         llvm::Optional<double> constantStep; //the step is a literal (1.0 when omitted)
+         bool endIsUpperBound = false;        //the end condition is 'variable < bound'
+      
+         //the bound is 'len(array) - offset' (offset 0 for 'len(array)')
+         util::symbol_t boundArray = util::StringInterner::invalidSymbol;
+         util::slot_t boundArraySlot = util::noSlot;
+         double boundOffset = 0.0;
+      };
+      
+      Value* emitNumber(double value);
+      Value* emitVariable(util::symbol_t name, util::slot_t slot);
+      Value* emitUnary(unsigned char opcode, Value* operand);
+      Value* emitBinary(unsigned char opcode, Value* left, Value* right);
+      Value* emitAssignment(util::symbol_t name, util::slot_t slot, Value* value);
+      Value* emitCall(util::symbol_t callee, size_t argCount, llvm::function_ref<Value*(size_t)> genArg,
+                      bool tail = false);
+      Value* emitIf(gen_value_t genCond, gen_value_t genThen, gen_value_t genElse, bool select = false);
+      bool lowersToSelect(llvm::Optional<unsigned> thenCost, llvm::Optional<unsigned> elseCost) const;
+      Value* emitFor(util::symbol_t varName, gen_value_t genStart, gen_value_t genEnd,
+                     gen_value_t genStep, gen_value_t genBody,
+                     const LoopShape& shape, gen_value_t genBound, Reduction reduction);
+      Value* emitVar(size_t count, llvm::function_ref<util::symbol_t(size_t)> getName,
+                     llvm::function_ref<ValueType(size_t)> getVarType,
+                     llvm::function_ref<Value*(size_t)> genInit, gen_value_t genBody);
+      Function* emitFunction(const FunctionAST* function, gen_value_t genBody);
+      
+      ///
+      /// @brief: fast math flags of the floating point operations emitted next in the function,
+      ///         and the attributes letting the backend apply the mode to its own transformations
+      ///
+      void setFunctionFloatingPointMode(Function* function, FloatingPointMode mode);
+      
+      ///
+      /// @brief: builtin functions, emitted inline. Vectors map to LLVM vectors of doubles:
+      ///         numbers mixed with vectors are repeated in every lane
+      ///
+      Value* emitBuiltin(Builtin builtin, size_t argCount, llvm::function_ref<Value*(size_t)> genArg);
+      Value* emitReduction(Builtin builtin, Value* vector);
+      
+      ///
+      /// @brief: one step of a reduction and its initial value. Floating point steps may be
+      ///         reassociated: reductions are split in partial results combined at the end
+      ///
+      Value* emitCombine(Reduction reduction, Value* left, Value* right);
+      llvm::Constant* getReductionIdentity(Reduction reduction, llvm::Type* type);
+      
+      ///
+      /// @brief: array element (or vector lane) access, indexVariable is the alloca of the index
+      ///         when it is a plain variable (its checks can be removed by an enclosing loop)
+      ///
+      Value* emitIndex(AllocaInst* array, Value* index, AllocaInst* indexVariable);
+      Value* emitIndexAssignment(AllocaInst* array, Value* index, AllocaInst* indexVariable, Value* value);
+      Value* emitElementAddress(AllocaInst* array, Value* index, AllocaInst* indexVariable);
+      Value* emitLaneIndex(AllocaInst* vector, Value* index);
+      llvm::BranchInst* emitBoundsCheck(Value* index, Value* length);
+      void addAliasScopes(llvm::Instruction* access, const AllocaInst* array);
+      llvm::BasicBlock* getBoundsFailBlock();
+      
+      ///
+      /// @brief: reuse the value of a shared node already emitted in the current basic block
+      ///
+      Value* memoize(const void* node, bool shared, gen_value_t emit);
+      bool isShared(const ExprAST* node) const;
    
+   };
+
 }
 
 
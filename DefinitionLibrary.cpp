@@ -0,0 +1,196 @@
+//
+//  DefinitionLibrary.cpp
+//  Kaleidoscope-LLVM
+//
+//  optimized IR of the definitions handed to the jit, imported by later modules for inlining
+//
+
+#include "DefinitionLibrary.h"
+
+#include <vector>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+namespace code_generator
+{
+   namespace
+   {
+      ///
+      /// @brief: bodies above this many instructions are beyond the inliner threshold anyway,
+      ///         copying them in every calling module would only slow down compilation
+      ///
+      const size_t importLimit = 256;
+      
+      size_t countInstructions(const llvm::Function& function)
+      {
+         size_t count = 0;
+         for (const auto& block : function)
+            count += block.size();
+         return count;
+      }
+      
+      ///
+      /// @brief: the global of the same name of module (declared when missing), null when it has another type
+      ///
+      llvm::GlobalVariable* getGlobalDeclaration(llvm::Module& module, const llvm::GlobalVariable& global)
+      {
+         auto declaration = module.getGlobalVariable(global.getName(), true);
+         if (!declaration)
+            declaration = new llvm::GlobalVariable(module, global.getValueType(), global.isConstant(),
+                                                   llvm::GlobalValue::ExternalLinkage, nullptr, global.getName());
+         return declaration->getValueType() == global.getValueType() ? declaration : nullptr;
+      }
+      
+      ///
+      /// @brief: copy the body of source into target (a declaration of the same type). The
+      ///         functions called by source are mapped to the functions of the same name of the
+      ///         module of target, declared when missing. Fails if one of them has another type.
+      ///         The globals used directly (the tables of the memoized definitions) are mapped the same way
+      ///
+      bool cloneBody(const llvm::Function& source, llvm::Function& target)
+      {
+         auto& module = *target.getParent();
+         llvm::ValueToValueMapTy mapping;
+         mapping[&source] = &target;
+         
+         auto parameter = target.arg_begin();
+         for (const auto& argument : source.args())
+         {
+            parameter->setName(argument.getName());
+            mapping[&argument] = &*parameter++;
+         }
+         
+         for (const auto& block : source)
+            for (const auto& instruction : block)
+               for (const auto& operand : instruction.operands())
+               {
+                  if (auto global = llvm::dyn_cast<llvm::GlobalVariable>(operand.get()))
+                  {
+                     if (mapping.count(global))
+                        continue;
+                     auto declaration = getGlobalDeclaration(module, *global);
+                     if (!declaration)
+                        return false;
+                     mapping[global] = declaration;
+                     continue;
+                  }
+                  
+                  auto callee = llvm::dyn_cast<llvm::Function>(operand.get());
+                  if (!callee || mapping.count(callee))
+                     continue;
+                  
+                  auto declaration = module.getFunction(callee->getName());
+                  if (!declaration)
+                  {
+                     declaration = llvm::Function::Create(callee->getFunctionType(), llvm::Function::ExternalLinkage,
+                                                          callee->getName(), &module);
+                     declaration->copyAttributesFrom(callee);
+                  }
+                  if (declaration->getFunctionType() != callee->getFunctionType())
+                     return false;
+                  mapping[callee] = declaration;
+               }
+         
+         llvm::SmallVector<llvm::ReturnInst*, 4> returns;
+         llvm::CloneFunctionInto(&target, &source, mapping, true, returns);
+         return true;
+      }
+   }
+   
+   DefinitionLibrary::DefinitionLibrary(llvm::LLVMContext& context) :
+   module_(std::make_unique<llvm::Module>("library", context))
+   {}
+   
+   DefinitionLibrary::~DefinitionLibrary() = default;
+   
+   void DefinitionLibrary::add(const llvm::Function& definition)
+   {
+      auto copy = module_->getFunction(definition.getName());
+      if (!copy)
+         copy = llvm::Function::Create(definition.getFunctionType(), llvm::Function::ExternalLinkage,
+                                       definition.getName(), module_.get());
+      else if (copy->getFunctionType() != definition.getFunctionType())
+         return;
+      
+      copy->deleteBody();
+      if (!cloneBody(definition, *copy))
+         copy->deleteBody();
+   }
+   
+   bool DefinitionLibrary::import(llvm::Function& declaration) const
+   {
+      //the functions called by an imported body are imported in turn: a chain of helpers inlines
+      //entirely. A body is imported once, turning it into a definition ends recursions
+      std::vector<llvm::Function*> pending{&declaration};
+      bool imported = false;
+      while (!pending.empty())
+      {
+         auto function = pending.back();
+         pending.pop_back();
+         if (!function->isDeclaration())
+            continue;
+         
+         auto definition = module_->getFunction(function->getName());
+         if (!definition || definition->isDeclaration() ||
+             definition->getFunctionType() != function->getFunctionType() ||
+             countInstructions(*definition) > importLimit || !cloneBody(*definition, *function))
+            continue;
+         
+         function->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+         imported |= function == &declaration;
+         
+         for (const auto& block : *function)
+            for (const auto& instruction : block)
+               if (auto call = llvm::dyn_cast<llvm::CallInst>(&instruction))
+                  if (auto callee = call->getCalledFunction())
+                     pending.push_back(callee);
+      }
+      return imported;
+   }
+   
+   std::unique_ptr<llvm::Module> DefinitionLibrary::extract(llvm::StringRef name) const
+   {
+      auto definition = module_->getFunction(name);
+      if (!definition || definition->isDeclaration())
+         return nullptr;
+      
+      auto module = std::make_unique<llvm::Module>(name, module_->getContext());
+      auto root = llvm::Function::Create(definition->getFunctionType(), llvm::Function::ExternalLinkage, name, module.get());
+      root->copyAttributesFrom(definition);
+      
+      //cloning a body declares its callees: the module grows while it is walked
+      std::vector<llvm::Function*> pending{root};
+      while (!pending.empty())
+      {
+         auto function = pending.back();
+         pending.pop_back();
+         
+         auto body = module_->getFunction(function->getName());
+         if (!body || body->isDeclaration() || body->getFunctionType() != function->getFunctionType())
+            continue;
+         if (!cloneBody(*body, *function))
+            return nullptr;
+         
+         for (const auto& block : *function)
+            for (const auto& instruction : block)
+               if (auto call = llvm::dyn_cast<llvm::CallInst>(&instruction))
+                  if (auto callee = call->getCalledFunction())
+                     if (callee->isDeclaration())
+                        pending.push_back(callee);
+      }
+      
+      //the state of the session stays untouched (the tables and counters of the memoized definitions)
+      for (auto& global : module->globals())
+      {
+         global.setInitializer(llvm::Constant::getNullValue(global.getValueType()));
+         global.setLinkage(llvm::GlobalValue::InternalLinkage);
+      }
+      return module;
+   }
+}
@@ -0,0 +1,65 @@
+//
+//  DefinitionLibrary.h
+//  Kaleidoscope-LLVM
+//
+//  optimized IR of the definitions handed to the jit, imported by later modules for inlining
+//
+
+#ifndef DefinitionLibrary_h
+#define DefinitionLibrary_h
+
+#include <memory>
+
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm
+{
+   class Function;
+   class LLVMContext;
+   class Module;
+}
+
+namespace code_generator
+{
+   ///
+   /// @brief: every definition is jit compiled in a module of its own, its callers in later
+   ///         modules only see a declaration. The library keeps a copy of the optimized body of
+   ///         the definitions: a module calling one of them imports the body as available_externally,
+   ///         visible to the inliner but never emitted (the jit resolves the symbol as before)
+   ///
+   class DefinitionLibrary
+   {
+   public:
+      
+      explicit DefinitionLibrary(llvm::LLVMContext& context);
+      ~DefinitionLibrary();
+      DefinitionLibrary(const DefinitionLibrary&) = delete;
+      DefinitionLibrary& operator=(const DefinitionLibrary&) = delete;
+      
+      ///
+      /// @brief: keep a copy of the definition, replacing the body of a previous one of the same name
+      ///
+      void add(const llvm::Function& definition);
+      
+      ///
+      /// @brief: give the declaration passed the body of the definition of the same name, if any
+      ///         and small enough to be inlined, with the bodies of the functions it calls.
+      ///         The functions without a body in the library are declared in the module
+      ///
+      bool import(llvm::Function& declaration) const;
+      
+      ///
+      /// @brief: a module of its own with the definition of the name passed and every definition
+      ///         it calls, directly or not (functions without a body in the library are declared),
+      ///         null when the library has no body of that name. The globals they use are private
+      ///         copies, zero initialized
+      ///
+      std::unique_ptr<llvm::Module> extract(llvm::StringRef name) const;
+   
+   private:
+      
+      std::unique_ptr<llvm::Module> module_;
+   };
+}
+
+#endif /* DefinitionLibrary_h */
@@ -8,17 +8,58 @@
 
 #include "Driver.h"
 #include "Parser.h"
+#include <chrono>
 #include <iostream>
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/TargetSelect.h"
 
+namespace
+{
+   ///
+   /// @brief: lex the whole file over and over for at least a second and report the throughput
+   ///
+   void benchmarkLexer(const std::string& path)
+   {
+      uint64_t fileSize = 0;
+      if (llvm::sys::fs::file_size(path, fileSize) || fileSize == 0)
+      {
+         std::cerr << "Error: cannot benchmark the lexer on " << path << "\n";
+         return;
+      }
+      
+      using clock = std::chrono::steady_clock;
+      unsigned runs = 0;
+      uint64_t tokens = 0;
+      double elapsed = 0;
+      auto start = clock::now();
+      
+      do
+      {
+         auto lexer = lexer::Lexer::createFromFile(path);
+         if (!lexer)
+            return;
+         
+         while (lexer->gettok() != lexer::tok_eof)
+            ++tokens;
+         
+         ++runs;
+         elapsed = std::chrono::duration<double>(clock::now() - start).count();
+      } while (elapsed < 1.0);
+      
+      std::cout << "lexed " << fileSize << " bytes (" << tokens / runs << " tokens) " << runs << " times: "
+                << (fileSize * runs) / (elapsed * 1e6) << " MB/s\n";
+   }
+}
+
 
 driver::DriverConfiguration::DriverConfiguration(bool enableJit,
-                                                 bool enableOpt,
+                                                 optimizer::OptimizationLevel enableOpt,
                                                  bool enableDebug,
                                                  bool saveAsObjectFile,
                                                  bool saveAsAsmFile,
                                                  bool saveAsIRFile,
-                                                 bool dumpOnScreen) : enableJit_(enableJit), enableOpt_(enableOpt), enableDebug_(enableDebug), saveAsObjectFile_(saveAsObjectFile), saveAsAsmFile_(saveAsAsmFile),saveAsIRFile_(saveAsIRFile), dumpOnScreen_(dumpOnScreen)
+                                                 bool dumpOnScreen,
+                                                 std::string inputFile) : enableJit_(enableJit), enableOpt_(enableOpt), enableDebug_(enableDebug), saveAsObjectFile_(saveAsObjectFile), saveAsAsmFile_(saveAsAsmFile),saveAsIRFile_(saveAsIRFile), dumpOnScreen_(dumpOnScreen), inputFile_(std::move(inputFile)), benchmarkLexer_(false), preLex_(false), flatAST_(false), parallelParse_(false), optimizeAST_(true), hashConsing_(false), boundsChecks_(false), wholeFile_(false), floatingPointMode_(AST::FloatingPointMode::Strict), selectThreshold_(8), tiered_(false), hotThreshold_(10000), memoTableSize_(0), constEvalBudget_(0)
 {}
 
 driver::Driver::Driver(driver::DriverConfiguration cnf) :
@@ -27,12 +68,26 @@ driver::Driver::Driver(driver::DriverConfiguration cnf) :
 
 void driver::Driver::go()
 {
+   if (cnf_.benchmarkLexer_)
+   {
+      benchmarkLexer(cnf_.inputFile_);
+      return;
+   }
    
    InitializeNativeTarget();
    InitializeNativeTargetAsmPrinter();
    InitializeNativeTargetAsmParser();
    
-   parser::Parser parser_;
+   //source files are scanned in memory, otherwise std::input is read in blocks
+   auto lexer = cnf_.inputFile_.empty() ? std::make_unique<lexer::Lexer>()
+                                        : lexer::Lexer::createFromFile(cnf_.inputFile_);
+   if (!lexer)
+      return;
+   
+   auto parserPtr = cnf_.preLex_ || cnf_.parallelParse_ ? std::make_unique<parser::Parser>(lexer::TokenTable::lex(*lexer))
+                                 : std::make_unique<parser::Parser>(std::move(lexer));
+   auto& parser_ = *parserPtr;
+   parser_.setConfiguration(cnf_);
    parser_.setTokenPrecedence('=', 2);
    parser_.setTokenPrecedence('<', 10);
    parser_.setTokenPrecedence('+', 20);
@@ -41,6 +96,11 @@ void driver::Driver::go()
    
    std::cout<<"\n >>";
    parser_.getNextToken();
-   parser_.mainLoop();
+   if (cnf_.parallelParse_)
+      parser_.batchLoop();
+   else
+      parser_.mainLoop();
    
+   parser_.saveProfile();
+   parser_.reportMemoization();
 }
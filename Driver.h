@@ -9,13 +9,19 @@
 #ifndef Driver_h
 #define Driver_h
 
+#include <cstdint>
+#include <string>
+
+#include "Optimizer.h"
+#include "ValueType.h"
+
 
 namespace driver {
    
    struct DriverConfiguration {
       
       bool enableJit_;
-      bool enableOpt_;
+      optimizer::OptimizationLevel enableOpt_; //pipeline of the modules handed to the jit
       bool enableDebug_;
       
       bool saveAsObjectFile_;
@@ -23,13 +29,32 @@ namespace driver {
       bool saveAsIRFile_;
       bool dumpOnScreen_;
       
+      std::string inputFile_; //source file to compile, std::input when empty
+      bool benchmarkLexer_;   //only lex inputFile_ and report the throughput
+      bool preLex_;           //lex the whole input up front into a token table
+      bool flatAST_;          //linearize function bodies and generate IR with the switch based walker
+      bool parallelParse_;    //parse the top level items of the token table on a thread pool (implies preLex_)
+      bool optimizeAST_;      //fold constants and prune dead code in the AST before generating IR
+      bool hashConsing_;      //share identical pure subexpressions, emitted once per basic block
+      bool boundsChecks_;     //trap on out of bounds array accesses (removed where a loop proves them)
+      bool wholeFile_;        //one module for the whole input, top level expressions evaluated at its end
+      AST::FloatingPointMode floatingPointMode_; //mode of the functions without a mode annotation
+      unsigned selectThreshold_; //cost of the branches of an 'if' lowered to a select, 0 always branches
+      bool tiered_;           //definitions start unoptimized, the hot ones are re-optimized in the background
+      std::uint64_t hotThreshold_; //calls and loop iterations making a tiered definition hot
+      std::string profileGenerate_; //count the branches and calls of the definitions, written here at exit
+      std::string profileUse_;      //weight the definitions with the profile of a previous session
+      unsigned memoTableSize_;      //entries of the result cache of each pure recursive definition, 0 disables it
+      std::uint64_t constEvalBudget_; //steps of a pure call with constant arguments run at compile time, 0 disables it
+      
       explicit DriverConfiguration(bool enableJit = false,
-                                   bool enableOpt = false,
+                                   optimizer::OptimizationLevel enableOpt = optimizer::OptimizationLevel::O2,
                                    bool enableDebug = false,
                                    bool saveAsObjectFile = false,
                                    bool saveAsAsmFile = false,
                                    bool saveAsIRFile = false,
-                                   bool dumpOnScreen = true);
+                                   bool dumpOnScreen = true,
+                                   std::string inputFile = "");
       
    };
    
@@ -0,0 +1,274 @@
+//
+//  FlatAST.cpp
+//  Kaleidoscope-LLVM
+//
+//  linearized representation of a function body: nodes in a contiguous vector,
+//  children referenced by 32 bit indices, walked with switch based visitors
+//
+
+#include "FlatAST.h"
+
+#include <cassert>
+#include <string>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace AST
+{
+   FlatAST FlatAST::build(const ExprAST* root, const llvm::DenseSet<const ExprAST*>* shared)
+   {
+      FlatAST flat;
+      flat.shared_ = shared;
+      flat.root_ = flat.append(root);
+      flat.shared_ = nullptr;
+      flat.sharedIndices_.clear();
+      return flat;
+   }
+   
+   node_index_t FlatAST::getRoot() const
+   {
+      return root_;
+   }
+   
+   const FlatNode& FlatAST::getNode(node_index_t index) const
+   {
+      assert(index < nodes_.size());
+      return nodes_[index];
+   }
+   
+   llvm::ArrayRef<std::uint32_t> FlatAST::getOperands(node_index_t index) const
+   {
+      const auto& node = getNode(index);
+      if (node.operandCount == 0)
+         return llvm::ArrayRef<std::uint32_t>();
+      return llvm::makeArrayRef(operands_).slice(node.firstOperand, node.operandCount);
+   }
+   
+   double FlatAST::getNumber(node_index_t index) const
+   {
+      assert(getNode(index).kind == ExprKind::Number);
+      return numbers_[getNode(index).payload];
+   }
+   
+   util::symbol_t FlatAST::getSymbol(node_index_t index) const
+   {
+      return getNode(index).payload;
+   }
+   
+   util::slot_t FlatAST::getSlot(node_index_t index) const
+   {
+      assert(getNode(index).kind == ExprKind::Variable && "only variables have a slot");
+      return getNode(index).firstOperand;
+   }
+   
+   std::size_t FlatAST::size() const
+   {
+      return nodes_.size();
+   }
+   
+   node_index_t FlatAST::addNode(ExprKind kind, unsigned char opcode, std::uint32_t payload,
+                                 llvm::ArrayRef<std::uint32_t> operands)
+   {
+      FlatNode node;
+      node.kind = kind;
+      node.opcode = opcode;
+      node.operandCount = static_cast<std::uint16_t>(operands.size());
+      node.payload = payload;
+      node.firstOperand = static_cast<std::uint32_t>(operands_.size());
+      node.flags = 0;
+      
+      operands_.insert(operands_.end(), operands.begin(), operands.end());
+      nodes_.push_back(node);
+      return static_cast<node_index_t>(nodes_.size() - 1);
+   }
+   
+   node_index_t FlatAST::append(const ExprAST* expression)
+   {
+      if (!expression || !shared_ || !shared_->count(expression))
+         return appendNode(expression);
+      
+      auto found = sharedIndices_.find(expression);
+      if (found != sharedIndices_.end())
+         return found->second;
+      
+      const auto index = appendNode(expression);
+      nodes_[index].flags |= FlatNode::sharedFlag;
+      sharedIndices_[expression] = index;
+      return index;
+   }
+   
+   ///
+   /// @brief: post order walk of the tree, children are appended before their parent
+   ///
+   node_index_t FlatAST::appendNode(const ExprAST* expression)
+   {
+      if (!expression)
+         return noNode;
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+            numbers_.push_back(llvm::cast<NumberExprAST>(expression)->getVal());
+            return addNode(ExprKind::Number, 0, static_cast<std::uint32_t>(numbers_.size() - 1), {});
+            
+         case ExprKind::Variable:
+         {
+            //no operands: the operand slice start holds the slot
+            auto variable = llvm::cast<VariableExprAST>(expression);
+            auto index = addNode(ExprKind::Variable, 0, variable->getSymbol(), {});
+            nodes_[index].firstOperand = variable->getSlot();
+            return index;
+         }
+            
+         case ExprKind::Unary:
+         {
+            auto unary = llvm::cast<UnaryExprAST>(expression);
+            std::uint32_t operand = append(unary->getOperand());
+            return addNode(ExprKind::Unary, unary->getOpcode(), 0, operand);
+         }
+            
+         case ExprKind::Binary:
+         {
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            std::uint32_t operands[] = { append(binary->getLeftOperand()), append(binary->getRightOperand()) };
+            return addNode(ExprKind::Binary, binary->getOpcode(), 0, operands);
+         }
+            
+         case ExprKind::Call:
+         {
+            auto call = llvm::cast<CallExprAST>(expression);
+            llvm::SmallVector<std::uint32_t, 4> operands;
+            for (auto arg : call->getArgumentList())
+               operands.push_back(append(arg));
+            return addNode(ExprKind::Call, 0, call->getCallee(), operands);
+         }
+            
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            std::uint32_t operands[] = { append(ifExpr->getCondion()),
+                                         append(ifExpr->getThenBranch()),
+                                         append(ifExpr->getElseBranch()) };
+            return addNode(ExprKind::If, 0, 0, operands);
+         }
+            
+         case ExprKind::For:
+         {
+            auto forExpr = llvm::cast<ForExprAST>(expression);
+            std::uint32_t operands[] = { append(forExpr->getStart()),
+                                         append(forExpr->getEnd()),
+                                         append(forExpr->getStep()),
+                                         append(forExpr->getBody()) };
+            return addNode(ExprKind::For, static_cast<unsigned char>(forExpr->getReduction()), forExpr->getKey(),
+                           operands);
+         }
+            
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            llvm::SmallVector<std::uint32_t, 8> operands;
+            for (const auto& variable : varExpr->getVarNames())
+            {
+               operands.push_back(variable.name);
+               operands.push_back(static_cast<std::uint32_t>(variable.type));
+               operands.push_back(append(variable.init));
+            }
+            operands.push_back(append(varExpr->getBody()));
+            return addNode(ExprKind::Var, 0, 0, operands);
+         }
+            
+         case ExprKind::Index:
+         {
+            auto index = llvm::cast<IndexExprAST>(expression);
+            std::uint32_t operands[] = { append(index->getArray()), append(index->getIndex()) };
+            return addNode(ExprKind::Index, 0, 0, operands);
+         }
+            
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      assert(false && "not an expression node");
+      return noNode;
+   }
+   
+   ///
+   /// indent utility
+   ///
+   static llvm::raw_ostream &indent(llvm::raw_ostream &O, int size) {
+      return O << std::string(size, ' ');
+   }
+   
+   llvm::raw_ostream &FlatAST::dump(llvm::raw_ostream &out, node_index_t index, int ind) const
+   {
+      if (index == noNode)
+         return out << "null\n";
+      
+      const auto& node = getNode(index);
+      auto operands = getOperands(index);
+      
+      switch (node.kind)
+      {
+         case ExprKind::Number:
+            return out << getNumber(index) << "\n";
+            
+         case ExprKind::Variable:
+            return out << util::symbolName(node.payload) << "\n";
+            
+         case ExprKind::Unary:
+            out << "unary" << node.opcode << "\n";
+            return dump(indent(out, ind), operands[0], ind + 1);
+            
+         case ExprKind::Binary:
+            out << "binary" << node.opcode << "\n";
+            dump(indent(out, ind) << "LHS:", operands[0], ind + 1);
+            return dump(indent(out, ind) << "RHS:", operands[1], ind + 1);
+            
+         case ExprKind::Call:
+            out << "Call" << util::symbolName(node.payload) << "\n";
+            for (auto arg : operands)
+               dump(indent(out, ind + 1), arg, ind + 1);
+            return out;
+            
+         case ExprKind::If:
+            out << "if\n";
+            dump(indent(out, ind) << "Cond:", operands[0], ind + 1);
+            dump(indent(out, ind) << "Then:", operands[1], ind + 1);
+            return dump(indent(out, ind) << "Else:", operands[2], ind + 1);
+            
+         case ExprKind::For:
+            if (node.opcode)
+               out << "reduce " << getReductionName(static_cast<Reduction>(node.opcode)) << " ";
+            out << "for " << util::symbolName(node.payload) << "\n";
+            dump(indent(out, ind) << "Start:", operands[0], ind + 1);
+            dump(indent(out, ind) << "End:", operands[1], ind + 1);
+            dump(indent(out, ind) << "Step:", operands[2], ind + 1);
+            return dump(indent(out, ind) << "Body:", operands[3], ind + 1);
+            
+         case ExprKind::Var:
+            out << "var\n";
+            for (unsigned i = 0; i + 1 < operands.size(); i += 3)
+            {
+               indent(out, ind) << util::symbolName(operands[i]);
+               const auto type = static_cast<ValueType>(operands[i + 1]);
+               if (type != ValueType::Auto)
+                  out << ':' << getValueTypeName(type);
+               dump(out << '=', operands[i + 2], ind + 1);
+            }
+            return dump(indent(out, ind) << "Body:", operands.back(), ind + 1);
+            
+         case ExprKind::Index:
+            out << "index " << util::symbolName(getSymbol(operands[0])) << "\n";
+            return dump(indent(out, ind) << "Index:", operands[1], ind + 1);
+            
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      return out;
+   }
+}
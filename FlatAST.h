@@ -0,0 +1,100 @@
+//
+//  FlatAST.h
+//  Kaleidoscope-LLVM
+//
+//  linearized representation of a function body: nodes in a contiguous vector,
+//  children referenced by 32 bit indices, walked with switch based visitors
+//
+
+#ifndef FlatAST_h
+#define FlatAST_h
+
+#include <cstdint>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+#include "AST.h"
+#include "Interner.h"
+
+namespace llvm
+{
+   class raw_ostream;
+}
+
+namespace AST
+{
+   using node_index_t = std::uint32_t;
+   
+   ///
+   /// @brief: flat node (16 bytes), tagged with the kind of the tree node it comes from.
+   ///         Operands are a slice of the operand vector of the FlatAST:
+   ///         Unary    [operand]
+   ///         Binary   [lhs, rhs]
+   ///         Call     [arg...]                    symbol: callee
+   ///         If       [cond, then, else]
+   ///         For      [start, end, step, body]    symbol: loop variable, step can be noNode,
+   ///                                              opcode: Reduction (None for a plain 'for')
+   ///         Var      [name, type, init]... [body] init can be noNode, names are symbols
+   ///         Index    [array, index]              array: a Variable node
+   ///         Number   no operands                 payload: index in the numbers vector
+   ///         Variable no operands                 symbol: name, firstOperand: slot of the binding
+   ///
+   struct FlatNode
+   {
+      enum : std::uint32_t { sharedFlag = 1 }; //more than one parent
+      
+      ExprKind kind;
+      unsigned char opcode;
+      std::uint16_t operandCount;
+      std::uint32_t payload;       //symbol or number index
+      std::uint32_t firstOperand;
+      std::uint32_t flags;
+   };
+   
+   ///
+   /// @brief: linearized expression tree, children are always stored before their parent
+   ///
+   class FlatAST
+   {
+   public:
+      
+      static const node_index_t noNode = ~0u;
+      
+      ///
+      /// @brief: linearize the tree rooted in the expression passed. The shared nodes (hash consing)
+      ///         are appended once and flagged: the result is a DAG
+      ///
+      static FlatAST build(const ExprAST* root, const llvm::DenseSet<const ExprAST*>* shared = nullptr);
+      
+      node_index_t getRoot() const;
+      const FlatNode& getNode(node_index_t index) const;
+      llvm::ArrayRef<std::uint32_t> getOperands(node_index_t index) const;
+      double getNumber(node_index_t index) const;
+      util::symbol_t getSymbol(node_index_t index) const;
+      util::slot_t getSlot(node_index_t index) const;
+      std::size_t size() const;
+      
+      llvm::raw_ostream &dump(llvm::raw_ostream &out, node_index_t index, int ind) const;
+      
+   private:
+      
+      std::vector<FlatNode> nodes_;
+      std::vector<std::uint32_t> operands_;
+      std::vector<double> numbers_;
+      node_index_t root_ = noNode;
+      
+      //used while building
+      const llvm::DenseSet<const ExprAST*>* shared_ = nullptr;
+      llvm::DenseMap<const ExprAST*, node_index_t> sharedIndices_;
+      
+      node_index_t append(const ExprAST* expression);
+      node_index_t appendNode(const ExprAST* expression);
+      node_index_t addNode(ExprKind kind, unsigned char opcode, std::uint32_t payload,
+                           llvm::ArrayRef<std::uint32_t> operands);
+   };
+}
+
+#endif /* FlatAST_h */
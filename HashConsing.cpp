@@ -0,0 +1,317 @@
+//
+//  HashConsing.cpp
+//  Kaleidoscope-LLVM
+//
+//  structural sharing of identical pure subexpressions of a function body
+//
+
+#include "HashConsing.h"
+
+#include <cstring>
+#include <vector>
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/Support/Casting.h"
+
+using namespace AST;
+
+namespace optimizer
+{
+   namespace
+   {
+      const unsigned assigned = ~0u;
+      
+      bool isBuiltinOperator(unsigned char op)
+      {
+         return op == '+' || op == '-' || op == '*' || op == '<';
+      }
+   }
+   
+   bool HashConsing::Key::operator==(const Key& rhs) const
+   {
+      return kind == rhs.kind && opcode == rhs.opcode && payload == rhs.payload && operands == rhs.operands;
+   }
+   
+   size_t HashConsing::KeyHash::operator()(const Key& key) const
+   {
+      return llvm::hash_combine(static_cast<unsigned>(key.kind), key.opcode, key.payload,
+                                llvm::hash_combine_range(key.operands.begin(), key.operands.end()));
+   }
+   
+   HashConsing::HashConsing(const PurityAnalysis& purity) :
+   purity_(purity)
+   {}
+   
+   void HashConsing::share(FunctionAST& function)
+   {
+      nodes_.reset();
+      table_.clear();
+      bindings_.clear();
+      shared_.clear();
+      
+      for (auto arg : function.getPrototype()->getArgumentList())
+         ++bindings_[arg];
+      collectBindings(function.getBody());
+      
+      bool shareable = false;
+      function.setBody(visit(function.getBody(), shareable));
+   }
+   
+   const shared_expressions_t& HashConsing::getSharedExpressions() const
+   {
+      return shared_;
+   }
+   
+   void HashConsing::collectBindings(const ExprAST* expression)
+   {
+      if (!expression)
+         return;
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+         case ExprKind::Variable:
+            break;
+         
+         case ExprKind::Unary:
+            collectBindings(llvm::cast<UnaryExprAST>(expression)->getOperand());
+            break;
+         
+         case ExprKind::Binary:
+         {
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            if (binary->getOpcode() == '=')
+            {
+               //storing a lane of a vector changes the whole variable
+               auto destination = binary->getLeftOperand();
+               if (auto element = llvm::dyn_cast<IndexExprAST>(destination))
+                  destination = element->getArray();
+               if (auto variable = llvm::dyn_cast<VariableExprAST>(destination))
+                  bindings_[variable->getSymbol()] = assigned;
+            }
+            collectBindings(binary->getLeftOperand());
+            collectBindings(binary->getRightOperand());
+            break;
+         }
+         
+         case ExprKind::Call:
+            for (auto arg : llvm::cast<CallExprAST>(expression)->getArgumentList())
+               collectBindings(arg);
+            break;
+         
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            collectBindings(ifExpr->getCondion());
+            collectBindings(ifExpr->getThenBranch());
+            collectBindings(ifExpr->getElseBranch());
+            break;
+         }
+         
+         case ExprKind::For:
+         {
+            //the loop variable changes at every iteration
+            auto forExpr = llvm::cast<ForExprAST>(expression);
+            bindings_[forExpr->getKey()] = assigned;
+            collectBindings(forExpr->getStart());
+            collectBindings(forExpr->getEnd());
+            collectBindings(forExpr->getStep());
+            collectBindings(forExpr->getBody());
+            break;
+         }
+         
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            for (const auto& variable : varExpr->getVarNames())
+            {
+               auto& bindings = bindings_[variable.name];
+               if (bindings != assigned)
+                  ++bindings;
+               collectBindings(variable.init);
+            }
+            collectBindings(varExpr->getBody());
+            break;
+         }
+         
+         case ExprKind::Index:
+            collectBindings(llvm::cast<IndexExprAST>(expression)->getIndex());
+            break;
+         
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+   }
+   
+   bool HashConsing::isStableVariable(util::symbol_t name) const
+   {
+      return bindings_.lookup(name) == 1;
+   }
+   
+   ExprAST* HashConsing::canonical(ExprAST* expression, Key key)
+   {
+      auto inserted = table_.insert(std::make_pair(std::move(key), expression));
+      if (inserted.second)
+         return expression;
+      
+      shared_.insert(inserted.first->second);
+      return inserted.first->second;
+   }
+   
+   ExprAST* HashConsing::visit(ExprAST* expression, bool& shareable)
+   {
+      shareable = false;
+      if (!expression)
+         return nullptr;
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+         {
+            Key key{ExprKind::Number, 0, 0, {}};
+            const double value = llvm::cast<NumberExprAST>(expression)->getVal();
+            std::memcpy(&key.payload, &value, sizeof(value));
+            shareable = true;
+            return canonical(expression, std::move(key));
+         }
+         
+         case ExprKind::Variable:
+         {
+            const auto name = llvm::cast<VariableExprAST>(expression)->getSymbol();
+            if (!isStableVariable(name))
+               return expression;
+            shareable = true;
+            return canonical(expression, Key{ExprKind::Variable, 0, name, {}});
+         }
+         
+         case ExprKind::Unary:
+         {
+            auto unary = llvm::cast<UnaryExprAST>(expression);
+            bool operandShareable = false;
+            auto operand = visit(unary->getOperand(), operandShareable);
+            
+            ExprAST* node = expression;
+            if (operand != unary->getOperand())
+               node = nodes_.create<UnaryExprAST>(unary->getOpcode(), operand);
+            
+            if (!operandShareable || !purity_.isPureFunction(operatorSymbol("unary", unary->getOpcode())))
+               return node;
+            shareable = true;
+            return canonical(node, Key{ExprKind::Unary, static_cast<unsigned char>(unary->getOpcode()), 0, {operand}});
+         }
+         
+         case ExprKind::Binary:
+         {
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            const auto op = binary->getOpcode();
+            
+            //the destination of an assignment stays a variable (or an array element)
+            bool leftShareable = false, rightShareable = false;
+            auto lhs = op == '=' && !llvm::isa<IndexExprAST>(binary->getLeftOperand())
+                          ? binary->getLeftOperand()
+                          : visit(binary->getLeftOperand(), leftShareable);
+            auto rhs = visit(binary->getRightOperand(), rightShareable);
+            
+            ExprAST* node = expression;
+            if (lhs != binary->getLeftOperand() || rhs != binary->getRightOperand())
+               node = nodes_.create<BinaryExprAST>(op, lhs, rhs);
+            
+            if (op == '=' || !leftShareable || !rightShareable ||
+                (!isBuiltinOperator(op) && !purity_.isPureFunction(operatorSymbol("binary", op))))
+               return node;
+            shareable = true;
+            return canonical(node, Key{ExprKind::Binary, op, 0, {lhs, rhs}});
+         }
+         
+         case ExprKind::Call:
+         {
+            auto call = llvm::cast<CallExprAST>(expression);
+            std::vector<ExprAST*> args;
+            bool changed = false, argsShareable = true;
+            for (auto arg : call->getArgumentList())
+            {
+               bool argShareable = false;
+               args.push_back(visit(arg, argShareable));
+               changed |= args.back() != arg;
+               argsShareable &= argShareable;
+            }
+            
+            ExprAST* node = expression;
+            if (changed)
+               node = nodes_.create<CallExprAST>(call->getCallee(), nodes_.copy(args));
+            
+            if (!argsShareable || !purity_.isPureFunction(call->getCallee()))
+               return node;
+            shareable = true;
+            
+            Key key{ExprKind::Call, 0, call->getCallee(), {}};
+            key.operands.append(args.begin(), args.end());
+            return canonical(node, std::move(key));
+         }
+         
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            bool unused = false;
+            auto cond = visit(ifExpr->getCondion(), unused);
+            auto thenBranch = visit(ifExpr->getThenBranch(), unused);
+            auto elseBranch = visit(ifExpr->getElseBranch(), unused);
+            
+            if (cond == ifExpr->getCondion() && thenBranch == ifExpr->getThenBranch() &&
+                elseBranch == ifExpr->getElseBranch())
+               return expression;
+            return nodes_.create<IfExprAST>(cond, thenBranch, elseBranch);
+         }
+         
+         case ExprKind::For:
+         {
+            auto forExpr = llvm::cast<ForExprAST>(expression);
+            bool unused = false;
+            auto start = visit(forExpr->getStart(), unused);
+            auto end = visit(forExpr->getEnd(), unused);
+            auto step = visit(forExpr->getStep(), unused);
+            auto body = visit(forExpr->getBody(), unused);
+            
+            if (start == forExpr->getStart() && end == forExpr->getEnd() && step == forExpr->getStep() &&
+                body == forExpr->getBody())
+               return expression;
+            return nodes_.create<ForExprAST>(forExpr->getKey(), start, end, step, body, forExpr->getReduction());
+         }
+         
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            std::vector<VarExprAST::variable_t> variables;
+            bool changed = false, unused = false;
+            for (const auto& variable : varExpr->getVarNames())
+            {
+               variables.push_back(VarExprAST::variable_t{variable.name, visit(variable.init, unused), variable.type});
+               changed |= variables.back().init != variable.init;
+            }
+            auto body = visit(varExpr->getBody(), unused);
+            
+            if (!changed && body == varExpr->getBody())
+               return expression;
+            return nodes_.create<VarExprAST>(nodes_.copy(variables), body);
+         }
+         
+         case ExprKind::Index:
+         {
+            //memory is read: never shared. The array stays the variable of the tree
+            auto index = llvm::cast<IndexExprAST>(expression);
+            bool unused = false;
+            auto position = visit(index->getIndex(), unused);
+            if (position == index->getIndex())
+               return expression;
+            return nodes_.create<IndexExprAST>(index->getArray(), position);
+         }
+         
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      return expression;
+   }
+}
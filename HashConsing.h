@@ -0,0 +1,86 @@
+//
+//  HashConsing.h
+//  Kaleidoscope-LLVM
+//
+//  structural sharing of identical pure subexpressions of a function body
+//
+
+#ifndef HashConsing_h
+#define HashConsing_h
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include "AST.h"
+#include "Purity.h"
+
+namespace optimizer
+{
+   using shared_expressions_t = llvm::DenseSet<const AST::ExprAST*>;
+   
+   ///
+   /// @brief: maps the structurally identical pure subtrees of a function body to one node.
+   ///         Shareable: numbers, variables bound once and never assigned, builtin arithmetic,
+   ///         calls and user defined operators targeting pure functions, all of shareable operands.
+   ///         The nodes reached more than once are reported, so that the code generator can
+   ///         reuse the value emitted for them in the same basic block
+   ///
+   class HashConsing
+   {
+   public:
+      
+      explicit HashConsing(const PurityAnalysis& purity);
+      HashConsing(const HashConsing&) = delete;
+      HashConsing& operator=(const HashConsing&) = delete;
+      
+      ///
+      /// @brief: share the subexpressions of the function passed. The nodes created for the
+      ///         previous function are released
+      ///
+      void share(AST::FunctionAST& function);
+      
+      ///
+      /// @brief: nodes of the last function shared that have more than one parent
+      ///
+      const shared_expressions_t& getSharedExpressions() const;
+   
+   private:
+      
+      struct Key
+      {
+         AST::ExprKind kind;
+         unsigned char opcode;
+         std::uint64_t payload; //bits of a number, or a symbol
+         llvm::SmallVector<const AST::ExprAST*, 4> operands;
+      
+         bool operator==(const Key& rhs) const;
+      };
+      
+      struct KeyHash
+      {
+         size_t operator()(const Key& key) const;
+      };
+      
+      const PurityAnalysis& purity_;
+      AST::ASTContext nodes_;
+      std::unordered_map<Key, AST::ExprAST*, KeyHash> table_;
+      llvm::DenseMap<util::symbol_t, unsigned> bindings_; //bindings of every name, ~0u when assigned
+      shared_expressions_t shared_;
+      
+      void collectBindings(const AST::ExprAST* expression);
+      bool isStableVariable(util::symbol_t name) const;
+      
+      ///
+      /// @brief: rebuild the expression on top of canonical children, shareable is set when the
+      ///         result is a canonical node of the table
+      ///
+      AST::ExprAST* visit(AST::ExprAST* expression, bool& shareable);
+      AST::ExprAST* canonical(AST::ExprAST* expression, Key key);
+   };
+}
+
+#endif /* HashConsing_h */
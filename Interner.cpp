@@ -0,0 +1,52 @@
+//
+//  Interner.cpp
+//  Kaleidoscope-LLVM
+//
+//  string interner shared by the lexer, the AST and the code generator
+//
+
+#include "Interner.h"
+
+#include <cassert>
+
+namespace util
+{
+   StringInterner& StringInterner::instance()
+   {
+      static StringInterner interner;
+      return interner;
+   }
+   
+   void StringInterner::setThreadSafe(bool threadSafe)
+   {
+      threadSafe_.store(threadSafe);
+   }
+   
+   symbol_t StringInterner::intern(llvm::StringRef str)
+   {
+      if (!threadSafe_.load(std::memory_order_relaxed))
+         return insert(str);
+      
+      std::lock_guard<std::mutex> lock(mutex_);
+      return insert(str);
+   }
+   
+   symbol_t StringInterner::insert(llvm::StringRef str)
+   {
+      auto inserted = symbols_.insert(std::make_pair(str, static_cast<symbol_t>(names_.size())));
+      if (inserted.second)
+         names_.push_back(inserted.first->getKey());
+      
+      return inserted.first->getValue();
+   }
+   
+   llvm::StringRef StringInterner::lookup(symbol_t symbol) const
+   {
+      std::unique_lock<std::mutex> lock(mutex_, std::defer_lock);
+      if (threadSafe_.load(std::memory_order_relaxed))
+         lock.lock();
+      
+      assert(symbol < names_.size() && "unknown symbol");
+      return names_[symbol];
+   }
+}
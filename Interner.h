@@ -0,0 +1,86 @@
+//
+//  Interner.h
+//  Kaleidoscope-LLVM
+//
+//  string interner shared by the lexer, the AST and the code generator
+//
+
+#ifndef Interner_h
+#define Interner_h
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace util
+{
+   ///
+   /// @brief: 32 bit id of an interned string
+   ///
+   using symbol_t = std::uint32_t;
+   
+   ///
+   /// @brief: session wide string interner. Every name is stored once and identified by a symbol,
+   ///         so that tokens, AST nodes and code generator tables compare and hash integers only
+   ///
+   class StringInterner
+   {
+   public:
+      
+      static const symbol_t invalidSymbol = ~0u;
+      
+      ///
+      /// @brief: the interner of the compiler session
+      ///
+      static StringInterner& instance();
+      
+      StringInterner(const StringInterner&) = delete;
+      StringInterner& operator=(const StringInterner&) = delete;
+      
+      ///
+      /// @brief: return the symbol of the string passed, adding it if it is seen for the first time
+      ///
+      symbol_t intern(llvm::StringRef str);
+      
+      ///
+      /// @brief: return the string of a symbol. The reference is valid for the whole session
+      ///
+      llvm::StringRef lookup(symbol_t symbol) const;
+      
+      ///
+      /// @brief: serialize the accesses while more threads use the interner (batch parsing).
+      ///         Off by default: the lexer interns every identifier and pays nothing for it
+      ///
+      void setThreadSafe(bool threadSafe);
+      
+   private:
+      
+      StringInterner() = default;
+      
+      symbol_t insert(llvm::StringRef str);
+      
+      llvm::StringMap<symbol_t> symbols_;
+      std::vector<llvm::StringRef> names_; //keys owned by symbols_ entries, never moved
+      mutable std::mutex mutex_;
+      std::atomic<bool> threadSafe_{false};
+   };
+   
+   ///
+   /// @brief: shortcuts for the session interner
+   ///
+   inline symbol_t intern(llvm::StringRef str)
+   {
+      return StringInterner::instance().intern(str);
+   }
+   
+   inline llvm::StringRef symbolName(symbol_t symbol)
+   {
+      return StringInterner::instance().lookup(symbol);
+   }
+}
+
+#endif /* Interner_h */
@@ -18,7 +18,6 @@
 #include "llvm/IR/Mangler.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/TargetSelect.h"
-#include "llvm/Transforms/Scalar.h"
 
 
 #include <string>
@@ -33,8 +32,7 @@ namespace jit
       targetMachine_(engineBuilder_.selectTarget()),
       dataLayout_(llvm::DataLayout(targetMachine_->createDataLayout())),
       objectLayer_([]() { return std::make_shared<llvm::SectionMemoryManager>(); }),
-      compileLayer_(objectLayer_,llvm::orc::SimpleCompiler(*targetMachine_)),
-      optimizeLayer_(compileLayer_, [this](std::shared_ptr<llvm::Module> M) {return optimizeModule(std::move(M));})
+      compileLayer_(objectLayer_,llvm::orc::SimpleCompiler(*targetMachine_))
    {
       llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
    }
@@ -44,12 +42,14 @@ namespace jit
       return *targetMachine_;
    }
    
-   JIT::ModuleHandle JIT::addModule(std::unique_ptr<llvm::Module>& module)
+   std::shared_ptr<llvm::JITSymbolResolver> JIT::createResolver()
    {
-      //first function to invoke in order to resolve symbol
-      auto firstResolver = [&](const std::string &name)
+      //first function to invoke in order to resolve symbol, the stubs of the tiered functions first
+      auto firstResolver = [this](const std::string &name)
       {
-         if (auto symbol = optimizeLayer_.findSymbol(name, false)) return symbol;
+         if (stubs_)
+            if (auto stub = stubs_->findStub(name, false)) return stub;
+         if (auto symbol = compileLayer_.findSymbol(name, false)) return symbol;
          return llvm::JITSymbol(nullptr);
       };
       
@@ -61,47 +61,62 @@ namespace jit
       };
       
       
-      auto resolver = llvm::orc::createLambdaResolver(firstResolver, secondResolver);
-      //return cantFail(compileLayer_.addModule(std::move(module), std::move(resolver)));
-      return cantFail(optimizeLayer_.addModule(std::move(module), std::move(resolver)));
+      return llvm::orc::createLambdaResolver(firstResolver, secondResolver);
    }
    
-   llvm::JITSymbol JIT::findSymbol(const std::string& name) {
+   std::string JIT::mangle(const std::string& name) const
+   {
       std::string MangledName;
       llvm::raw_string_ostream MangledNameStream(MangledName);
       llvm::Mangler::getNameWithPrefix(MangledNameStream, name, dataLayout_);
-      //return compileLayer_.findSymbol(MangledNameStream.str(), true);
-      
-      return optimizeLayer_.findSymbol(MangledNameStream.str(), true);
+      return MangledNameStream.str();
+   }
+   
+   JIT::ModuleHandle JIT::addModule(std::unique_ptr<llvm::Module>& module)
+   {
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+      return cantFail(compileLayer_.addModule(std::move(module), createResolver()));
+   }
+   
+   JIT::ModuleHandle JIT::addObject(Object object)
+   {
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+      return cantFail(objectLayer_.addObject(std::make_shared<Object>(std::move(object)), createResolver()));
+   }
+   
+   llvm::JITSymbol JIT::findSymbol(const std::string& name) {
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+      return compileLayer_.findSymbol(mangle(name), true);
    }
    
    llvm::JITTargetAddress JIT::getSymbolAddress(const std::string& name) {
+      //the address of a symbol not used yet finalizes (links) its object
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
       return cantFail(findSymbol(name).getAddress());
    }
    
    void JIT::removeModule(ModuleHandle H) {
-      //cantFail(compileLayer_.removeModule(H));
-      cantFail(optimizeLayer_.removeModule(H));
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+      cantFail(compileLayer_.removeModule(H));
    }
    
-   std::shared_ptr<llvm::Module> JIT::optimizeModule(std::shared_ptr<llvm::Module> module)
+   void JIT::setIndirection(const std::string& name, llvm::JITTargetAddress target)
    {
-      // Create a function pass manager.
-      auto functionPassManager = llvm::make_unique<llvm::legacy::FunctionPassManager>(module.get());
-      
-      // Add some optimizations.
-      functionPassManager->add(llvm::createInstructionCombiningPass());
-      functionPassManager->add(llvm::createReassociatePass());
-      functionPassManager->add(llvm::createNewGVNPass());
-      functionPassManager->add(llvm::createCFGSimplificationPass());
-      functionPassManager->doInitialization();
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+      if (!stubs_)
+         stubs_ = llvm::orc::createLocalIndirectStubsManagerBuilder(targetMachine_->getTargetTriple())();
       
-      // Run the optimizations over all functions in the module being added to
-      // the JIT.
-      for (auto &function : *module)
-         functionPassManager->run(function);
-         
-         return module;
+      const auto mangled = mangle(name);
+      if (stubs_->findStub(mangled, false))
+         cantFail(stubs_->updatePointer(mangled, target));
+      else
+         cantFail(stubs_->createStub(mangled, target, llvm::JITSymbolFlags::Exported));
+   }
+   
+   void JIT::enableFastCodeGen()
+   {
+      std::lock_guard<std::recursive_mutex> lock(mutex_);
+      targetMachine_->setOptLevel(llvm::CodeGenOpt::None);
+      targetMachine_->setFastISel(true);
    }
 }
-
@@ -18,10 +18,11 @@
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
-#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/Object/ObjectFile.h"
 
-#include <functional>
 #include <memory>
+#include <mutex>
 
 namespace jit
 {
@@ -34,20 +35,21 @@ namespace jit
       llvm::DataLayout dataLayout_;
       llvm::orc::RTDyldObjectLinkingLayer objectLayer_;
       using CompileLayer = llvm::orc::IRCompileLayer<decltype(objectLayer_), llvm::orc::SimpleCompiler>;
-      CompileLayer compileLayer_;
+      CompileLayer compileLayer_; //the modules come optimized from the code generator
       
+      //stubs jumping to the current version of the tiered functions (see TieredCompiler)
+      std::unique_ptr<llvm::orc::IndirectStubsManager> stubs_;
       
-      //embedded optimization inside the jit compiler
-      using OptimizeFunction = std::function<std::shared_ptr<llvm::Module>(std::shared_ptr<llvm::Module>)>;
-      llvm::orc::IRTransformLayer<decltype(compileLayer_), OptimizeFunction> optimizeLayer_;
+      //the background compile thread of the tiered mode adds objects while the parser adds modules
+      std::recursive_mutex mutex_;
       
-   private:
-      
-      std::shared_ptr<llvm::Module> optimizeModule(std::shared_ptr<llvm::Module> module);
+      std::shared_ptr<llvm::JITSymbolResolver> createResolver();
+      std::string mangle(const std::string& name) const;
       
    public:
       
       using ModuleHandle = decltype(compileLayer_)::ModuleHandleT;
+      using Object = llvm::object::OwningBinary<llvm::object::ObjectFile>;
       
       explicit JIT();
       llvm::EngineBuilder engineBuilder_;
@@ -57,6 +59,23 @@ namespace jit
       llvm::JITTargetAddress getSymbolAddress(const std::string& name);
       void removeModule(ModuleHandle moduleHandle);      
       
+      ///
+      /// @brief: add an object compiled elsewhere (with a target machine of its own)
+      ///
+      ModuleHandle addObject(Object object);
+      
+      ///
+      /// @brief: the symbol name resolves to a stub jumping to target. The first call creates
+      ///         the stub, the next ones only change its target: the code already calling it
+      ///         jumps to the new target from its next call on
+      ///
+      void setIndirection(const std::string& name, llvm::JITTargetAddress target);
+      
+      ///
+      /// @brief: no optimization in the code generation of the next modules, fast instruction selection
+      ///
+      void enableFastCodeGen();
+      
    };
 }
 
@@ -7,94 +7,203 @@
 //
 
 #include "Lexer.h"
+#include "Scanner.h"
 
 #include <cctype>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+
+#include "llvm/Support/MemoryBuffer.h"
 
 namespace lexer
 {
+   namespace
+   {
+      ///
+      /// @brief: keywords of the language recognised with a perfect hash built at compile time
+      ///
+      struct Keyword
+      {
+         const char* name;
+         std::size_t length;
+         int token;
+      };
+      
+      constexpr Keyword keywords[] = {
+         {"def", 3, tok_def},     {"extern", 6, tok_extern}, {"if", 2, tok_if},
+         {"then", 4, tok_then},   {"else", 4, tok_else},     {"for", 3, tok_for},
+         {"in", 2, tok_in},       {"unary", 5, tok_unary},   {"binary", 6, tok_binary},
+         {"var", 3, tok_var},     {"reduce", 6, tok_reduce}
+      };
+      
+      constexpr std::size_t keywordCount = sizeof(keywords) / sizeof(keywords[0]);
+      constexpr std::size_t keywordTableSize = 32;
+      
+      constexpr unsigned keywordHash(const char* str, std::size_t length)
+      {
+         return ((unsigned char)str[0] * 7u + (unsigned char)str[length - 1] * 10u + length) & (keywordTableSize - 1);
+      }
+      
+      struct KeywordTable
+      {
+         int slots[keywordTableSize]; //index in keywords or -1
+         bool perfect;
+      };
+      
+      constexpr KeywordTable buildKeywordTable()
+      {
+         KeywordTable table {{}, true};
+         for (std::size_t i = 0; i < keywordTableSize; ++i)
+            table.slots[i] = -1;
+         
+         for (std::size_t i = 0; i < keywordCount; ++i)
+         {
+            auto hash = keywordHash(keywords[i].name, keywords[i].length);
+            if (table.slots[hash] != -1)
+               table.perfect = false;
+            table.slots[hash] = static_cast<int>(i);
+         }
+         
+         return table;
+      }
+      
+      constexpr KeywordTable keywordTable = buildKeywordTable();
+      static_assert(keywordTable.perfect, "keyword hash has collisions, change the hash function");
+      
+      ///
+      /// @brief: keyword token for the identifier passed, tok_identifier if it is not a keyword
+      ///
+      int keywordToken(llvm::StringRef identifier)
+      {
+         auto slot = keywordTable.slots[keywordHash(identifier.data(), identifier.size())];
+         if (slot < 0)
+            return tok_identifier;
+         
+         const auto& keyword = keywords[slot];
+         if (keyword.length != identifier.size() || std::memcmp(keyword.name, identifier.data(), keyword.length))
+            return tok_identifier;
+         
+         return keyword.token;
+      }
+   }
+   
    Lexer::Lexer(/*debug::DebugInfo& debug*/) /*:
-   debug_(debug)*/
+   debug_(debug)*/ :
+   block_(blockSize_),
+   fd_(STDIN_FILENO),
+   cur_(block_.data()),
+   end_(block_.data()),
+   windowOffset_(0),
+   tokenOffset_(0),
+   tokenLength_(0),
+   symbol_(util::StringInterner::invalidSymbol),
+   numVal_(0)
+   {}
+   
+   Lexer::Lexer(std::unique_ptr<llvm::MemoryBuffer> buffer) :
+   buffer_(std::move(buffer)),
+   fd_(-1),
+   cur_(buffer_->getBufferStart()),
+   end_(buffer_->getBufferEnd()),
+   windowOffset_(0),
+   tokenOffset_(0),
+   tokenLength_(0),
+   symbol_(util::StringInterner::invalidSymbol),
+   numVal_(0)
    {}
    
+   Lexer::~Lexer() = default;
+   
+   std::unique_ptr<Lexer> Lexer::createFromFile(const std::string& path)
+   {
+      //big files are memory mapped, the null terminator is not needed since the scan is bounded
+      auto buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+      if (!buffer)
+      {
+         std::cerr << "Error: cannot open " << path << ": " << buffer.getError().message() << "\n";
+         return nullptr;
+      }
+      
+      return std::make_unique<Lexer>(std::move(*buffer));
+   }
+   
    int Lexer::gettok()
    {
+      const char* tokenStart = cur_;
+      int token = scanToken(tokenStart);
       
-      static int LastChar = ' ';
+      const char* windowBegin = buffer_ ? buffer_->getBufferStart() : block_.data();
+      tokenOffset_ = windowOffset_ + (tokenStart - windowBegin);
+      tokenLength_ = static_cast<std::uint32_t>(cur_ - tokenStart);
+      return token;
+   }
+   
+   int Lexer::scanToken(const char*& tokenStart)
+   {
+      int LastChar = peek(tokenStart);
       
-      // Skip any whitespace.
-      while (isspace(LastChar)) {
-         LastChar = advance();
+      while (true)
+      {
+         // Skip any whitespace (the window can be refilled in the middle of a run).
+         while (isspace(LastChar)) {
+            cur_ = scan::skipWhitespace(cur_, end_);
+            tokenStart = cur_;
+            LastChar = peek(tokenStart);
+         }
+         
+         if (LastChar != '#')
+            break;
+         
+         // Comment until end of line.
+         do
+         {
+            cur_ = scan::skipLine(cur_, end_);
+            tokenStart = cur_;
+            LastChar = peek(tokenStart);
+         }while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
       }
       
       //debug_.currentLocation_ = debug_.currentLexerLocation_;
       
       if (isalpha(LastChar)) {
          // identifier: [a-zA-Z][a-zA-Z0-9]*
-         identifierStr_ = LastChar;
-         while (isalnum((LastChar = getchar())))
+         do
          {
-            identifierStr_ += LastChar;
-         }
+            cur_ = scan::scanIdentifier(cur_, end_);
+         } while (isalnum(peek(tokenStart)));
          
-         if (identifierStr_ == "def")
-            return tok_def;
-         if (identifierStr_ == "extern")
-            return tok_extern;
-         if (identifierStr_ == "if")
-            return tok_if;
-         if (identifierStr_ == "then")
-            return tok_then;
-         if (identifierStr_ == "else")
-            return tok_else;
-         if(identifierStr_ == "for")
-            return tok_for;
-         if(identifierStr_ == "in")
-            return tok_in;
-         if(identifierStr_ == "unary")
-            return tok_unary;
-         if(identifierStr_ == "binary")
-            return tok_binary;
-         if (identifierStr_ == "var")
-            return tok_var;
+         identifierStr_ = llvm::StringRef(tokenStart, cur_ - tokenStart);
          
-         return tok_identifier;
+         auto token = keywordToken(identifierStr_);
+         if (token == tok_identifier)
+            symbol_ = util::intern(identifierStr_);
+         
+         return token;
       }
       
       if (isdigit(LastChar) || LastChar == '.') {
          
          // Number: [0-9.]+
-         std::string NumStr;
          do
          {
-            NumStr += LastChar;
-            LastChar = getchar();
+            cur_ = scan::scanNumber(cur_, end_);
+            LastChar = peek(tokenStart);
          } while (isdigit(LastChar) || LastChar == '.');
          
-         numVal_ = strtod(NumStr.c_str(), nullptr);
+         numVal_ = scan::parseNumber(tokenStart, cur_);
          return tok_number;
       }
       
-      
-      if (LastChar == '#') {
-         // Comment until end of line.
-         do
-         {
-            LastChar = getchar();
-         }while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
-         
-         if (LastChar != EOF)
-            return gettok();
-      }
-      
       // Check for end of file.  Don't eat the EOF.
       if (LastChar == EOF)
          return tok_eof;
       
       // Otherwise, just return the character as its ascii value.
-      int ThisChar = LastChar;
-      LastChar = advance();
-      return ThisChar;
+      advance();
+      return LastChar;
      
    }
    
@@ -103,14 +212,37 @@ namespace lexer
       return numVal_;
    }
    
-   std::string Lexer::getId() const
+   llvm::StringRef Lexer::getId() const
    {
       return identifierStr_;
    }
    
-   int Lexer::advance()
+   util::symbol_t Lexer::getSymbol() const
+   {
+      return symbol_;
+   }
+   
+   std::uint64_t Lexer::getTokenOffset() const
+   {
+      return tokenOffset_;
+   }
+   
+   std::uint32_t Lexer::getTokenLength() const
    {
-      int LastChar = getchar();
+      return tokenLength_;
+   }
+   
+   int Lexer::peek(const char*& tokenStart)
+   {
+      if (cur_ == end_ && !refill(tokenStart))
+         return EOF;
+      
+      return (unsigned char)*cur_;
+   }
+   
+   void Lexer::advance()
+   {
+      ++cur_;
       
 //      if (LastChar == '\n' || LastChar == '\r')
 //      {
@@ -121,8 +253,39 @@ namespace lexer
 //      {
 //         debug_.currentLexerLocation_.col++;
 //      }
+   }
+   
+   bool Lexer::refill(const char*& tokenStart)
+   {
+      if (fd_ < 0)
+         return false;
       
-      return LastChar;
+      //keep the part of the token already scanned at the front of the window
+      size_t kept = end_ - tokenStart;
+      windowOffset_ += tokenStart - block_.data();
+      if (kept != 0 && tokenStart != block_.data())
+         std::memmove(block_.data(), tokenStart, kept);
+      
+      if (block_.size() - kept < blockSize_ / 2)
+         block_.resize(block_.size() * 2);
+      
+      ssize_t bytesRead;
+      do
+      {
+         bytesRead = ::read(fd_, block_.data() + kept, block_.size() - kept);
+      } while (bytesRead < 0 && errno == EINTR);
+      
+      tokenStart = block_.data();
+      cur_ = tokenStart + kept;
+      end_ = cur_ + (bytesRead > 0 ? bytesRead : 0);
+      
+      if (bytesRead <= 0)
+      {
+         fd_ = -1;
+         return false;
+      }
+      
+      return true;
    }
    
 }
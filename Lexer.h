@@ -9,8 +9,19 @@
 #ifndef Lexer_h
 #define Lexer_h
 
+#include <cstdint>
 #include <string>
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
 #include "Debug.h"
+#include "Interner.h"
+
+namespace llvm
+{
+   class MemoryBuffer;
+}
 
 namespace lexer
 {
@@ -46,7 +57,10 @@ namespace lexer
       tok_binary = -12,
       
       //variable definition
-      tok_var = -13
+      tok_var = -13,
+      
+      //reduction loop
+      tok_reduce = -14
 
    };
    
@@ -55,25 +69,78 @@ namespace lexer
       
    public:
       
+      ///
+      /// @brief: lexer reading std::input in large blocks (interactive sessions and pipes)
+      ///
       Lexer(/*debug::DebugInfo& debug*/);
       
+      ///
+      /// @brief: lexer scanning an input already in memory (i.e. a memory mapped source file)
+      ///
+      explicit Lexer(std::unique_ptr<llvm::MemoryBuffer> buffer);
+      
+      ~Lexer();
+      
+      ///
+      /// @brief: map the file passed in memory and build a lexer on top of it.
+      ///         nullptr is returned if the file can not be opened
+      ///
+      static std::unique_ptr<Lexer> createFromFile(const std::string& path);
+      
       /**
        * @brief: tokenize my input.
-       *         Reading from std::input a single char and recongnise the basic tokens of the language
+       *         Scan the input buffer with a cursor and recongnise the basic tokens of the language
        */
       int gettok();
       
       double getNum() const;
-      std::string getId() const;
+      
+      ///
+      /// @brief: view of the last identifier scanned, valid until the next call to gettok()
+      ///
+      llvm::StringRef getId() const;
+      
+      ///
+      /// @brief: interned symbol of the last identifier scanned
+      ///
+      util::symbol_t getSymbol() const;
+      
+      ///
+      /// @brief: position (bytes from the beginning of the input) and size of the last token scanned
+      ///
+      std::uint64_t getTokenOffset() const;
+      std::uint32_t getTokenLength() const;
       
       
    private:
-      std::string identifierStr_;
+      
+      static const size_t blockSize_ = 64 * 1024;
+      
+      std::unique_ptr<llvm::MemoryBuffer> buffer_; //whole input (file mode)
+      std::vector<char> block_;                    //input window (stdin mode)
+      int fd_;                                     //descriptor to refill from, -1 once exhausted
+      const char* cur_;
+      const char* end_;
+      std::uint64_t windowOffset_;                 //input offset of the beginning of the window
+      std::uint64_t tokenOffset_;
+      std::uint32_t tokenLength_;
+      
+      llvm::StringRef identifierStr_;
+      util::symbol_t symbol_;
       double numVal_;
       //debug::DebugInfo& debug_;
       
       
-      int advance();
+      ///
+      /// @brief: current char (EOF at the end of input) refilling the window if needed.
+      ///         tokenStart is the beginning of the token being scanned, it is kept in the window
+      ///         and updated if the window moves
+      ///
+      int peek(const char*& tokenStart);
+      int scanToken(const char*& tokenStart);
+      void advance();
+      
+      bool refill(const char*& tokenStart);
       
    };
    
@@ -0,0 +1,122 @@
+//
+//  Memoization.cpp
+//  Kaleidoscope-LLVM
+//
+//  cache of the results of pure definitions, in front of their body
+//
+
+#include "Memoization.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MathExtras.h"
+
+namespace optimizer
+{
+   namespace
+   {
+      ///
+      /// @brief: the entries stay small, 48 bytes at most
+      ///
+      const unsigned maxArguments = 4;
+      
+      ///
+      /// @brief: multiplier of the hash (2^64 / golden ratio), its high bits are well mixed
+      ///
+      const std::uint64_t hashMultiplier = 0x9E3779B97F4A7C15ull;
+      
+      ///
+      /// @brief: counter += 1, the table is used by the thread running the definition only
+      ///
+      void emitIncrement(llvm::IRBuilder<>& builder, llvm::GlobalVariable* counter)
+      {
+         builder.CreateStore(builder.CreateAdd(builder.CreateLoad(counter), builder.getInt64(1)), counter);
+      }
+   }
+   
+   bool memoize(llvm::Function& function, const std::string& prefix, unsigned tableSize)
+   {
+      auto& context = function.getContext();
+      auto& module = *function.getParent();
+      if (function.isDeclaration() || function.arg_empty() || function.arg_size() > maxArguments ||
+          !function.getReturnType()->isDoubleTy() || tableSize < 2 || !llvm::isPowerOf2_32(tableSize))
+         return false;
+      for (const auto& argument : function.args())
+         if (!argument.getType()->isDoubleTy())
+            return false;
+      
+      //the body moves, the self calls keep calling the table lookup
+      auto compute = llvm::Function::Create(function.getFunctionType(), llvm::Function::ExternalLinkage,
+                                            prefix + ".compute", &module);
+      compute->copyAttributesFrom(&function);
+      compute->getBasicBlockList().splice(compute->begin(), function.getBasicBlockList());
+      auto parameter = compute->arg_begin();
+      for (auto& argument : function.args())
+      {
+         parameter->takeName(&argument);
+         argument.replaceAllUsesWith(&*parameter++);
+      }
+      
+      //entry: tag (hash | 1, 0 is empty), the bits of the arguments, the result
+      auto int64 = llvm::Type::getInt64Ty(context);
+      auto keysType = llvm::ArrayType::get(int64, function.arg_size());
+      auto entryType = llvm::StructType::get(context, {int64, keysType, llvm::Type::getDoubleTy(context)});
+      auto tableType = llvm::ArrayType::get(entryType, tableSize);
+      auto table = new llvm::GlobalVariable(module, tableType, false, llvm::GlobalValue::ExternalLinkage,
+                                            llvm::ConstantAggregateZero::get(tableType), prefix + ".table");
+      table->setAlignment(64);
+      auto calls = new llvm::GlobalVariable(module, int64, false, llvm::GlobalValue::ExternalLinkage,
+                                            llvm::ConstantInt::get(int64, 0), prefix + ".calls");
+      auto hits = new llvm::GlobalVariable(module, int64, false, llvm::GlobalValue::ExternalLinkage,
+                                           llvm::ConstantInt::get(int64, 0), prefix + ".hits");
+      
+      auto lookup = llvm::BasicBlock::Create(context, "memo.lookup", &function);
+      auto hit = llvm::BasicBlock::Create(context, "memo.hit", &function);
+      auto miss = llvm::BasicBlock::Create(context, "memo.miss", &function);
+      
+      llvm::IRBuilder<> builder(lookup);
+      emitIncrement(builder, calls);
+      
+      std::vector<llvm::Value*> arguments;
+      std::vector<llvm::Value*> keys;
+      llvm::Value* hash = builder.getInt64(0);
+      for (auto& argument : function.args())
+      {
+         arguments.push_back(&argument);
+         keys.push_back(builder.CreateBitCast(&argument, int64));
+         hash = builder.CreateMul(builder.CreateXor(hash, keys.back()), builder.getInt64(hashMultiplier));
+      }
+      
+      auto index = builder.CreateLShr(hash, 64 - llvm::Log2_32(tableSize));
+      auto tag = builder.CreateOr(hash, builder.getInt64(1));
+      auto field = [&](unsigned member) -> llvm::Value* {
+         return builder.CreateInBoundsGEP(tableType, table, {builder.getInt64(0), index, builder.getInt32(member)});
+      };
+      auto key = [&](unsigned i) -> llvm::Value* {
+         return builder.CreateInBoundsGEP(tableType, table, {builder.getInt64(0), index, builder.getInt32(1), builder.getInt32(i)});
+      };
+      
+      //no early exit: comparing every key costs less than the branches
+      llvm::Value* found = builder.CreateICmpEQ(builder.CreateLoad(field(0)), tag);
+      for (unsigned i = 0; i < keys.size(); ++i)
+         found = builder.CreateAnd(found, builder.CreateICmpEQ(builder.CreateLoad(key(i)), keys[i]));
+      builder.CreateCondBr(found, hit, miss);
+      
+      builder.SetInsertPoint(hit);
+      emitIncrement(builder, hits);
+      builder.CreateRet(builder.CreateLoad(field(2)));
+      
+      //a collision evicts the previous entry
+      builder.SetInsertPoint(miss);
+      auto result = builder.CreateCall(compute, arguments);
+      builder.CreateStore(tag, field(0));
+      for (unsigned i = 0; i < keys.size(); ++i)
+         builder.CreateStore(keys[i], key(i));
+      builder.CreateStore(result, field(2));
+      builder.CreateRet(result);
+      return true;
+   }
+}
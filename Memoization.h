@@ -0,0 +1,32 @@
+//
+//  Memoization.h
+//  Kaleidoscope-LLVM
+//
+//  cache of the results of pure definitions, in front of their body
+//
+
+#ifndef Memoization_h
+#define Memoization_h
+
+#include <string>
+
+namespace llvm {
+   class Function;
+}
+
+namespace optimizer
+{
+   ///
+   /// @brief: turn the definition (pure, double arguments and result) into a lookup in a direct
+   ///         mapped table of tableSize entries (a power of 2, 2 at least: the index is the top
+   ///         bits of the hash), keyed on the bits of the arguments, calling its body (moved to
+   ///         prefix.compute) on a miss. The recursive calls of the body go through the table: a
+   ///         fib-style recursion is evaluated once per argument.
+   ///         The table and the counters of the calls and hits are the globals prefix.table,
+   ///         prefix.calls and prefix.hits. False, untouched, when the signature or the size
+   ///         doesn't fit
+   ///
+   bool memoize(llvm::Function& function, const std::string& prefix, unsigned tableSize);
+}
+
+#endif /* Memoization_h */
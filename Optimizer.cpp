@@ -8,50 +8,105 @@
 
 #include "Optimizer.h"
 
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
-#include "llvm/Support/TargetSelect.h"
-#include "llvm/Transforms/Scalar.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO/AlwaysInliner.h"
+#include "llvm/Transforms/IPO/ElimAvailExtern.h"
 
 namespace optimizer
 {
-   ///
-   /// @brief: construct optimizer and init the function passage manager
-   ///
-   Optimizer::Optimizer() : funcPassManager_(nullptr)
-   {}
+   namespace
+   {
+      llvm::PassBuilder::OptimizationLevel getPassBuilderLevel(OptimizationLevel level)
+      {
+         switch (level)
+         {
+            case OptimizationLevel::O1:
+               return llvm::PassBuilder::OptimizationLevel::O1;
+            case OptimizationLevel::O2:
+               return llvm::PassBuilder::OptimizationLevel::O2;
+            case OptimizationLevel::O3:
+               return llvm::PassBuilder::OptimizationLevel::O3;
+            case OptimizationLevel::O0:
+               break;
+         }
+         return llvm::PassBuilder::OptimizationLevel::O0;
+      }
+      
+      ///
+      /// @brief: calls of the function to itself
+      ///
+      unsigned countSelfCalls(const llvm::Function& function)
+      {
+         unsigned count = 0;
+         for (auto user : function.users())
+            if (auto call = llvm::dyn_cast<llvm::CallInst>(user))
+               count += call->getFunction() == &function && call->getCalledFunction() == &function;
+         return count;
+      }
+   }
    
    ///
-   /// @brief: run FunctionPassManager optimizer for the function passed
+   /// @brief: register the analyses once and build the pipeline of the level
    ///
-   void Optimizer::runLocalFunctionOptimization(llvm::Function *f)
+   Optimizer::Optimizer(OptimizationLevel level, llvm::TargetMachine* targetMachine) :
+   level_(level),
+   passBuilder_(targetMachine)
    {
-      funcPassManager_->run(*f);
+      passBuilder_.registerModuleAnalyses(moduleAnalyses_);
+      passBuilder_.registerCGSCCAnalyses(cgsccAnalyses_);
+      passBuilder_.registerFunctionAnalyses(functionAnalyses_);
+      passBuilder_.registerLoopAnalyses(loopAnalyses_);
+      passBuilder_.crossRegisterProxies(loopAnalyses_, functionAnalyses_, cgsccAnalyses_, moduleAnalyses_);
+      
+      // The bodies imported from previous modules (available_externally) are only there to be
+      // inlined: they are compiled in their own module, the default pipelines drop them at the end.
+      if (level == OptimizationLevel::O0)
+      {
+         pipeline_.addPass(llvm::AlwaysInlinerPass());
+         pipeline_.addPass(llvm::EliminateAvailableExternallyPass());
+      }
+      else
+         pipeline_ = passBuilder_.buildPerModuleDefaultPipeline(getPassBuilderLevel(level));
    }
    
+   OptimizationLevel Optimizer::getLevel() const
+   {
+      return level_;
+   }
    
-   ///
-   /// @brief: premature optimization for function generated (mainly peephole opt)
-   ///
-   
-   void Optimizer::enablePrematureOptimization(llvm::Module* module)
+   bool Optimizer::optimizeModule(llvm::Module& module)
    {
-      //initializa the function passage manager
-      funcPassManager_ = std::make_unique<llvm::legacy::FunctionPassManager>(module);
+      if (llvm::verifyModule(module, &llvm::errs()))
+         return false;
       
-      // Do simple "peephole" optimizations plus something else.
-      funcPassManager_->add(llvm::createInstructionCombiningPass());
-      // Reassociate expressions.
-      funcPassManager_->add(llvm::createReassociatePass());
-      // Eliminate Common SubExpressions.
-      funcPassManager_->add(llvm::createNewGVNPass());
-      // Simplify the control flow graph (deleting unreachable blocks, etc).
-      funcPassManager_->add(llvm::createCFGSimplificationPass());
-      //do init
-      funcPassManager_->doInitialization();
-
+      //self recursive definitions, to report the ones turned into loops
+      std::vector<std::pair<std::string, unsigned>> recursive;
+      for (const auto& function : module)
+         if (!function.isDeclaration() && !function.hasAvailableExternallyLinkage())
+            if (const auto selfCalls = countSelfCalls(function))
+               recursive.emplace_back(function.getName().str(), selfCalls);
+      
+      pipeline_.run(module, moduleAnalyses_);
+      
+      loopAnalyses_.clear();
+      functionAnalyses_.clear();
+      cgsccAnalyses_.clear();
+      moduleAnalyses_.clear();
+      
+      for (const auto& function : recursive)
+      {
+         auto optimized = module.getFunction(function.first);
+         if (optimized && !optimized->isDeclaration() && countSelfCalls(*optimized) == 0)
+            llvm::errs() << "note: tail recursion of '" << function.first << "' turned into a loop\n";
+      }
+      return true;
    }
-
-   
 }
-
@@ -9,29 +9,63 @@
 #ifndef Optimizer_h
 #define Optimizer_h
 
-#include <memory>
-#include "llvm/IR/LegacyPassManager.h"
+#include <cstdint>
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
 
 namespace llvm {
-   class Function;
    class Module;
+   class TargetMachine;
 }
 
 namespace  optimizer
 {
    ///
-   /// @brief: optimizer
+   /// @brief: named optimization levels of the IR, the default pipelines of LLVM.
+   ///         O0 only inlines the 'alwaysinline' functions (the user defined operators)
+   ///
+   enum class OptimizationLevel : std::uint8_t
+   {
+      O0,
+      O1,
+      O2,
+      O3
+   };
+   
+   ///
+   /// @brief: optimizer of the modules handed to the jit. The pipeline of the level and the
+   ///         analysis managers are built once, every module goes through them exactly once
    ///
    class Optimizer
    {
-      std::unique_ptr<llvm::legacy::FunctionPassManager> funcPassManager_;
+   public:
       
+      ///
+      /// @brief: targetMachine gives the costs of the target (vectorization, unrolling, inlining)
+      ///
+      explicit Optimizer(OptimizationLevel level, llvm::TargetMachine* targetMachine);
+      Optimizer(const Optimizer&) = delete;
+      Optimizer& operator=(const Optimizer&) = delete;
       
-   public:
-      explicit Optimizer();
-      void enablePrematureOptimization(llvm::Module* module);
-      void runLocalFunctionOptimization(llvm::Function* f);
+      OptimizationLevel getLevel() const;
+      
+      ///
+      /// @brief: run the pipeline over the module. The analysis results are dropped afterwards:
+      ///         the next module may reuse the addresses of this one.
+      ///         False, the module untouched and its errors printed, when it doesn't verify
+      ///
+      bool optimizeModule(llvm::Module& module);
+   
+   private:
       
+      OptimizationLevel level_;
+      llvm::PassBuilder passBuilder_;
+      llvm::LoopAnalysisManager loopAnalyses_;
+      llvm::FunctionAnalysisManager functionAnalyses_;
+      llvm::CGSCCAnalysisManager cgsccAnalyses_;
+      llvm::ModuleAnalysisManager moduleAnalyses_;
+      llvm::ModulePassManager pipeline_;
    };
 }
 
@@ -12,23 +12,30 @@
 #include "Lexer.h"
 #include "AST.h"
 #include "Debug.h"
+#include "TokenTable.h"
+#include "FlatAST.h"
+#include "SlotResolver.h"
+#include "Memoization.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 
 
+#include <algorithm>
 #include <cctype>
 #include <vector>
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <future>
+#include <thread>
 
 using namespace code_generator;
 using namespace lexer;
 
 namespace parser
 {
-   using ArgsExpr_t = std::vector<std::unique_ptr<ExprAST>>;
-   using ArgsStr_t = std::vector<std::string>;
-   
-   
    debug::DebugInfo gDebugInfo;
    //code_generator::CodeGeneratorImpl gCodeGenerator;
    //jit::JIT gJitCompiler;
@@ -38,532 +45,372 @@ namespace parser
    /// @brief: construct a pimpl lexer
    ///
    Parser::Parser() :
-   curToken_(0),
+   Parser(std::make_unique<Lexer>())
+   {}
+   
+   ///
+   /// @brief: construct a parser on top of the lexer passed (i.e. reading a source file)
+   ///
+   Parser::Parser(std::unique_ptr<lexer::Lexer> lexer) :
+   SyntaxParser(std::move(lexer)),
    codeGenerator_(jitCompiler_),
-   configurator_(util::CompilerConfigurator(codeGenerator_, jitCompiler_)),
-   lexer_(std::make_unique<Lexer>())
+   configurator_(util::CompilerConfigurator(codeGenerator_, jitCompiler_))
    {
       codeGenerator_.InitializeModuleAndPassManager();
    }
    
    ///
-   /// intenal routines
+   /// @brief: construct a parser walking a token table lexed up front
    ///
-   
-   int Parser::getNextToken()
+   Parser::Parser(std::unique_ptr<lexer::TokenTable> tokens) :
+   SyntaxParser(std::move(tokens)),
+   codeGenerator_(jitCompiler_),
+   configurator_(util::CompilerConfigurator(codeGenerator_, jitCompiler_))
    {
-      curToken_ = lexer_->gettok();
-      return curToken_;
+      codeGenerator_.InitializeModuleAndPassManager();
    }
    
-   int Parser::getTokenPrecedence()
+   void Parser::setConfiguration(const driver::DriverConfiguration& cnf)
    {
-      if(!isascii(curToken_))
-         return -1;
+      cnf_ = cnf;
+      codeGenerator_.setBoundsChecks(cnf_.boundsChecks_);
+      codeGenerator_.setFloatingPointMode(cnf_.floatingPointMode_);
+      codeGenerator_.setSelectLowering(&purity_, cnf_.selectThreshold_);
+      codeGenerator_.setOptimizationLevel(cnf_.enableOpt_);
       
-      //here we could throw.. what should I do? .. dunno now
+      if (!cnf_.profileUse_.empty())
+         profile_.load(cnf_.profileUse_);
       
-      int tokenPrec = configurator_.getCodeGenerator().getOperatorPrecedence(curToken_);
-      return tokenPrec;
-   }
-   
-   void Parser::setTokenPrecedence(unsigned char token, int value)
-   {
-      //here we could throw.. what should I do? .. dunno now
-      configurator_.getCodeGenerator().setOperatorPrecedence(token, value);
+      //the callees come from the definition library: the previous definitions, compiled already
+      if (cnf_.constEvalBudget_)
+      {
+         callEvaluator_ = std::make_unique<jit::CallEvaluator>(jitCompiler_, cnf_.constEvalBudget_);
+         astOptimizer_.setCallEvaluator([this](util::symbol_t callee, llvm::ArrayRef<double> arguments) -> llvm::Optional<double> {
+            if (!purity_.isPureFunction(callee))
+               return llvm::None;
+            const auto name = util::symbolName(callee).str();
+            auto module = codeGenerator_.extractDefinition(name);
+            if (!module)
+               return llvm::None;
+            return callEvaluator_->evaluate(std::move(module), name, arguments);
+         });
+      }
+      
+      //the whole file mode compiles a single module, optimized once
+      if (cnf_.tiered_ && !cnf_.wholeFile_)
+      {
+         codeGenerator_.setOptimizationLevel(optimizer::OptimizationLevel::O0);
+         tieredCompiler_ = std::make_unique<jit::TieredCompiler>(jitCompiler_, cnf_.hotThreshold_);
+      }
    }
    
-   expression_t Parser::error(const char* str)
-   {
-      std::cerr << "Error: "<< str << "\n";
-      return nullptr;
-   }
-
-   prototype_t Parser::errorP(const char *str)
-   {
-      error(str);
-      return nullptr;
-   }
+   ///
+   /// intenal routines
+   ///
    
-   expression_t Parser::parseExpression()
+   int Parser::getOperatorPrecedence(unsigned char token) const
    {
-      //parseUnary();
-      auto lhs = parseUnary(); //parsePrimaryExpression();
-      if (!lhs)
-         return nullptr;
-      
-      return parseBinOpRHS(0, std::move(lhs));
+      return configurator_.getCodeGenerator().getOperatorPrecedence(token);
    }
    
-   expression_t Parser::parseNumberExpr()
+   void Parser::setOperatorPrecedence(unsigned char token, int value)
    {
-      auto res = std::make_unique<AST::NumberExprAST>(configurator_.getCodeGenerator(), lexer_->getNum());
-      getNextToken();
-      return std::move(res);
+      configurator_.getCodeGenerator().setOperatorPrecedence(token, value);
    }
    
-   expression_t Parser::parseParentExpr()
+   llvm::Function* Parser::codeGenFunction(FunctionAST& function)
    {
-      getNextToken();
+      //the code generator takes the prototype: what is known of the definition is kept aside,
+      //recorded only once it is generated
+      if (cnf_.optimizeAST_)
+      {
+         astOptimizer_.optimize(function);
+         astOptimizer_.prepareOperator(function);
+      }
+      purity_.classifyDefinition(function);
+      const auto symbol = function.getPrototype()->getSymbol();
       
-      auto v = parseExpression();
+      const optimizer::shared_expressions_t* shared = nullptr;
+      if (cnf_.hashConsing_)
+      {
+         hashConsing_.share(function);
+         shared = &hashConsing_.getSharedExpressions();
+      }
+      codeGenerator_.setSharedExpressions(shared);
       
-      if(v == nullptr)
-         return nullptr;
+      //the tree is final: variable references are resolved to scope slots
+      AST::resolveSlots(function);
       
-      if(curToken_ != ')')
-         return error("expected )");
-   
-      getNextToken();
+      llvm::Function* definition = nullptr;
+      if (!cnf_.flatAST_)
+         definition = function.codeGen(codeGenerator_);
+      else
+      {
+         const auto flat = AST::FlatAST::build(function.getBody(), shared);
+         definition = codeGenerator_.codeGenFlatFunction(&function, flat);
+      }
+      
+      if (!definition)
+      {
+         astOptimizer_.discardOperator();
+         purity_.discardDefinition();
+         return nullptr;
+      }
+      astOptimizer_.addOperator();
+      purity_.addDefinition();
       
-      return v;
+      applyProfile(*definition);
+      if (cnf_.memoTableSize_)
+         memoizeDefinition(symbol, *definition);
+      return definition;
    }
    
-   expression_t Parser::parseIdentifierExpr()
+   void Parser::applyProfile(llvm::Function& definition)
    {
-      auto idName = lexer_->getId();
+      //the top level expressions run once, the tiered mode profiles its own tier 0
+      const auto name = definition.getName().str();
+      if (tieredCompiler_ || name.compare(0, 11, "__anon_expr") == 0)
+         return;
       
-      //SourceLocation Idlocation = debugInfo_.currentLocation_;
+      if (const auto* profile = profile_.find(name))
+         if (!optimizer::annotateProfile(definition, *profile, profile_.isHot(*profile)))
+            std::cerr << "warning: the profile of '" << name << "' does not match its definition, ignored\n";
       
-      getNextToken();
-      
-      if( curToken_ != '(')
-         return std::make_unique<AST::VariableExprAST>(configurator_.getCodeGenerator(), idName);
-      
-      getNextToken();
-      ArgsExpr_t args;
-      
-      if( curToken_ != ')')
+      if (!cnf_.profileGenerate_.empty())
       {
-         while(1)
-         {
-            auto arg = parseExpression();
-            if( arg != nullptr)
-            {
-               args.push_back(std::move(arg));
-            }
-            else
-            {
-               return nullptr;
-            }
-            
-            if( curToken_ == ')')
-               break;
-            
-            if(curToken_ != ',')
-               return error("Expected ) or , in argument list");
-            
-            getNextToken();
-         }
+         const auto counters = name + ".profile." + std::to_string(++profileVersion_);
+         profiledDefinitions_[name] = {counters, optimizer::instrumentProfile(definition, counters)};
       }
-      
-      getNextToken();
-      return std::make_unique<AST::CallExprAST>(configurator_.getCodeGenerator(), idName, std::move(args));
    }
    
-   expression_t Parser::parsePrimaryExpression()
+   void Parser::memoizeDefinition(util::symbol_t symbol, llvm::Function& definition)
    {
-      switch(curToken_)
-      {
-         default:
-            return error("Unknown token where aspecting an expression");
-            
-         case lexer::tok_identifier :
-            return parseIdentifierExpr();
-            
-         case lexer::tok_number:
-            return parseNumberExpr();
-            
-         case '(':
-            return parseParentExpr();
-         
-         case lexer::tok_if:
-            return parseIfExpr();
-            
-         case lexer::tok_for:
-            return parseForExpr();
-            
-         case lexer::tok_var:
-            return parseVarExpr();
-      }
+      //straight line definitions cost less than the lookup, the operators are inlined
+      const auto name = definition.getName().str();
+      if (!purity_.isPureFunction(symbol) || purity_.isSpeculatableFunction(symbol) ||
+          definition.hasFnAttribute(llvm::Attribute::AlwaysInline) || name.compare(0, 11, "__anon_expr") == 0)
+         return;
+      
+      const auto prefix = name + ".memo." + std::to_string(++memoVersion_);
+      if (optimizer::memoize(definition, prefix, cnf_.memoTableSize_))
+         memoizedDefinitions_[name] = prefix;
    }
    
-   expression_t Parser::parseUnary()
+   void Parser::saveProfile()
    {
-      if ( !isascii(curToken_) || curToken_ == '(' || curToken_ == ',')
-         return parsePrimaryExpression();
+      if (cnf_.profileGenerate_.empty())
+         return;
       
-      int opcode = curToken_;
-      getNextToken();
-      if (auto operand = parseUnary())
-         return std::make_unique<UnaryExprAST>(configurator_.getCodeGenerator(), opcode, std::move(operand));
-      
-      return nullptr;
+      for (const auto& definition : profiledDefinitions_)
+         if (auto counters = jitCompiler_.findSymbol(definition.second.counters))
+         {
+            const auto address = cantFail(counters.getAddress());
+            profile_.add(definition.first, optimizer::readProfile(reinterpret_cast<const std::atomic<std::uint64_t>*>(address),
+                                                                  definition.second.shape));
+         }
+      profile_.save(cnf_.profileGenerate_);
    }
    
-   expression_t Parser::parseBinOpRHS(int exprPrec, expression_t lhs)
+   void Parser::reportMemoization()
    {
-      while( true )
+      for (const auto& definition : memoizedDefinitions_)
       {
-         auto tokenPrec = getTokenPrecedence();
-         if(tokenPrec < exprPrec)
-            return lhs;
-         
-         int binOp = curToken_;
-         //SourceLocation binaryOpLocation = debugInfo_.currentLocation_;
-         getNextToken();
-         
-         auto rhs = parseUnary(); 
-         if( rhs == nullptr)
-            return nullptr;
-         
-         int nextPrec = curToken_;
-         if(tokenPrec < nextPrec)
-         {
-            rhs = parseBinOpRHS(tokenPrec+1, std::move(rhs));
-            if(rhs == nullptr)
-               return nullptr;
-         }
+         auto callsSymbol = jitCompiler_.findSymbol(definition.second + ".calls");
+         auto hitsSymbol = jitCompiler_.findSymbol(definition.second + ".hits");
+         if (!callsSymbol || !hitsSymbol)
+            continue;
          
-         lhs = std::make_unique<AST::BinaryExprAST>(configurator_.getCodeGenerator(), binOp, std::move(lhs), std::move(rhs));
+         const auto calls = *reinterpret_cast<const std::uint64_t*>(cantFail(callsSymbol.getAddress()));
+         const auto hits = *reinterpret_cast<const std::uint64_t*>(cantFail(hitsSymbol.getAddress()));
+         fprintf(stderr, "note: memoized '%s': %llu calls, %.1f%% hits\n", definition.first.c_str(),
+                 static_cast<unsigned long long>(calls), calls ? 100.0 * hits / calls : 0.0);
       }
    }
    
-   prototype_t Parser::parsePrototype()
+   ///
+   /// Top-Level parsing
+   ///
+   
+   void Parser::handleDefinition()
    {
-      //SourceLocation fnLocation = debugInfo_.currentLocation_;
-
-      unsigned binaryPrecedence = 30;
-      // by default I assume I am going to parse a prototype definition
-      unsigned kind = 0; //0 (prototype) - 1(unary) - 2(binary)
-      std::string functionName = lexer_->getId();
-      
-      switch (curToken_)
+      if(auto parsedDefinition = parseDefinition())
       {
-         case lexer::tok_identifier:
-            getNextToken();
-            break;
-            
-            
-         case lexer::tok_unary:
-            
-            getNextToken();
-            
-            if (!isascii(curToken_))
-               return errorP("Expected unary operator");
-            
-            functionName = ("unary") + (char)curToken_;
-            kind = 1;
-            getNextToken();
-            
-            break;
-            
-         case lexer::tok_binary:
-            
-            getNextToken();
-            if (!isascii(curToken_))
-               return errorP("Expected binary operator");
-            
-            functionName = ("binary") + (char)curToken_;
-            kind = 2;
-            getNextToken();
-            
-            
-            if (curToken_ == lexer::tok_number)
-            {
-               if (lexer_->getNum() < 1 || lexer_->getNum() > 100)
-                  return errorP("Invalid precedecnce: must be 1..100");
-               
-               binaryPrecedence = (unsigned)lexer_->getNum();
-               getNextToken();
-            }
-            
-            break;
-            
-         default:
-            return errorP("expected function name in prototype");
+         emitDefinition(*parsedDefinition);
       }
-      
-      if (curToken_ != '(')
-         return errorP("Expected '(' in prototype");
-      
-      ArgsStr_t args;
-      while(getNextToken() == lexer::tok_identifier)
-         args.push_back(lexer_->getId());
-      
-      if(curToken_!= ')')
-         return errorP("expected ')' in prototype");
-      
-      // success.
-      getNextToken();
-      
-      if (kind && args.size() != kind)
-         return errorP("Invalid number of operands for operator");
-      
-      return std::make_unique<AST::PrototypeAST>(configurator_.getCodeGenerator(),
-                                                 functionName,
-                                                 std::move(args),
-                                                 kind != 0,
-                                                 binaryPrecedence);
-   }
-   
-   function_t Parser::parseDefinition()
-   {
-      getNextToken();
-      auto prototype = parsePrototype();
-      if(prototype == nullptr)
-         return nullptr;
-      
-      auto expression = parseExpression();
-      if( expression != nullptr )
+      else
       {
-         return
-         std::make_unique<AST::FunctionAST>(configurator_.getCodeGenerator(), std::move(prototype), std::move(expression));
+         getNextToken();
       }
-      
-      return nullptr;
    }
    
-   function_t Parser::parseTopLevelExpr()
+   void Parser::handleExtern()
    {
-      //SourceLocation fnLocation = debugInfo_.currentLocation_;
-      auto expression = parseExpression();
-      if( expression != nullptr)
+      if(auto parsedExtern = parseExtern())
       {
-         auto prototype = std::make_unique<AST::PrototypeAST>(configurator_.getCodeGenerator(),
-                                                              "__anon_expr", std::vector<std::string> {});
-         
-         return std::make_unique<AST::FunctionAST>(configurator_.getCodeGenerator(),
-                                                   std::move(prototype), std::move(expression));
+         emitExtern(parsedExtern);
+      }
+      else
+      {
+         getNextToken();
       }
-      return nullptr;
-   }
-   
-   prototype_t Parser::parseExtern()
-   {
-      getNextToken();
-      return parsePrototype();
-   }
-   
-   expression_t Parser::parseIfExpr()
-   {
-      //SourceLocation ifLocation = debugInfo_.currentLocation_;;
-
-      getNextToken();
-      auto Cond = parseExpression();
-      
-      if(!Cond)
-         return nullptr;
-      
-      if (curToken_ != tok_then)
-         return errorP("expected then");
-      
-      getNextToken();
-      
-      auto Then = parseExpression();
-      if (!Then)
-         return nullptr;
-      
-      if (curToken_ != tok_else)
-         return errorP("expected else");
-      
-      getNextToken();
-      
-      auto Else = parseExpression();
-      if (!Else)
-         return nullptr;
-      
-      return std::make_unique<IfExprAST>(configurator_.getCodeGenerator(),
-                                         std::move(Cond), std::move(Then), std::move(Else));
    }
    
-   expression_t Parser::parseForExpr()
+   void Parser::handleTopLevelExpression()
    {
-      getNextToken();
-      
-      if (curToken_ != tok_identifier)
-         return errorP("expected identifier after for");
-      
-      std::string IdName = lexer_->getId();
-      
-      getNextToken();
-      
-      if (curToken_ != '=')
-         return errorP("expected '=' after for");
-      
-      getNextToken();
-      
-      auto Start = parseExpression();
-      if (!Start)
-         return nullptr;
-      
-      if (curToken_ != ',')
-         return errorP("expected ',' after for start value");
-      
-      getNextToken();
-      
-      auto End = parseExpression();
-      if (!End)
-         return nullptr;
-      
-      // The step value is optional.
-      expression_t Step;
-      if (curToken_ == ',')
+      if(auto parsedTopLevelExpr = parseTopLevelExpr())
+      {
+         emitTopLevelExpression(*parsedTopLevelExpr);
+      }
+      else
       {
          getNextToken();
-         Step = parseExpression();
-         if (!Step)
-            return nullptr;
       }
-      
-      if (curToken_ != tok_in)
-         return errorP("expected 'in' after for");
-      
-      getNextToken();
-      
-      auto Body = parseExpression();
-      if (!Body)
-         return nullptr;
-      
-      return llvm::make_unique<ForExprAST>(configurator_.getCodeGenerator(),
-                                           IdName, std::move(Start),
-                                           std::move(End), std::move(Step),
-                                           std::move(Body));
-      
    }
    
-   expression_t Parser::parseVarExpr()
+   void Parser::emitDefinition(FunctionAST& parsedDefinition)
    {
-      getNextToken(); // eat the var.
-      
-      std::vector<std::pair<std::string, expression_t>> variableNames;
-      
-      // At least one variable name is required.
-      if (curToken_ != tok_identifier)
-         return errorP("expected identifier after var");
-      
-      while (1)
+      if( const auto* defintionIR = codeGenFunction(parsedDefinition))
       {
-         std::string name = lexer_->getId();
-         getNextToken();
+         //the module collects the whole input, optimized at its end
+         if (cnf_.wholeFile_)
+         {
+            defintionIR->print(llvm::errs());
+            return;
+         }
          
-         // Read the optional initializer.
-         expression_t init = nullptr;
-         if (curToken_ == '=')
+         //tier 0 is optimized after keeping the IR of the later tiers
+         if (tieredCompiler_)
          {
-            getNextToken(); // eat the '='.
+            if (llvm::verifyModule(*defintionIR->getParent(), &llvm::errs()))
+            {
+               dropModule();
+               return;
+            }
+            defintionIR->print(llvm::errs());
+            exportDefinitions(*defintionIR->getParent());
+            const auto name = defintionIR->getName().str();
             
-            init = parseExpression();
-            if (!init)
-               return nullptr;
+            std::unique_ptr<llvm::Module> module;
+            codeGenerator_.getModule(module);
+            tieredCompiler_->addDefinition(std::move(module), name);
+            codeGenerator_.InitializeModuleAndPassManager();
+            return;
+         }
+         
+         if (!codeGenerator_.optimizeModule())
+         {
+            dropModule();
+            return;
          }
+         defintionIR->print(llvm::errs());
          
-         variableNames.push_back(std::make_pair(name, std::move(init)));
+         //later modules import the optimized body, unless it updates counters of its own module
+         if (cnf_.profileGenerate_.empty())
+            exportDefinitions(*defintionIR->getParent());
          
-         // End of var list, exit loop.
-         if (curToken_ != ',')
-            break;
+         //TODO: remove this hack!!
+         std::unique_ptr<llvm::Module> module;
+         codeGenerator_.getModule(module);
          
-         getNextToken();
+         jitCompiler_.addModule(module);
+         codeGenerator_.InitializeModuleAndPassManager();
          
-         if (curToken_ != tok_identifier)
-            return errorP("expected identifier list after var");
+         //jit_->addModule(std::move)
       }
-      
-      // At this point, we have to have 'in'.
-      if (curToken_ != tok_in)
-         return errorP("expected 'in' keyword after 'var'");
-      
-      //eat in
-      getNextToken();
-      
-      auto body = parseExpression();
-      if (!body)
-         return nullptr;
-      
-      return std::make_unique<VarExprAST>(configurator_.getCodeGenerator(),
-                                          std::move(variableNames), std::move(body));
-
    }
-
    
-   ///
-   /// Top-Level parsing
-   ///
+   void Parser::dropModule()
+   {
+      //the verifier printed what is wrong
+      std::cerr << "error: invalid IR generated, the module is dropped\n";
+      codeGenerator_.InitializeModuleAndPassManager();
+   }
    
-   void Parser::handleDefinition()
+   void Parser::exportDefinitions(const llvm::Module& module)
    {
-      if(const auto& parsedDefinition = parseDefinition())
-      {
-         if( const auto* defintionIR = parsedDefinition->codeGen())
-         {
-            defintionIR->print(llvm::errs());
-            
-            //TODO: remove this hack!!
-            std::unique_ptr<llvm::Module> module;
-            codeGenerator_.getModule(module);
-            
-            jitCompiler_.addModule(module);
-            codeGenerator_.InitializeModuleAndPassManager();
-
-            //jit_->addModule(std::move)
-         }
-      }
-      else
-      {
-         getNextToken();
-      }
+      //the definition and the functions made for it (the body behind a memoization table)
+      for (const auto& function : module)
+         if (!function.isDeclaration() && !function.hasAvailableExternallyLinkage())
+            codeGenerator_.exportDefinition(function);
    }
    
-   void Parser::handleExtern()
+   void Parser::emitExtern(prototype_t& parsedExtern)
    {
-      if(auto parsedExtern = parseExtern())
-      {
-         if(const auto* externIR = parsedExtern->codeGen())
-         {
-            externIR->print(llvm::errs());
-            configurator_.getCodeGenerator().addProtypeCache(parsedExtern->getName(), parsedExtern);
-         }
-      }
-      else
+      purity_.addExtern(*parsedExtern);
+      
+      if(const auto* externIR = parsedExtern->codeGen(codeGenerator_))
       {
-         getNextToken();
+         externIR->print(llvm::errs());
+         configurator_.getCodeGenerator().addProtypeCache(parsedExtern->getSymbol(), parsedExtern);
       }
    }
    
-   void Parser::handleTopLevelExpression()
+   void Parser::emitTopLevelExpression(FunctionAST& parsedTopLevelExpr)
    {
-      if(auto parsedTopLevelExpr = parseTopLevelExpr())
+      if( auto* topLevelExprIR = codeGenFunction(parsedTopLevelExpr))
       {
-         if( const auto* topLevelExprIR = parsedTopLevelExpr->codeGen())
+         //evaluated with the module, at the end of the input
+         if (cnf_.wholeFile_)
          {
             topLevelExprIR->print(llvm::errs());   //dump IR for the function
-            
-            //evaluation
-            std::unique_ptr<llvm::Module> module;
-            codeGenerator_.getModule(module);
-            
-            auto H = jitCompiler_.addModule(module);
-            codeGenerator_.InitializeModuleAndPassManager();
-            //InitializeModuleAndPassManager();
-            
-            // Search the JIT for the __anon_expr symbol.
-            auto exprSymbol = jitCompiler_.findSymbol("__anon_expr");
-            assert(exprSymbol && "Function not found");
-            
-            // Get the symbol's address and cast it to the right type (takes no
-            // arguments, returns a double) so we can call it as a native function.
-            double (*FP)() = (double (*)())(intptr_t)cantFail(exprSymbol.getAddress());
-            fprintf(stderr, "Evaluated to %f\n", FP());
-            
-            // Delete the anonymous expression module from the JIT.
-            jitCompiler_.removeModule(H);
+            pendingExpressions_.push_back("__anon_expr." + std::to_string(pendingExpressions_.size()));
+            topLevelExprIR->setName(pendingExpressions_.back());
+            return;
          }
+         
+         if (!codeGenerator_.optimizeModule())
+         {
+            dropModule();
+            return;
+         }
+         topLevelExprIR->print(llvm::errs());   //dump IR for the function
+         
+         //evaluation
+         std::unique_ptr<llvm::Module> module;
+         codeGenerator_.getModule(module);
+         
+         auto H = jitCompiler_.addModule(module);
+         codeGenerator_.InitializeModuleAndPassManager();
+         //InitializeModuleAndPassManager();
+         
+         evaluate("__anon_expr");
+         
+         // Delete the anonymous expression module from the JIT.
+         jitCompiler_.removeModule(H);
       }
-      else
+   }
+   
+   void Parser::evaluate(const std::string& name)
+   {
+      // Search the JIT for the symbol of the expression.
+      auto exprSymbol = jitCompiler_.findSymbol(name);
+      assert(exprSymbol && "Function not found");
+      
+      // Get the symbol's address and cast it to the right type (takes no
+      // arguments, returns a double) so we can call it as a native function.
+      double (*FP)() = (double (*)())(intptr_t)cantFail(exprSymbol.getAddress());
+      fprintf(stderr, "Evaluated to %f\n", FP());
+   }
+   
+   void Parser::emitWholeFile()
+   {
+      if (!cnf_.wholeFile_)
+         return;
+      
+      if (!codeGenerator_.optimizeModule())
       {
-         getNextToken();
+         dropModule();
+         pendingExpressions_.clear();
+         return;
       }
+      std::unique_ptr<llvm::Module> module;
+      codeGenerator_.getModule(module);
+      jitCompiler_.addModule(module);
+      codeGenerator_.InitializeModuleAndPassManager();
+      
+      for (const auto& name : pendingExpressions_)
+         evaluate(name);
+      pendingExpressions_.clear();
    }
    
    ///
@@ -578,6 +425,7 @@ namespace parser
          switch(curToken_)
          {
             case lexer::tok_eof:
+               emitWholeFile();
                return;
             case ';':
                getNextToken();
@@ -593,8 +441,145 @@ namespace parser
                break;
          }
          
+         //the item has been code generated: release all its nodes
+         astContext_.reset();
+         
          std::cout << "\n\n >>";
          
       }
    }
+   
+   ///
+   /// @brief: split the token table in ranges starting at a top level 'def' or 'extern'.
+   ///         Every range starts with the operator precedences of the binary operators defined
+   ///         before it, found parsing the 'def binary' prototypes ahead
+   ///
+   std::vector<Parser::ParseChunk> Parser::splitTopLevelItems(size_t chunkCount) const
+   {
+      assert(tokens_ && "batch parsing needs a token table");
+      
+      std::vector<size_t> itemStarts;
+      for (size_t i = 0; i < tokenEnd_; ++i)
+      {
+         const int token = tokens_->getKind(i);
+         if (token == lexer::tok_def || token == lexer::tok_extern)
+            itemStarts.push_back(i);
+      }
+      
+      precedence_table_t precedence;
+      for (int token = 0; token < 128; ++token)
+      {
+         const int value = getOperatorPrecedence(token);
+         if (value != -1)
+            precedence[token] = value;
+      }
+      
+      const size_t itemsPerChunk = std::max<size_t>(1, (itemStarts.size() + chunkCount - 1) / std::max<size_t>(1, chunkCount));
+      
+      //the prototypes only: their errors are reported when their range is parsed
+      SyntaxParser scanner(*tokens_, 0, tokenEnd_);
+      std::ostringstream ignored;
+      scanner.setErrorStream(ignored);
+      
+      std::vector<ParseChunk> chunks;
+      size_t begin = 0;
+      size_t scanned = 0; //'def binary' prototypes before scanned are in precedence
+      for (size_t item = itemsPerChunk; item <= itemStarts.size(); item += itemsPerChunk)
+      {
+         const size_t end = item < itemStarts.size() ? itemStarts[item] : tokenEnd_;
+         if (end == begin)
+            continue;
+         
+         chunks.push_back(ParseChunk{begin, end, precedence});
+         
+         // def binary ...
+         for (; scanned < item && scanned < itemStarts.size(); ++scanned)
+         {
+            scanner.rewind(itemStarts[scanned]);
+            if (scanner.peekToken(0) != lexer::tok_def || scanner.peekToken(1) != lexer::tok_binary)
+               continue;
+            
+            scanner.getNextToken(); //eat 'def'
+            const auto prototype = scanner.parsePrototype();
+            if (prototype && prototype->isBinary())
+               precedence[prototype->getOperatorName()] = prototype->getBinaryPrecedence();
+         }
+         
+         begin = end;
+      }
+      
+      //top level expressions only, or the tail after the last def
+      if (begin < tokenEnd_ || chunks.empty())
+         chunks.push_back(ParseChunk{begin, tokenEnd_, precedence});
+      
+      return chunks;
+   }
+   
+   ///
+   /// @brief: batch mode: the ranges of the token table are parsed concurrently, the items are
+   ///         code generated in source order as soon as the range holding them is parsed
+   ///
+   void Parser::batchLoop()
+   {
+      if (!tokens_)
+      {
+         mainLoop();
+         return;
+      }
+      
+      const unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+      llvm::ThreadPool pool;
+      const auto chunks = splitTopLevelItems(threads * 8);
+      
+      std::vector<std::unique_ptr<SyntaxParser>> parsers;
+      std::vector<std::vector<TopLevelItem>> items(chunks.size());
+      std::vector<std::shared_future<void>> parsed;
+      
+      util::StringInterner::instance().setThreadSafe(true);
+      
+      for (size_t i = 0; i < chunks.size(); ++i)
+      {
+         parsers.push_back(std::make_unique<SyntaxParser>(*tokens_, chunks[i].begin, chunks[i].end));
+         auto& chunkParser = *parsers.back();
+         auto& chunkItems = items[i];
+         for (const auto& op : chunks[i].precedence)
+            chunkParser.setTokenPrecedence(op.first, op.second);
+         
+         parsed.push_back(pool.async([&chunkParser, &chunkItems] {
+            chunkParser.getNextToken();
+            chunkParser.parseAll(chunkItems);
+         }));
+      }
+      
+      for (size_t i = 0; i < chunks.size(); ++i)
+      {
+         parsed[i].wait();
+         
+         for (auto& item : items[i])
+         {
+            switch (item.kind)
+            {
+               case TopLevelItem::Kind::Definition:
+                  emitDefinition(*item.function);
+                  break;
+               case TopLevelItem::Kind::Extern:
+                  emitExtern(item.prototype);
+                  break;
+               case TopLevelItem::Kind::Expression:
+                  emitTopLevelExpression(*item.function);
+                  break;
+               case TopLevelItem::Kind::Error:
+                  std::cerr << item.error;
+                  break;
+            }
+         }
+         
+         //the range has been code generated: release its nodes
+         items[i].clear();
+         parsers[i].reset();
+      }
+      
+      util::StringInterner::instance().setThreadSafe(false);
+      emitWholeFile();
+   }
 }
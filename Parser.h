@@ -11,12 +11,23 @@
 
 #include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "Lexer.h"
+#include "TokenTable.h"
 #include "AST.h"
+#include "SyntaxParser.h"
+#include "ASTOptimizer.h"
+#include "HashConsing.h"
+#include "Purity.h"
+#include "Profile.h"
 #include "CompilerConfigurator.h"
+#include "Driver.h"
 #include "CodeGenerator.h"
 #include "JIT.h"
+#include "TieredCompiler.h"
+#include "CallEvaluator.h"
 
 //namespace AST {
 //   class ExprAST;
@@ -30,11 +41,11 @@ using namespace AST;
 
 namespace parser {
    
-   using expression_t = std::unique_ptr<ExprAST>;
-   using prototype_t = std::unique_ptr<PrototypeAST>;
-   using function_t = std::unique_ptr<FunctionAST>;
-   
-   class Parser
+   ///
+   /// @brief: parser driving the code generator and the jit: every top level item is
+   ///         code generated (and top level expressions evaluated) as soon as it is parsed
+   ///
+   class Parser : public SyntaxParser
    {
    public:
       
@@ -44,77 +55,19 @@ namespace parser {
       explicit Parser();
       
       ///
-      /// delete copy ctor and copy assignment
+      /// parse the tokens produced by the lexer passed
       ///
-      Parser(const Parser&) = delete;
-      Parser& operator=(const Parser&) = delete;
+      explicit Parser(std::unique_ptr<lexer::Lexer> lexer);
       
       ///
-      /// Deal with the language constructs
+      /// parse a token table lexed up front: cheap lookahead and backtracking
       ///
+      explicit Parser(std::unique_ptr<lexer::TokenTable> tokens);
       
-      int getNextToken();
-      void setTokenPrecedence(unsigned char, int);
-      int getTokenPrecedence();
-
-      expression_t error(const char* str);
-      prototype_t errorP(const char* str);
-            
-      ///numbexpr := number
-      expression_t parseNumberExpr();
-      
-      ///parenexpr := '(' expression ')'
-      expression_t parseParentExpr();
-      
-      ///identifierexpr
-      ///   := identifier
-      //    := identifier '('expression')'
-      expression_t parseIdentifierExpr();
-      
-      /// primary
-      ///   ::= identifierexpr
-      ///   ::= numberexpr
-      ///   ::= parenexpr
-      expression_t parsePrimaryExpression();
-      
-      /// unary operation
-      ///  ::= primary
-      ///  ::= '!' unary
-      expression_t parseUnary();
-      
-      /// binary operation
-      ///   ::= ('+' primary)*
-      expression_t parseBinOpRHS(int exprPrec, expression_t lhs);
-      
-      /// expression
-      ///   ::= primary binoprhs
-      ///
-      expression_t parseExpression();
-      
-      /// prototype
-      ///   ::= id '(' id* ')'
-      ///   ::= unary  LETTER number? (id)
-      ///   ::= binary LETTER number? (id, id)
-      prototype_t parsePrototype();
-      
-      /// definition ::= 'def' prototype expression
-      function_t parseDefinition();
-
-      /// toplevelexpr ::= expression
-      function_t parseTopLevelExpr();
-      
-      /// external ::= 'extern' prototype
-      prototype_t parseExtern();
-      
-      /// ifexpr ::= 'if' expression 'then' expression 'else' expression
-      expression_t parseIfExpr();
-      
-      /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
-      expression_t parseForExpr();
-      
-      /// varexpr ::= 'var' identifier ('=' expression)?
-      //  (',' identifier ('=' expression)?)* 'in' expression
-      expression_t parseVarExpr();
+      ///
+      /// options of the driver affecting parsing and code generation
+      ///
+      void setConfiguration(const driver::DriverConfiguration& cnf);
       
       ///
       /// Top Level parsing
@@ -125,15 +78,119 @@ namespace parser {
       
       void mainLoop();
       
+      ///
+      /// @brief: parse the token table in ranges on a thread pool, then code generate
+      ///         the items in source order. Falls back to mainLoop() without a token table
+      ///
+      void batchLoop();
+      
+      ///
+      /// @brief: write the profile of the definitions run (--profile-generate)
+      ///
+      void saveProfile();
+      
+      ///
+      /// @brief: calls and cache hits of the memoized definitions (--memoize)
+      ///
+      void reportMemoization();
+      
+   protected:
+      
+      int getOperatorPrecedence(unsigned char token) const override;
+      void setOperatorPrecedence(unsigned char token, int value) override;
+      
    private:
       
+      ///
+      /// @brief: range of the token table parsed by a worker, with the operator precedences
+      ///         in effect at its beginning
+      ///
+      struct ParseChunk
+      {
+         size_t begin;
+         size_t end;
+         precedence_table_t precedence;
+      };
+      
+      jit::JIT jitCompiler_; //first: the code generator optimizes for its target machine
       code_generator::CodeGeneratorImpl codeGenerator_;
-      jit::JIT jitCompiler_;
-
+      std::unique_ptr<jit::TieredCompiler> tieredCompiler_; //tiered mode only, stops before the jit goes
+      std::unique_ptr<jit::CallEvaluator> callEvaluator_;   //runs the pure calls with constant arguments
       
-      int curToken_;
       util::CompilerConfigurator configurator_;
-      std::unique_ptr<lexer::Lexer> lexer_;
+      driver::DriverConfiguration cnf_;
+      
+      optimizer::ASTOptimizer astOptimizer_;
+      optimizer::PurityAnalysis purity_;
+      optimizer::HashConsing hashConsing_{purity_};
+      
+      std::vector<std::string> pendingExpressions_; //whole file mode: names of the top level expressions
+      
+      ///
+      /// @brief: counters of a definition instrumented for the profile
+      ///
+      struct ProfiledDefinition
+      {
+         std::string counters;
+         optimizer::ProfileShape shape;
+      };
+      
+      optimizer::ProfileData profile_;
+      std::map<std::string, ProfiledDefinition> profiledDefinitions_;
+      unsigned profileVersion_ = 0;
+      
+      std::map<std::string, std::string> memoizedDefinitions_; //name, prefix of the globals of its cache
+      unsigned memoVersion_ = 0;
+      
+      ///
+      /// @brief: simplify the body of a parsed function (unless disabled), share its identical
+      ///         pure subexpressions (if enabled) and emit IR for it, through the flat representation
+      ///         if enabled
+      ///
+      llvm::Function* codeGenFunction(FunctionAST& function);
+      
+      ///
+      /// @brief: weight the unoptimized IR of a definition with its recorded profile and/or count
+      ///         its branches and calls, as configured
+      ///
+      void applyProfile(llvm::Function& definition);
+      
+      ///
+      /// @brief: put a cache of results in front of a pure definition with loops or recursion
+      ///
+      void memoizeDefinition(util::symbol_t symbol, llvm::Function& definition);
+      
+      ///
+      /// @brief: discard the module being generated when it doesn't verify: it is neither
+      ///         exported nor handed to the jit
+      ///
+      void dropModule();
+      
+      ///
+      /// @brief: keep the bodies of the functions defined in the module for the later modules
+      ///         (inlining, compile time evaluation)
+      ///
+      void exportDefinitions(const llvm::Module& module);
+      
+      ///
+      /// @brief: code generation of the parsed top level items
+      ///
+      void emitDefinition(FunctionAST& parsedDefinition);
+      void emitExtern(prototype_t& parsedExtern);
+      void emitTopLevelExpression(FunctionAST& parsedTopLevelExpr);
+      
+      ///
+      /// @brief: call the top level expression jit compiled under the name passed, print its value
+      ///
+      void evaluate(const std::string& name);
+      
+      ///
+      /// @brief: whole file mode: hand the module of the input to the jit, then evaluate its
+      ///         top level expressions in source order
+      ///
+      void emitWholeFile();
+      
+      std::vector<ParseChunk> splitTopLevelItems(size_t chunkCount) const;
       
    };
    
@@ -0,0 +1,243 @@
+//
+//  Profile.cpp
+//  Kaleidoscope-LLVM
+//
+//  execution profiles of the jit compiled definitions: counters in the IR, a file across sessions, weights in the IR
+//
+
+#include "Profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <utility>
+
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+
+namespace optimizer
+{
+   namespace
+   {
+      ///
+      /// @brief: conditional branches and calls (intrinsics aside) of the function, in IR order
+      ///
+      void collectSites(llvm::Function& function, std::vector<llvm::BranchInst*>& branches,
+                        std::vector<llvm::CallInst*>& calls)
+      {
+         for (auto& block : function)
+            for (auto& instruction : block)
+            {
+               if (auto branch = llvm::dyn_cast<llvm::BranchInst>(&instruction))
+               {
+                  if (branch->isConditional())
+                     branches.push_back(branch);
+               }
+               else if (auto call = llvm::dyn_cast<llvm::CallInst>(&instruction))
+               {
+                  if (!llvm::isa<llvm::IntrinsicInst>(call))
+                     calls.push_back(call);
+               }
+            }
+      }
+      
+      ///
+      /// @brief: branch weights are 32 bits, scale the counts of a branch down together. One is
+      ///         added to every weight: a count of zero is "rarely", not "never"
+      ///
+      std::pair<std::uint32_t, std::uint32_t> getBranchWeights(const BranchProfile& branch)
+      {
+         const auto taken = std::min(branch.taken, branch.executions);
+         const auto notTaken = branch.executions - taken;
+         const auto scale = std::max(taken, notTaken) / std::numeric_limits<std::uint32_t>::max() + 1;
+         return {static_cast<std::uint32_t>(taken / scale + 1), static_cast<std::uint32_t>(notTaken / scale + 1)};
+      }
+   }
+   
+   void emitCounterAdd(llvm::IRBuilder<>& builder, llvm::Value* counter, llvm::Value* amount)
+   {
+      auto count = builder.CreateLoad(counter);
+      count->setAtomic(llvm::AtomicOrdering::Monotonic);
+      count->setAlignment(8);
+      auto store = builder.CreateStore(builder.CreateAdd(count, amount), counter);
+      store->setAtomic(llvm::AtomicOrdering::Monotonic);
+      store->setAlignment(8);
+   }
+   
+   ProfileShape instrumentProfile(llvm::Function& function, const std::string& countersName)
+   {
+      std::vector<llvm::BranchInst*> branches;
+      std::vector<llvm::CallInst*> calls;
+      collectSites(function, branches, calls);
+      
+      //entries, then executions and taken of every branch, then calls
+      auto& module = *function.getParent();
+      auto int64 = llvm::Type::getInt64Ty(module.getContext());
+      auto countersType = llvm::ArrayType::get(int64, 1 + 2 * branches.size() + calls.size());
+      auto counters = new llvm::GlobalVariable(module, countersType, false, llvm::GlobalValue::ExternalLinkage,
+                                               llvm::ConstantAggregateZero::get(countersType), countersName);
+      counters->setAlignment(8);
+      
+      unsigned index = 0;
+      llvm::IRBuilder<> builder(&*function.getEntryBlock().getFirstInsertionPt());
+      auto counter = [&]() { return builder.CreateConstInBoundsGEP2_32(countersType, counters, 0, index++); };
+      
+      emitCounterAdd(builder, counter(), builder.getInt64(1));
+      for (auto branch : branches)
+      {
+         builder.SetInsertPoint(branch);
+         emitCounterAdd(builder, counter(), builder.getInt64(1));
+         emitCounterAdd(builder, counter(), builder.CreateZExt(branch->getCondition(), int64));
+      }
+      for (auto call : calls)
+      {
+         builder.SetInsertPoint(call);
+         emitCounterAdd(builder, counter(), builder.getInt64(1));
+      }
+      
+      return {static_cast<unsigned>(branches.size()), static_cast<unsigned>(calls.size())};
+   }
+   
+   FunctionProfile readProfile(const std::atomic<std::uint64_t>* counters, const ProfileShape& shape)
+   {
+      auto next = [&counters]() { return (counters++)->load(std::memory_order_relaxed); };
+      
+      FunctionProfile profile;
+      profile.entries = next();
+      for (unsigned i = 0; i < shape.branches; ++i)
+      {
+         const auto executions = next();
+         profile.branches.push_back({executions, next()});
+      }
+      for (unsigned i = 0; i < shape.calls; ++i)
+         profile.calls.push_back(next());
+      return profile;
+   }
+   
+   bool annotateProfile(llvm::Function& function, const FunctionProfile& profile, bool hot)
+   {
+      std::vector<llvm::BranchInst*> branches;
+      std::vector<llvm::CallInst*> calls;
+      collectSites(function, branches, calls);
+      if (branches.size() != profile.branches.size() || calls.size() != profile.calls.size())
+         return false;
+      
+      function.setEntryCount(profile.entries);
+      if (profile.entries == 0)
+         function.addFnAttr(llvm::Attribute::Cold);
+      else if (hot)
+         function.addFnAttr(llvm::Attribute::InlineHint);
+      
+      llvm::MDBuilder metadata(function.getContext());
+      for (size_t i = 0; i < branches.size(); ++i)
+      {
+         const auto weights = getBranchWeights(profile.branches[i]);
+         branches[i]->setMetadata(llvm::LLVMContext::MD_prof, metadata.createBranchWeights(weights.first, weights.second));
+      }
+      
+      //a call never made in a definition entered is on an error or rare path: not worth inlining
+      for (size_t i = 0; i < calls.size(); ++i)
+         if (profile.entries != 0 && profile.calls[i] == 0)
+         {
+            calls[i]->addAttribute(llvm::AttributeList::FunctionIndex, llvm::Attribute::Cold);
+            calls[i]->addAttribute(llvm::AttributeList::FunctionIndex, llvm::Attribute::NoInline);
+         }
+      return true;
+   }
+   
+   bool ProfileData::load(const std::string& path)
+   {
+      std::ifstream file(path);
+      if (!file)
+      {
+         std::cerr << "cannot read the profile " << path << "\n";
+         return false;
+      }
+      
+      functions_.clear();
+      FunctionProfile* current = nullptr;
+      std::string line;
+      for (unsigned number = 1; std::getline(file, line); ++number)
+      {
+         std::istringstream record(line);
+         std::string kind;
+         if (!(record >> kind))
+            continue;
+         
+         bool valid = false;
+         if (kind == "function")
+         {
+            std::string name;
+            FunctionProfile profile;
+            valid = static_cast<bool>(record >> name >> profile.entries);
+            if (valid)
+               current = &(functions_[name] = std::move(profile));
+         }
+         else if (kind == "branch" && current)
+         {
+            BranchProfile branch;
+            valid = static_cast<bool>(record >> branch.executions >> branch.taken);
+            if (valid)
+               current->branches.push_back(branch);
+         }
+         else if (kind == "call" && current)
+         {
+            std::uint64_t count;
+            valid = static_cast<bool>(record >> count);
+            if (valid)
+               current->calls.push_back(count);
+         }
+         
+         if (!valid)
+         {
+            std::cerr << path << ":" << number << ": malformed profile record\n";
+            functions_.clear();
+            return false;
+         }
+      }
+      return true;
+   }
+   
+   bool ProfileData::save(const std::string& path) const
+   {
+      std::ofstream file(path);
+      for (const auto& function : functions_)
+      {
+         file << "function " << function.first << " " << function.second.entries << "\n";
+         for (const auto& branch : function.second.branches)
+            file << "branch " << branch.executions << " " << branch.taken << "\n";
+         for (const auto count : function.second.calls)
+            file << "call " << count << "\n";
+      }
+      
+      if (!file)
+      {
+         std::cerr << "cannot write the profile " << path << "\n";
+         return false;
+      }
+      return true;
+   }
+   
+   void ProfileData::add(const std::string& name, FunctionProfile profile)
+   {
+      functions_[name] = std::move(profile);
+   }
+   
+   const FunctionProfile* ProfileData::find(const std::string& name) const
+   {
+      const auto function = functions_.find(name);
+      return function != functions_.end() ? &function->second : nullptr;
+   }
+   
+   bool ProfileData::isHot(const FunctionProfile& profile) const
+   {
+      std::uint64_t maxEntries = 0;
+      for (const auto& function : functions_)
+         maxEntries = std::max(maxEntries, function.second.entries);
+      return profile.entries != 0 && profile.entries >= maxEntries / 100;
+   }
+}
@@ -0,0 +1,112 @@
+//
+//  Profile.h
+//  Kaleidoscope-LLVM
+//
+//  execution profiles of the jit compiled definitions: counters in the IR, a file across sessions, weights in the IR
+//
+
+#ifndef Profile_h
+#define Profile_h
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/IRBuilder.h"
+
+namespace llvm {
+   class Function;
+}
+
+namespace optimizer
+{
+   ///
+   /// @brief: a conditional branch (an 'if', the end test of a 'for'): the trip count of a loop
+   ///         is taken / (executions - taken) of its end test
+   ///
+   struct BranchProfile
+   {
+      std::uint64_t executions;
+      std::uint64_t taken;      //to the first successor, the 'then' block or the loop body
+   };
+   
+   ///
+   /// @brief: counts of a definition. Branches and calls are numbered in the order of the IR
+   ///         generated for the definition, before any optimization: the same source with the
+   ///         same options numbers them the same way in every session
+   ///
+   struct FunctionProfile
+   {
+      std::uint64_t entries = 0;
+      std::vector<BranchProfile> branches;
+      std::vector<std::uint64_t> calls;
+   };
+   
+   ///
+   /// @brief: counters added to a definition by instrumentProfile
+   ///
+   struct ProfileShape
+   {
+      unsigned branches;
+      unsigned calls;
+   };
+   
+   ///
+   /// @brief: counter += amount before the insertion point. Relaxed atomics: the counters are read
+   ///         by other threads, a lost update only makes a count slightly low
+   ///
+   void emitCounterAdd(llvm::IRBuilder<>& builder, llvm::Value* counter, llvm::Value* amount);
+   
+   ///
+   /// @brief: count the entries, the branches taken and the calls of an unoptimized definition
+   ///         in a global array of the module named countersName
+   ///
+   ProfileShape instrumentProfile(llvm::Function& function, const std::string& countersName);
+   
+   ///
+   /// @brief: snapshot of the counters of a definition instrumented with shape
+   ///
+   FunctionProfile readProfile(const std::atomic<std::uint64_t>* counters, const ProfileShape& shape);
+   
+   ///
+   /// @brief: give an unoptimized definition its profile: entry count, branch weights (the block
+   ///         placement moves the cold blocks out of the hot path), 'cold' on the calls never made
+   ///         and the definitions never entered, 'inlinehint' on the hot definitions. False when the
+   ///         definition changed since the profile was recorded
+   ///
+   bool annotateProfile(llvm::Function& function, const FunctionProfile& profile, bool hot);
+   
+   ///
+   /// @brief: profiles of the definitions of a session, by name
+   ///
+   class ProfileData
+   {
+   public:
+      
+      ///
+      /// @brief: text format, one line per record:
+      ///         function <name> <entries> | branch <executions> <taken> | call <count>
+      ///
+      bool load(const std::string& path);
+      bool save(const std::string& path) const;
+      
+      ///
+      /// @brief: a redefinition replaces the profile of the previous one
+      ///
+      void add(const std::string& name, FunctionProfile profile);
+      const FunctionProfile* find(const std::string& name) const;
+      
+      ///
+      /// @brief: entered at least 1% as often as the most entered definition
+      ///
+      bool isHot(const FunctionProfile& profile) const;
+   
+   private:
+      
+      std::map<std::string, FunctionProfile> functions_;
+   };
+}
+
+#endif /* Profile_h */
@@ -0,0 +1,296 @@
+//
+//  Purity.cpp
+//  Kaleidoscope-LLVM
+//
+//  functions known to have no side effects: their calls can be shared, memoized or evaluated early
+//
+
+#include "Purity.h"
+
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/Support/Casting.h"
+
+#include "Builtins.h"
+
+using namespace AST;
+
+namespace optimizer
+{
+   namespace
+   {
+      ///
+      /// @brief: libm functions without side effects (errno aside, which Kaleidoscope can't read)
+      ///
+      bool isPureLibraryFunction(llvm::StringRef name)
+      {
+         return llvm::StringSwitch<bool>(name)
+            .Cases("sin", "cos", "tan", "asin", "acos", true)
+            .Cases("atan", "atan2", "sinh", "cosh", "tanh", true)
+            .Cases("exp", "exp2", "log", "log2", "log10", true)
+            .Cases("sqrt", "cbrt", "pow", "fabs", "hypot", true)
+            .Cases("floor", "ceil", "round", "trunc", "fmod", true)
+            .Cases("fmin", "fmax", true)
+            .Default(false);
+      }
+      
+      bool isBuiltinOperator(unsigned char op)
+      {
+         return op == '+' || op == '-' || op == '*' || op == '<' || op == '=';
+      }
+      
+      ///
+      /// @brief: a builtin is expanded in a few instructions, a call costs its arguments,
+      ///         the call itself and the body if it is inlined
+      ///
+      const unsigned builtinCost = 1;
+      const unsigned callCost = 4;
+   }
+   
+   void PurityAnalysis::classifyDefinition(const FunctionAST& function)
+   {
+      const auto name = function.getPrototype()->getSymbol();
+      pending_.name = name;
+      pending_.pure = callsOnlyPureFunctions(function.getBody(), name);
+      
+      //a self call is not speculatable yet: recursive functions are left out
+      pending_.speculatable = false;
+      pending_.speculatable = pending_.pure && getSpeculationCost(function.getBody());
+   }
+   
+   void PurityAnalysis::addDefinition()
+   {
+      const auto name = pending_.name;
+      if (name == util::StringInterner::invalidSymbol)
+         return;
+      
+      userFunctions_.insert(name);
+      if (pending_.pure)
+         pureFunctions_.insert(name);
+      else
+         pureFunctions_.erase(name);
+      if (pending_.speculatable)
+         speculatableFunctions_.insert(name);
+      else
+         speculatableFunctions_.erase(name);
+      discardDefinition();
+   }
+   
+   void PurityAnalysis::discardDefinition()
+   {
+      pending_ = Classification();
+   }
+   
+   void PurityAnalysis::addExtern(const PrototypeAST& prototype)
+   {
+      userFunctions_.insert(prototype.getSymbol());
+      if (isPureLibraryFunction(prototype.getName()))
+      {
+         pureFunctions_.insert(prototype.getSymbol());
+         speculatableFunctions_.insert(prototype.getSymbol());
+      }
+   }
+   
+   bool PurityAnalysis::isPureFunction(util::symbol_t name) const
+   {
+      if (name == pending_.name)
+         return pending_.pure;
+      if (pureFunctions_.count(name))
+         return true;
+      return !userFunctions_.count(name) && getBuiltin(name) != Builtin::None;
+   }
+   
+   bool PurityAnalysis::isSpeculatableFunction(util::symbol_t name) const
+   {
+      if (name == pending_.name)
+         return pending_.speculatable;
+      if (speculatableFunctions_.count(name))
+         return true;
+      return !userFunctions_.count(name) && getBuiltin(name) != Builtin::None;
+   }
+   
+   llvm::Optional<unsigned> PurityAnalysis::getSpeculatedCallCost(util::symbol_t name) const
+   {
+      if (!isSpeculatableFunction(name))
+         return llvm::None;
+      return name == pending_.name || speculatableFunctions_.count(name) ? callCost : builtinCost;
+   }
+   
+   bool PurityAnalysis::isPureCallee(util::symbol_t name, util::symbol_t self) const
+   {
+      return name == self || isPureFunction(name);
+   }
+   
+   bool PurityAnalysis::callsOnlyPureFunctions(const ExprAST* expression, util::symbol_t self) const
+   {
+      if (!expression)
+         return true;
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+         case ExprKind::Variable:
+            return true;
+         
+         case ExprKind::Unary:
+         {
+            auto unary = llvm::cast<UnaryExprAST>(expression);
+            return isPureCallee(operatorSymbol("unary", unary->getOpcode()), self) &&
+                   callsOnlyPureFunctions(unary->getOperand(), self);
+         }
+         
+         case ExprKind::Binary:
+         {
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            const auto op = binary->getOpcode();
+            return (isBuiltinOperator(op) || isPureCallee(operatorSymbol("binary", op), self)) &&
+                   callsOnlyPureFunctions(binary->getLeftOperand(), self) &&
+                   callsOnlyPureFunctions(binary->getRightOperand(), self);
+         }
+         
+         case ExprKind::Call:
+         {
+            auto call = llvm::cast<CallExprAST>(expression);
+            if (!isPureCallee(call->getCallee(), self))
+               return false;
+            for (auto arg : call->getArgumentList())
+               if (!callsOnlyPureFunctions(arg, self))
+                  return false;
+            return true;
+         }
+         
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            return callsOnlyPureFunctions(ifExpr->getCondion(), self) &&
+                   callsOnlyPureFunctions(ifExpr->getThenBranch(), self) &&
+                   callsOnlyPureFunctions(ifExpr->getElseBranch(), self);
+         }
+         
+         case ExprKind::For:
+         {
+            auto forExpr = llvm::cast<ForExprAST>(expression);
+            return callsOnlyPureFunctions(forExpr->getStart(), self) &&
+                   callsOnlyPureFunctions(forExpr->getEnd(), self) &&
+                   callsOnlyPureFunctions(forExpr->getStep(), self) &&
+                   callsOnlyPureFunctions(forExpr->getBody(), self);
+         }
+         
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            for (const auto& variable : varExpr->getVarNames())
+               if (!callsOnlyPureFunctions(variable.init, self))
+                  return false;
+            return callsOnlyPureFunctions(varExpr->getBody(), self);
+         }
+         
+         //arrays are memory shared with the caller
+         case ExprKind::Index:
+            return false;
+         
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      return false;
+   }
+   
+   llvm::Optional<unsigned> PurityAnalysis::getSpeculationCost(const ExprAST* expression) const
+   {
+      if (!expression)
+         return 0u;
+      
+      //cost of a call to the function passed with the operands passed
+      auto callCostOf = [this](util::symbol_t name,
+                               llvm::ArrayRef<const ExprAST*> operands) -> llvm::Optional<unsigned> {
+         auto cost = getSpeculatedCallCost(name);
+         if (!cost)
+            return llvm::None;
+         
+         for (auto operand : operands)
+         {
+            auto operandCost = getSpeculationCost(operand);
+            if (!operandCost)
+               return llvm::None;
+            *cost += *operandCost;
+         }
+         return cost;
+      };
+      
+      switch (expression->getKind())
+      {
+         case ExprKind::Number:
+            return 0u;
+         
+         case ExprKind::Variable:
+            return 1u;
+         
+         case ExprKind::Unary:
+         {
+            auto unary = llvm::cast<UnaryExprAST>(expression);
+            return callCostOf(operatorSymbol("unary", unary->getOpcode()), {unary->getOperand()});
+         }
+         
+         case ExprKind::Binary:
+         {
+            auto binary = llvm::cast<BinaryExprAST>(expression);
+            const auto op = binary->getOpcode();
+            if (op == '=')
+               return llvm::None;
+            if (!isBuiltinOperator(op))
+               return callCostOf(operatorSymbol("binary", op), {binary->getLeftOperand(), binary->getRightOperand()});
+            
+            auto lhs = getSpeculationCost(binary->getLeftOperand());
+            auto rhs = getSpeculationCost(binary->getRightOperand());
+            if (!lhs || !rhs)
+               return llvm::None;
+            return *lhs + *rhs + 1;
+         }
+         
+         case ExprKind::Call:
+         {
+            auto call = llvm::cast<CallExprAST>(expression);
+            return callCostOf(call->getCallee(), call->getArgumentList());
+         }
+         
+         //both branches are evaluated, plus the select
+         case ExprKind::If:
+         {
+            auto ifExpr = llvm::cast<IfExprAST>(expression);
+            auto cond = getSpeculationCost(ifExpr->getCondion());
+            auto thenBranch = getSpeculationCost(ifExpr->getThenBranch());
+            auto elseBranch = getSpeculationCost(ifExpr->getElseBranch());
+            if (!cond || !thenBranch || !elseBranch)
+               return llvm::None;
+            return *cond + *thenBranch + *elseBranch + 1;
+         }
+         
+         //the variables are local: the bindings of an operator expanded inline can be evaluated
+         case ExprKind::Var:
+         {
+            auto varExpr = llvm::cast<VarExprAST>(expression);
+            unsigned cost = 0;
+            for (const auto& variable : varExpr->getVarNames())
+            {
+               auto init = getSpeculationCost(variable.init);
+               if (!init)
+                  return llvm::None;
+               cost += *init;
+            }
+            auto body = getSpeculationCost(varExpr->getBody());
+            if (!body)
+               return llvm::None;
+            return cost + *body;
+         }
+         
+         case ExprKind::For:
+         case ExprKind::Index:
+         case ExprKind::Prototype:
+         case ExprKind::Function:
+            break;
+      }
+      
+      return llvm::None;
+   }
+}
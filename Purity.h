@@ -0,0 +1,93 @@
+//
+//  Purity.h
+//  Kaleidoscope-LLVM
+//
+//  functions known to have no side effects: their calls can be shared, memoized or evaluated early
+//
+
+#ifndef Purity_h
+#define Purity_h
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Optional.h"
+
+#include "AST.h"
+#include "Interner.h"
+
+namespace optimizer
+{
+   ///
+   /// @brief: tracks the functions of the session that are pure: same arguments, same result, no
+   ///         effect visible to the caller. Variables are local to a function, so a definition is
+   ///         pure when every call in its body (user defined operators included) targets a pure
+   ///         function. Externs are pure only for a list of well known math functions, builtins
+   ///         are pure unless the program defines a function of the same name.
+   ///         Termination is not checked, like for the 'pure' attribute of C compilers
+   ///
+   class PurityAnalysis
+   {
+   public:
+      
+      ///
+      /// @brief: classify a definition before its code generation, which takes its prototype.
+      ///         Until addDefinition, the classification is seen by the self calls of its body
+      ///         only: a definition failing code generation changes nothing
+      ///
+      void classifyDefinition(const AST::FunctionAST& function);
+      
+      ///
+      /// @brief: record the classification of the definition just generated, a redefinition
+      ///         replaces the previous classification. Or drop it, the definition failed
+      ///
+      void addDefinition();
+      void discardDefinition();
+      void addExtern(const AST::PrototypeAST& prototype);
+      
+      bool isPureFunction(util::symbol_t name) const;
+      
+      ///
+      /// @brief: every call in the expression targets a pure function (self calls of
+      ///         the function being classified count as pure)
+      ///
+      bool callsOnlyPureFunctions(const AST::ExprAST* expression,
+                                  util::symbol_t self = util::StringInterner::invalidSymbol) const;
+      
+      ///
+      /// @brief: a call can be evaluated when its result is not needed: the function is pure,
+      ///         straight line (no loop, no recursion) and only calls speculatable functions
+      ///
+      bool isSpeculatableFunction(util::symbol_t name) const;
+      
+      ///
+      /// @brief: cost of the call itself (arguments excluded) to a speculatable function, None
+      ///         for the other functions
+      ///
+      llvm::Optional<unsigned> getSpeculatedCallCost(util::symbol_t name) const;
+      
+      ///
+      /// @brief: rough count of the instructions evaluating the expression unconditionally (a
+      ///         branch of an 'if' lowered to a select), None when that could change the program:
+      ///         assignments, array reads (guarded by a bounds test), loops and calls to functions
+      ///         that are not speculatable
+      ///
+      llvm::Optional<unsigned> getSpeculationCost(const AST::ExprAST* expression) const;
+   
+   private:
+      
+      llvm::DenseSet<util::symbol_t> pureFunctions_;
+      llvm::DenseSet<util::symbol_t> speculatableFunctions_;
+      llvm::DenseSet<util::symbol_t> userFunctions_; //defined or declared: they hide the builtins
+      
+      struct Classification
+      {
+         util::symbol_t name = util::StringInterner::invalidSymbol;
+         bool pure = false;
+         bool speculatable = false;
+      };
+      Classification pending_; //definition being generated
+      
+      bool isPureCallee(util::symbol_t name, util::symbol_t self) const;
+   };
+}
+
+#endif /* Purity_h */
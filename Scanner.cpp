@@ -0,0 +1,262 @@
+//
+//  Scanner.cpp
+//  Kaleidoscope-LLVM
+//
+//  character class scanning used by the lexer (SSE2/AVX2 with scalar fallback)
+//
+
+#include "Scanner.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace lexer
+{
+   namespace scan
+   {
+      namespace
+      {
+         ///
+         /// @brief: vector operations, one struct per instruction set
+         ///
+#if defined(__SSE2__)
+         struct Sse2
+         {
+            using vector_t = __m128i;
+            static const std::ptrdiff_t width = 16;
+            
+            static vector_t load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+            static vector_t splat(char c) { return _mm_set1_epi8(c); }
+            static vector_t equal(vector_t a, vector_t b) { return _mm_cmpeq_epi8(a, b); }
+            static vector_t either(vector_t a, vector_t b) { return _mm_or_si128(a, b); }
+            static vector_t sub(vector_t a, vector_t b) { return _mm_sub_epi8(a, b); }
+            // unsigned a <= b, lane by lane
+            static vector_t lessEqual(vector_t a, vector_t b) { return _mm_cmpeq_epi8(_mm_min_epu8(a, b), a); }
+            static std::uint32_t mask(vector_t a) { return static_cast<std::uint32_t>(_mm_movemask_epi8(a)); }
+            static const std::uint32_t all = 0xFFFFu;
+         };
+#endif
+         
+#if defined(__AVX2__)
+         struct Avx2
+         {
+            using vector_t = __m256i;
+            static const std::ptrdiff_t width = 32;
+            
+            static vector_t load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+            static vector_t splat(char c) { return _mm256_set1_epi8(c); }
+            static vector_t equal(vector_t a, vector_t b) { return _mm256_cmpeq_epi8(a, b); }
+            static vector_t either(vector_t a, vector_t b) { return _mm256_or_si256(a, b); }
+            static vector_t sub(vector_t a, vector_t b) { return _mm256_sub_epi8(a, b); }
+            static vector_t lessEqual(vector_t a, vector_t b) { return _mm256_cmpeq_epi8(_mm256_min_epu8(a, b), a); }
+            static std::uint32_t mask(vector_t a) { return static_cast<std::uint32_t>(_mm256_movemask_epi8(a)); }
+            static const std::uint32_t all = 0xFFFFFFFFu;
+         };
+#endif
+         
+         ///
+         /// @brief: character classes, each one with a scalar and a vector test.
+         ///         An inverted class has a vector test matching the characters outside of it
+         ///
+         struct Whitespace
+         {
+            static const bool inverted = false;
+            
+            static bool test(unsigned char c) { return c == ' ' || static_cast<unsigned char>(c - '\t') <= 4; }
+            
+            template <typename V>
+            static typename V::vector_t test(typename V::vector_t c)
+            {
+               return V::either(V::equal(c, V::splat(' ')),
+                                V::lessEqual(V::sub(c, V::splat('\t')), V::splat(4)));
+            }
+         };
+         
+         struct NotNewline
+         {
+            static bool test(unsigned char c) { return c != '\n' && c != '\r'; }
+            
+            static const bool inverted = true;
+            
+            template <typename V>
+            static typename V::vector_t test(typename V::vector_t c)
+            {
+               return V::either(V::equal(c, V::splat('\n')), V::equal(c, V::splat('\r')));
+            }
+         };
+         
+         struct Alphanumeric
+         {
+            static const bool inverted = false;
+            
+            static bool test(unsigned char c)
+            {
+               return static_cast<unsigned char>(c - '0') <= 9 || static_cast<unsigned char>((c | 0x20) - 'a') <= 25;
+            }
+            
+            template <typename V>
+            static typename V::vector_t test(typename V::vector_t c)
+            {
+               auto lower = V::either(c, V::splat(0x20));
+               return V::either(V::lessEqual(V::sub(c, V::splat('0')), V::splat(9)),
+                                V::lessEqual(V::sub(lower, V::splat('a')), V::splat(25)));
+            }
+         };
+         
+         struct NumberChar
+         {
+            static const bool inverted = false;
+            
+            static bool test(unsigned char c) { return static_cast<unsigned char>(c - '0') <= 9 || c == '.'; }
+            
+            template <typename V>
+            static typename V::vector_t test(typename V::vector_t c)
+            {
+               return V::either(V::lessEqual(V::sub(c, V::splat('0')), V::splat(9)),
+                                V::equal(c, V::splat('.')));
+            }
+         };
+         
+         ///
+         /// @brief: skip whole vectors of characters of class C, stops at the first vector containing a
+         ///         character outside the class (returning its position) or when less than a vector is left
+         ///
+         template <typename V, typename C>
+         const char* scanBlocks(const char* p, const char* end)
+         {
+            while (end - p >= V::width)
+            {
+               auto inClass = V::mask(C::template test<V>(V::load(p)));
+               if (C::inverted)
+                  inClass = ~inClass & V::all;
+               
+               if (inClass != V::all)
+                  return p + __builtin_ctz(~inClass);
+               
+               p += V::width;
+            }
+            
+            return p;
+         }
+         
+         template <typename C>
+         const char* scanRun(const char* p, const char* end)
+         {
+#if defined(__AVX2__)
+            p = scanBlocks<Avx2, C>(p, end);
+#endif
+#if defined(__SSE2__)
+            p = scanBlocks<Sse2, C>(p, end);
+#endif
+            while (p != end && C::test(static_cast<unsigned char>(*p)))
+               ++p;
+            
+            return p;
+         }
+         
+         bool isDigit(char c)
+         {
+            return static_cast<unsigned char>(c - '0') <= 9;
+         }
+         
+         ///
+         /// @brief: exact powers of ten representable as doubles
+         ///
+         const double powersOfTen[] = {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+         };
+         
+         const int maxFastPathDigits = 19;
+         const int maxFastPathExponent = 22;
+         const std::uint64_t maxExactMantissa = std::uint64_t(1) << 53;
+         
+         double parseSlow(const char* begin, const char* end)
+         {
+            char buffer[128];
+            std::size_t length = end - begin;
+            if (length < sizeof(buffer))
+            {
+               std::memcpy(buffer, begin, length);
+               buffer[length] = '\0';
+               return std::strtod(buffer, nullptr);
+            }
+            
+            return std::strtod(std::string(begin, end).c_str(), nullptr);
+         }
+      }
+      
+      const char* skipWhitespace(const char* begin, const char* end)
+      {
+         return scanRun<Whitespace>(begin, end);
+      }
+      
+      const char* skipLine(const char* begin, const char* end)
+      {
+         return scanRun<NotNewline>(begin, end);
+      }
+      
+      const char* scanIdentifier(const char* begin, const char* end)
+      {
+         return scanRun<Alphanumeric>(begin, end);
+      }
+      
+      const char* scanNumber(const char* begin, const char* end)
+      {
+         return scanRun<NumberChar>(begin, end);
+      }
+      
+      double parseNumber(const char* begin, const char* end)
+      {
+         std::uint64_t mantissa = 0;
+         int digits = 0;          //significant digits accumulated in mantissa
+         int fractionDigits = 0;  //digits after the '.'
+         
+         const char* p = begin;
+         for (; p != end && isDigit(*p); ++p)
+         {
+            if (mantissa == 0 && *p == '0')
+               continue;
+            if (digits == maxFastPathDigits)
+               return parseSlow(begin, end);
+            
+            mantissa = mantissa * 10 + (*p - '0');
+            ++digits;
+         }
+         
+         //strtod stops at the second '.', so does the literal
+         if (p != end && *p == '.')
+         {
+            for (++p; p != end && isDigit(*p); ++p)
+            {
+               ++fractionDigits;
+               if (mantissa == 0 && *p == '0')
+                  continue;
+               if (digits == maxFastPathDigits)
+                  return parseSlow(begin, end);
+               
+               mantissa = mantissa * 10 + (*p - '0');
+               ++digits;
+            }
+         }
+         
+         //integer conversion is correctly rounded
+         if (fractionDigits == 0 || mantissa == 0)
+            return static_cast<double>(mantissa);
+         
+         //both operands exact: the division is correctly rounded (Clinger's fast path)
+         if (mantissa <= maxExactMantissa && fractionDigits <= maxFastPathExponent)
+            return static_cast<double>(mantissa) / powersOfTen[fractionDigits];
+         
+         return parseSlow(begin, end);
+      }
+   }
+}
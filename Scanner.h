@@ -0,0 +1,41 @@
+//
+//  Scanner.h
+//  Kaleidoscope-LLVM
+//
+//  character class scanning used by the lexer (SSE2/AVX2 with scalar fallback)
+//
+
+#ifndef Scanner_h
+#define Scanner_h
+
+namespace lexer
+{
+   namespace scan
+   {
+      ///
+      /// @brief: every routine scans the range [begin, end) and returns a pointer to the first
+      ///         character that does not belong to the run (end if the whole range does)
+      ///
+      
+      /// whitespace as in isspace() for the "C" locale
+      const char* skipWhitespace(const char* begin, const char* end);
+      
+      /// body of a comment, stops on '\n' or '\r'
+      const char* skipLine(const char* begin, const char* end);
+      
+      /// identifier characters [a-zA-Z0-9]
+      const char* scanIdentifier(const char* begin, const char* end);
+      
+      /// numeric literal characters [0-9.]
+      const char* scanNumber(const char* begin, const char* end);
+      
+      ///
+      /// @brief: value of the numeric literal [begin, end) as strtod would return it, correctly rounded.
+      ///         Literals with up to 19 significant digits and 22 fractional digits take an exact
+      ///         integer fast path, the others fall back to strtod on a stack copy
+      ///
+      double parseNumber(const char* begin, const char* end);
+   }
+}
+
+#endif /* Scanner_h */
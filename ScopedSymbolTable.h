@@ -0,0 +1,104 @@
+//
+//  ScopedSymbolTable.h
+//  Kaleidoscope-LLVM
+//
+//  lexical scopes of a function body as a flat stack of bindings
+//
+
+#ifndef ScopedSymbolTable_h
+#define ScopedSymbolTable_h
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Interner.h"
+
+namespace util
+{
+   using slot_t = std::uint32_t;
+   
+   const slot_t noSlot = ~0u;
+   
+   ///
+   /// @brief: bindings of the scopes open at a point of a function body, innermost last.
+   ///         A binding is identified by its slot, the position in the stack: the slots of a body
+   ///         only depend on its structure, so they can be resolved once before code generation
+   ///         and used for O(1) lookups. Closing a scope truncates the stack, shadowed bindings
+   ///         become visible again without being saved and restored
+   ///
+   template <typename Value>
+   class ScopedSymbolTable
+   {
+   public:
+      
+      void clear()
+      {
+         bindings_.clear();
+         scopes_.clear();
+      }
+      
+      void pushScope()
+      {
+         scopes_.push_back(bindings_.size());
+      }
+      
+      void popScope()
+      {
+         assert(!scopes_.empty() && "no scope to close");
+         bindings_.resize(scopes_.back());
+         scopes_.pop_back();
+      }
+      
+      ///
+      /// @brief: bind a name in the innermost scope, return its slot
+      ///
+      slot_t bind(symbol_t name, Value value)
+      {
+         bindings_.emplace_back(name, value);
+         return static_cast<slot_t>(bindings_.size() - 1);
+      }
+      
+      ///
+      /// @brief: slot of the innermost binding of the name, noSlot if it is not bound.
+      ///         Scopes are shallow, a backward scan beats hashing
+      ///
+      slot_t lookup(symbol_t name) const
+      {
+         for (auto slot = bindings_.size(); slot != 0; --slot)
+            if (bindings_[slot - 1].first == name)
+               return static_cast<slot_t>(slot - 1);
+         return noSlot;
+      }
+      
+      ///
+      /// @brief: the slot resolved for the name, if it is still bound to it; otherwise the slot
+      ///         of the innermost binding of the name
+      ///
+      slot_t lookup(symbol_t name, slot_t resolved) const
+      {
+         if (resolved < bindings_.size() && bindings_[resolved].first == name)
+            return resolved;
+         return lookup(name);
+      }
+      
+      Value& getValue(slot_t slot)
+      {
+         assert(slot < bindings_.size() && "slot out of scope");
+         return bindings_[slot].second;
+      }
+      
+      slot_t size() const
+      {
+         return static_cast<slot_t>(bindings_.size());
+      }
+   
+   private:
+      
+      std::vector<std::pair<symbol_t, Value>> bindings_;
+      std::vector<std::size_t> scopes_; //size of the stack when each scope was opened
+   };
+}
+
+#endif /* ScopedSymbolTable_h */
@@ -0,0 +1,129 @@
+//
+//  SlotResolver.cpp
+//  Kaleidoscope-LLVM
+//
+//  resolution of the variable references of a function body to scope slots
+//
+
+#include "SlotResolver.h"
+
+#include "llvm/Support/Casting.h"
+
+#include "ScopedSymbolTable.h"
+
+namespace AST
+{
+   namespace
+   {
+      ///
+      /// @brief: walks the body opening and closing scopes like the code generator.
+      ///         The value of a binding is the node introducing it (nullptr for arguments)
+      ///
+      class Resolver
+      {
+      public:
+         
+         void resolve(FunctionAST& function)
+         {
+            for (auto arg : function.getPrototype()->getArgumentList())
+               scopes_.bind(arg, nullptr);
+            visit(function.getBody());
+         }
+      
+      private:
+         
+         util::ScopedSymbolTable<const ExprAST*> scopes_;
+         
+         void visit(ExprAST* expression)
+         {
+            if (!expression)
+               return;
+            
+            switch (expression->getKind())
+            {
+               case ExprKind::Number:
+                  break;
+               
+               case ExprKind::Variable:
+               {
+                  auto variable = llvm::cast<VariableExprAST>(expression);
+                  variable->setSlot(scopes_.lookup(variable->getSymbol()));
+                  break;
+               }
+               
+               case ExprKind::Unary:
+                  visit(llvm::cast<UnaryExprAST>(expression)->getOperand());
+                  break;
+               
+               case ExprKind::Binary:
+               {
+                  auto binary = llvm::cast<BinaryExprAST>(expression);
+                  visit(binary->getLeftOperand());
+                  visit(binary->getRightOperand());
+                  break;
+               }
+               
+               case ExprKind::Call:
+                  for (auto arg : llvm::cast<CallExprAST>(expression)->getArgumentList())
+                     visit(arg);
+                  break;
+               
+               case ExprKind::If:
+               {
+                  auto ifExpr = llvm::cast<IfExprAST>(expression);
+                  visit(ifExpr->getCondion());
+                  visit(ifExpr->getThenBranch());
+                  visit(ifExpr->getElseBranch());
+                  break;
+               }
+               
+               case ExprKind::For:
+               {
+                  auto forExpr = llvm::cast<ForExprAST>(expression);
+                  visit(forExpr->getStart());
+                  
+                  scopes_.pushScope();
+                  scopes_.bind(forExpr->getKey(), forExpr);
+                  visit(forExpr->getBody());
+                  visit(forExpr->getStep());
+                  visit(forExpr->getEnd());
+                  scopes_.popScope();
+                  break;
+               }
+               
+               case ExprKind::Var:
+               {
+                  auto varExpr = llvm::cast<VarExprAST>(expression);
+                  
+                  scopes_.pushScope();
+                  for (const auto& variable : varExpr->getVarNames())
+                  {
+                     visit(variable.init);
+                     scopes_.bind(variable.name, varExpr);
+                  }
+                  visit(varExpr->getBody());
+                  scopes_.popScope();
+                  break;
+               }
+               
+               case ExprKind::Index:
+               {
+                  auto index = llvm::cast<IndexExprAST>(expression);
+                  visit(index->getArray());
+                  visit(index->getIndex());
+                  break;
+               }
+               
+               case ExprKind::Prototype:
+               case ExprKind::Function:
+                  break;
+            }
+         }
+      };
+   }
+   
+   void resolveSlots(FunctionAST& function)
+   {
+      Resolver().resolve(function);
+   }
+}
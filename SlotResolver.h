@@ -0,0 +1,26 @@
+//
+//  SlotResolver.h
+//  Kaleidoscope-LLVM
+//
+//  resolution of the variable references of a function body to scope slots
+//
+
+#ifndef SlotResolver_h
+#define SlotResolver_h
+
+#include "AST.h"
+
+namespace AST
+{
+   ///
+   /// @brief: set the slot of every variable reference (and assignment destination) of the body:
+   ///         the position of its binding in the scope stack the code generator builds.
+   ///         Arguments are bound first, a 'var' binds its names one after the other (an initializer
+   ///         sees the names before it), a 'for' binds its variable for the end, step and body.
+   ///         References to unbound names are left unresolved and reported by the code generator.
+   ///         Must run after the last transformation of the tree, right before code generation
+   ///
+   void resolveSlots(FunctionAST& function);
+}
+
+#endif /* SlotResolver_h */
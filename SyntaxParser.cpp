@@ -0,0 +1,732 @@
+//
+//  SyntaxParser.cpp
+//  Kaleidoscope-LLVM
+//
+//  syntax only part of the parser: builds the AST of the top level items without generating code,
+//  so that independent ranges of a token table can be parsed concurrently
+//
+
+#include "SyntaxParser.h"
+
+#include "llvm/ADT/STLExtras.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace lexer;
+
+namespace parser
+{
+   using ArgsExpr_t = std::vector<ExprAST*>;
+   using ArgsStr_t = std::vector<util::symbol_t>;
+   
+   ///
+   /// @brief: construct a parser on top of the lexer passed (i.e. reading a source file)
+   ///
+   SyntaxParser::SyntaxParser(std::unique_ptr<lexer::Lexer> lexer) :
+   curToken_(0),
+   lexer_(std::move(lexer)),
+   tokens_(nullptr),
+   tokenIndex_(noToken),
+   tokenEnd_(0),
+   errorStream_(&std::cerr)
+   {}
+   
+   ///
+   /// @brief: construct a parser walking a token table lexed up front
+   ///
+   SyntaxParser::SyntaxParser(std::unique_ptr<lexer::TokenTable> tokens) :
+   SyntaxParser(*tokens, 0, tokens->size() - 1)
+   {
+      ownedTokens_ = std::move(tokens);
+   }
+   
+   ///
+   /// @brief: construct a parser walking a range of a token table
+   ///
+   SyntaxParser::SyntaxParser(const lexer::TokenTable& tokens, size_t begin, size_t end) :
+   curToken_(0),
+   tokens_(&tokens),
+   tokenIndex_(begin - 1), //noToken for the first range, the first getNextToken() moves to begin
+   tokenEnd_(end),
+   errorStream_(&std::cerr)
+   {
+      assert(begin <= end && end < tokens.size());
+   }
+   
+   int SyntaxParser::getOperatorPrecedence(unsigned char token) const
+   {
+      auto it = precedence_.find(token);
+      return it != precedence_.end() ? it->second : -1;
+   }
+   
+   void SyntaxParser::setOperatorPrecedence(unsigned char token, int value)
+   {
+      precedence_[token] = value;
+   }
+   
+   int SyntaxParser::getNextToken()
+   {
+      if (tokens_)
+      {
+         //tokenEnd_ reads as tok_eof, stay there
+         if (tokenIndex_ + 1 < tokenEnd_)
+            ++tokenIndex_;
+         else
+            tokenIndex_ = tokenEnd_;
+         curToken_ = tokenIndex_ < tokenEnd_ ? tokens_->getKind(tokenIndex_) : lexer::tok_eof;
+         return curToken_;
+      }
+      
+      curToken_ = lexer_->gettok();
+      return curToken_;
+   }
+   
+   int SyntaxParser::peekToken(size_t distance) const
+   {
+      assert(tokens_ && "lookahead needs a token table");
+      auto index = std::min(tokenIndex_ + distance, tokenEnd_);
+      return index < tokenEnd_ ? tokens_->getKind(index) : lexer::tok_eof;
+   }
+   
+   void SyntaxParser::rewind(size_t position)
+   {
+      assert(tokens_ && position <= tokenEnd_ && "backtracking needs a token table");
+      tokenIndex_ = position;
+      curToken_ = tokenIndex_ < tokenEnd_ ? tokens_->getKind(tokenIndex_) : lexer::tok_eof;
+   }
+   
+   double SyntaxParser::currentNumber() const
+   {
+      return tokens_ ? tokens_->getNumber(tokenIndex_) : lexer_->getNum();
+   }
+   
+   util::symbol_t SyntaxParser::currentSymbol() const
+   {
+      return tokens_ ? tokens_->getSymbol(tokenIndex_) : lexer_->getSymbol();
+   }
+   
+   std::uint64_t SyntaxParser::currentOffset() const
+   {
+      return tokens_ ? tokens_->getOffset(tokenIndex_) : lexer_->getTokenOffset();
+   }
+   
+   std::uint32_t SyntaxParser::currentLength() const
+   {
+      return tokens_ ? tokens_->getLength(tokenIndex_) : lexer_->getTokenLength();
+   }
+   
+   int SyntaxParser::getTokenPrecedence()
+   {
+      if(!isascii(curToken_))
+         return -1;
+      
+      //here we could throw.. what should I do? .. dunno now
+      
+      int tokenPrec = getOperatorPrecedence(curToken_);
+      return tokenPrec;
+   }
+   
+   void SyntaxParser::setTokenPrecedence(unsigned char token, int value)
+   {
+      //here we could throw.. what should I do? .. dunno now
+      setOperatorPrecedence(token, value);
+   }
+   
+   expression_t SyntaxParser::error(const char* str)
+   {
+      *errorStream_ << "Error at offset " << currentOffset() << " (" << currentLength() << " bytes): " << str << "\n";
+      return nullptr;
+   }
+   
+   void SyntaxParser::setErrorStream(std::ostream& stream)
+   {
+      errorStream_ = &stream;
+   }
+
+   prototype_t SyntaxParser::errorP(const char *str)
+   {
+      error(str);
+      return nullptr;
+   }
+   
+   expression_t SyntaxParser::parseExpression()
+   {
+      //parseUnary();
+      auto lhs = parseUnary(); //parsePrimaryExpression();
+      if (!lhs)
+         return nullptr;
+      
+      return parseBinOpRHS(0, lhs);
+   }
+   
+   expression_t SyntaxParser::parseNumberExpr()
+   {
+      auto res = astContext_.create<AST::NumberExprAST>(currentNumber());
+      getNextToken();
+      return res;
+   }
+   
+   expression_t SyntaxParser::parseParentExpr()
+   {
+      getNextToken();
+      
+      auto v = parseExpression();
+      
+      if(v == nullptr)
+         return nullptr;
+      
+      if(curToken_ != ')')
+         return error("expected )");
+   
+      getNextToken();
+      
+      return v;
+   }
+   
+   expression_t SyntaxParser::parseIdentifierExpr()
+   {
+      auto idName = currentSymbol();
+      
+      //SourceLocation Idlocation = debugInfo_.currentLocation_;
+      
+      getNextToken();
+      
+      if( curToken_ == '[')
+      {
+         getNextToken(); //eat '['
+         auto index = parseExpression();
+         if (!index)
+            return nullptr;
+         
+         if (curToken_ != ']')
+            return error("Expected ] after array index");
+         
+         getNextToken(); //eat ']'
+         return astContext_.create<AST::IndexExprAST>(astContext_.create<AST::VariableExprAST>(idName), index);
+      }
+      
+      if( curToken_ != '(')
+         return astContext_.create<AST::VariableExprAST>(idName);
+      
+      getNextToken();
+      ArgsExpr_t args;
+      
+      if( curToken_ != ')')
+      {
+         while(1)
+         {
+            auto arg = parseExpression();
+            if( arg != nullptr)
+            {
+               args.push_back(arg);
+            }
+            else
+            {
+               return nullptr;
+            }
+            
+            if( curToken_ == ')')
+               break;
+            
+            if(curToken_ != ',')
+               return error("Expected ) or , in argument list");
+            
+            getNextToken();
+         }
+      }
+      
+      getNextToken();
+      return astContext_.create<AST::CallExprAST>(idName, astContext_.copy(args));
+   }
+   
+   expression_t SyntaxParser::parsePrimaryExpression()
+   {
+      switch(curToken_)
+      {
+         default:
+            return error("Unknown token where aspecting an expression");
+            
+         case lexer::tok_identifier :
+            return parseIdentifierExpr();
+            
+         case lexer::tok_number:
+            return parseNumberExpr();
+            
+         case '(':
+            return parseParentExpr();
+         
+         case lexer::tok_if:
+            return parseIfExpr();
+            
+         case lexer::tok_for:
+            return parseForExpr();
+            
+         case lexer::tok_reduce:
+            return parseReduceExpr();
+            
+         case lexer::tok_var:
+            return parseVarExpr();
+      }
+   }
+   
+   expression_t SyntaxParser::parseUnary()
+   {
+      if ( !isascii(curToken_) || curToken_ == '(' || curToken_ == ',')
+         return parsePrimaryExpression();
+      
+      int opcode = curToken_;
+      getNextToken();
+      if (auto operand = parseUnary())
+         return astContext_.create<AST::UnaryExprAST>(opcode, operand);
+      
+      return nullptr;
+   }
+   
+   expression_t SyntaxParser::parseBinOpRHS(int exprPrec, expression_t lhs)
+   {
+      while( true )
+      {
+         auto tokenPrec = getTokenPrecedence();
+         if(tokenPrec < exprPrec)
+            return lhs;
+         
+         int binOp = curToken_;
+         //SourceLocation binaryOpLocation = debugInfo_.currentLocation_;
+         getNextToken();
+         
+         auto rhs = parseUnary(); 
+         if( rhs == nullptr)
+            return nullptr;
+         
+         int nextPrec = curToken_;
+         if(tokenPrec < nextPrec)
+         {
+            rhs = parseBinOpRHS(tokenPrec+1, rhs);
+            if(rhs == nullptr)
+               return nullptr;
+         }
+         
+         lhs = astContext_.create<AST::BinaryExprAST>(binOp, lhs, rhs);
+      }
+   }
+   
+   prototype_t SyntaxParser::parsePrototype()
+   {
+      //SourceLocation fnLocation = debugInfo_.currentLocation_;
+
+      unsigned binaryPrecedence = 30;
+      // by default I assume I am going to parse a prototype definition
+      unsigned kind = 0; //0 (prototype) - 1(unary) - 2(binary)
+      util::symbol_t functionName = util::StringInterner::invalidSymbol;
+      
+      switch (curToken_)
+      {
+         case lexer::tok_identifier:
+            functionName = currentSymbol();
+            getNextToken();
+            break;
+            
+            
+         case lexer::tok_unary:
+            
+            getNextToken();
+            
+            if (!isascii(curToken_))
+               return errorP("Expected unary operator");
+            
+            functionName = operatorSymbol("unary", (char)curToken_);
+            kind = 1;
+            getNextToken();
+            
+            break;
+            
+         case lexer::tok_binary:
+            
+            getNextToken();
+            if (!isascii(curToken_))
+               return errorP("Expected binary operator");
+            
+            functionName = operatorSymbol("binary", (char)curToken_);
+            kind = 2;
+            getNextToken();
+            
+            
+            if (curToken_ == lexer::tok_number)
+            {
+               if (currentNumber() < 1 || currentNumber() > 100)
+                  return errorP("Invalid precedecnce: must be 1..100");
+               
+               binaryPrecedence = (unsigned)currentNumber();
+               getNextToken();
+            }
+            
+            break;
+            
+         default:
+            return errorP("expected function name in prototype");
+      }
+      
+      if (curToken_ != '(')
+         return errorP("Expected '(' in prototype");
+      
+      ArgsStr_t args;
+      std::vector<ValueType> argTypes;
+      getNextToken(); //eat '('
+      while(curToken_ == lexer::tok_identifier)
+      {
+         args.push_back(currentSymbol());
+         getNextToken();
+         
+         argTypes.push_back(ValueType::F64);
+         if (!parseTypeAnnotation(argTypes.back(), kind == 0))
+            return nullptr;
+      }
+      
+      if(curToken_!= ')')
+         return errorP("expected ')' in prototype");
+      
+      // success.
+      getNextToken();
+      
+      //return type and floating point mode annotations, in any order: ': i64 : fast'
+      auto returnType = ValueType::F64;
+      auto floatingPointMode = FloatingPointMode::Session;
+      while (curToken_ == ':')
+      {
+         getNextToken(); //eat ':'
+         llvm::Optional<FloatingPointMode> mode;
+         if (curToken_ == lexer::tok_identifier)
+            mode = parseFloatingPointMode(util::symbolName(currentSymbol()));
+         
+         if (mode)
+         {
+            floatingPointMode = *mode;
+            getNextToken();
+         }
+         else if (!parseTypeName(returnType, false))
+            return nullptr;
+      }
+      
+      if (kind && args.size() != kind)
+         return errorP("Invalid number of operands for operator");
+      
+      return std::make_unique<AST::PrototypeAST>(functionName,
+                                                 std::move(args),
+                                                 kind != 0,
+                                                 binaryPrecedence,
+                                                 std::move(argTypes),
+                                                 returnType,
+                                                 floatingPointMode);
+   }
+   
+   bool SyntaxParser::parseTypeAnnotation(ValueType& type, bool allowArray)
+   {
+      if (curToken_ != ':')
+         return true;
+      
+      getNextToken(); //eat ':'
+      return parseTypeName(type, allowArray);
+   }
+   
+   bool SyntaxParser::parseTypeName(ValueType& type, bool allowArray)
+   {
+      if (curToken_ != lexer::tok_identifier)
+      {
+         error("expected type name after ':'");
+         return false;
+      }
+      
+      auto annotation = parseValueType(util::symbolName(currentSymbol()));
+      if (!annotation)
+      {
+         error("unknown type name: expected f64, f32, i64, i32, vec2, vec4 or vec8");
+         return false;
+      }
+      
+      type = *annotation;
+      getNextToken();
+      
+      if (curToken_ == '[')
+      {
+         if (!allowArray)
+         {
+            error("arrays are only allowed as function arguments");
+            return false;
+         }
+         
+         if (isVectorType(type))
+         {
+            error("arrays of vectors are not supported");
+            return false;
+         }
+         
+         if (getNextToken() != ']')
+         {
+            error("expected ']' after '[' in array type");
+            return false;
+         }
+         
+         type = getArrayType(type);
+         getNextToken();
+      }
+      return true;
+   }
+   
+   function_t SyntaxParser::parseDefinition()
+   {
+      getNextToken();
+      auto prototype = parsePrototype();
+      if(prototype == nullptr)
+         return nullptr;
+      
+      auto expression = parseExpression();
+      if( expression != nullptr )
+      {
+         return
+         std::make_unique<AST::FunctionAST>(std::move(prototype), expression);
+      }
+      
+      return nullptr;
+   }
+   
+   function_t SyntaxParser::parseTopLevelExpr()
+   {
+      //SourceLocation fnLocation = debugInfo_.currentLocation_;
+      auto expression = parseExpression();
+      if( expression != nullptr)
+      {
+         auto prototype = std::make_unique<AST::PrototypeAST>(util::intern("__anon_expr"), ArgsStr_t {});
+         
+         return std::make_unique<AST::FunctionAST>(std::move(prototype), expression);
+      }
+      return nullptr;
+   }
+   
+   prototype_t SyntaxParser::parseExtern()
+   {
+      getNextToken();
+      return parsePrototype();
+   }
+   
+   expression_t SyntaxParser::parseIfExpr()
+   {
+      //SourceLocation ifLocation = debugInfo_.currentLocation_;;
+
+      getNextToken();
+      auto Cond = parseExpression();
+      
+      if(!Cond)
+         return nullptr;
+      
+      if (curToken_ != tok_then)
+         return error("expected then");
+      
+      getNextToken();
+      
+      auto Then = parseExpression();
+      if (!Then)
+         return nullptr;
+      
+      if (curToken_ != tok_else)
+         return error("expected else");
+      
+      getNextToken();
+      
+      auto Else = parseExpression();
+      if (!Else)
+         return nullptr;
+      
+      return astContext_.create<AST::IfExprAST>(Cond, Then, Else);
+   }
+   
+   expression_t SyntaxParser::parseForExpr(Reduction reduction)
+   {
+      getNextToken();
+      
+      if (curToken_ != tok_identifier)
+         return error("expected identifier after for");
+      
+      util::symbol_t IdName = currentSymbol();
+      
+      getNextToken();
+      
+      if (curToken_ != '=')
+         return error("expected '=' after for");
+      
+      getNextToken();
+      
+      auto Start = parseExpression();
+      if (!Start)
+         return nullptr;
+      
+      if (curToken_ != ',')
+         return error("expected ',' after for start value");
+      
+      getNextToken();
+      
+      auto End = parseExpression();
+      if (!End)
+         return nullptr;
+      
+      // The step value is optional.
+      expression_t Step = nullptr;
+      if (curToken_ == ',')
+      {
+         getNextToken();
+         Step = parseExpression();
+         if (!Step)
+            return nullptr;
+      }
+      
+      if (curToken_ != tok_in)
+         return error("expected 'in' after for");
+      
+      getNextToken();
+      
+      auto Body = parseExpression();
+      if (!Body)
+         return nullptr;
+      
+      return astContext_.create<AST::ForExprAST>(IdName, Start, End, Step, Body, reduction);
+      
+   }
+   
+   expression_t SyntaxParser::parseReduceExpr()
+   {
+      getNextToken(); // eat the reduce.
+      
+      auto reduction = Reduction::None;
+      if (curToken_ == '+')
+         reduction = Reduction::Sum;
+      else if (curToken_ == '*')
+         reduction = Reduction::Product;
+      else if (curToken_ == tok_identifier && util::symbolName(currentSymbol()) == "min")
+         reduction = Reduction::Min;
+      else if (curToken_ == tok_identifier && util::symbolName(currentSymbol()) == "max")
+         reduction = Reduction::Max;
+      else
+         return error("expected '+', '*', 'min' or 'max' after reduce");
+      
+      // the loop is parsed like a 'for', from the token of the operator
+      return parseForExpr(reduction);
+   }
+   
+   expression_t SyntaxParser::parseVarExpr()
+   {
+      getNextToken(); // eat the var.
+      
+      std::vector<VarExprAST::variable_t> variableNames;
+      
+      // At least one variable name is required.
+      if (curToken_ != tok_identifier)
+         return error("expected identifier after var");
+      
+      while (1)
+      {
+         util::symbol_t name = currentSymbol();
+         getNextToken();
+         
+         auto type = ValueType::Auto;
+         if (!parseTypeAnnotation(type))
+            return nullptr;
+         
+         // Read the optional initializer.
+         expression_t init = nullptr;
+         if (curToken_ == '=')
+         {
+            getNextToken(); // eat the '='.
+            
+            init = parseExpression();
+            if (!init)
+               return nullptr;
+         }
+         
+         variableNames.push_back(VarExprAST::variable_t{name, init, type});
+         
+         // End of var list, exit loop.
+         if (curToken_ != ',')
+            break;
+         
+         getNextToken();
+         
+         if (curToken_ != tok_identifier)
+            return error("expected identifier list after var");
+      }
+      
+      // At this point, we have to have 'in'.
+      if (curToken_ != tok_in)
+         return error("expected 'in' keyword after 'var'");
+      
+      //eat in
+      getNextToken();
+      
+      auto body = parseExpression();
+      if (!body)
+         return nullptr;
+      
+      return astContext_.create<AST::VarExprAST>(astContext_.copy(variableNames), body);
+
+   }
+   
+   ///
+   /// Top-Level parsing without code generation
+   ///
+   
+   void SyntaxParser::parseAll(std::vector<TopLevelItem>& items)
+   {
+      auto* errorStream = errorStream_;
+      
+      while (curToken_ != lexer::tok_eof)
+      {
+         if (curToken_ == ';')
+         {
+            getNextToken();
+            continue;
+         }
+         
+         std::ostringstream diagnostics;
+         errorStream_ = &diagnostics;
+         
+         TopLevelItem item;
+         switch (curToken_)
+         {
+            case lexer::tok_def:
+               item.kind = TopLevelItem::Kind::Definition;
+               item.function = parseDefinition();
+               
+               //same effect as code generating the definition
+               if (item.function && item.function->getPrototype()->isBinary())
+               {
+                  const auto& prototype = item.function->getPrototype();
+                  setOperatorPrecedence(prototype->getOperatorName(), prototype->getBinaryPrecedence());
+               }
+               break;
+            case lexer::tok_extern:
+               item.kind = TopLevelItem::Kind::Extern;
+               item.prototype = parseExtern();
+               break;
+            default:
+               item.kind = TopLevelItem::Kind::Expression;
+               item.function = parseTopLevelExpr();
+               break;
+         }
+         
+         if (!item.function && !item.prototype)
+         {
+            item.kind = TopLevelItem::Kind::Error;
+            item.error = diagnostics.str();
+            getNextToken();
+         }
+         
+         items.push_back(std::move(item));
+      }
+      
+      errorStream_ = errorStream;
+   }
+}
@@ -0,0 +1,204 @@
+//
+//  SyntaxParser.h
+//  Kaleidoscope-LLVM
+//
+//  syntax only part of the parser: builds the AST of the top level items without generating code,
+//  so that independent ranges of a token table can be parsed concurrently
+//
+
+#ifndef SyntaxParser_h
+#define SyntaxParser_h
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Lexer.h"
+#include "TokenTable.h"
+#include "AST.h"
+
+using namespace AST;
+
+namespace parser {
+   
+   using expression_t = ExprAST*;
+   using prototype_t = std::unique_ptr<PrototypeAST>;
+   using function_t = std::unique_ptr<FunctionAST>;
+   using precedence_table_t = std::map<unsigned char, int>;
+   
+   ///
+   /// @brief: top level item parsed, in source order
+   ///
+   struct TopLevelItem
+   {
+      enum class Kind { Definition, Extern, Expression, Error };
+      
+      Kind kind;
+      function_t function;    //Definition and Expression
+      prototype_t prototype;  //Extern
+      std::string error;      //Error: diagnostics of the item
+   };
+   
+   class SyntaxParser
+   {
+   public:
+      
+      ///
+      /// parse the tokens produced by the lexer passed
+      ///
+      explicit SyntaxParser(std::unique_ptr<lexer::Lexer> lexer);
+      
+      ///
+      /// parse a token table lexed up front: cheap lookahead and backtracking
+      ///
+      explicit SyntaxParser(std::unique_ptr<lexer::TokenTable> tokens);
+      
+      ///
+      /// parse the tokens [begin, end) of a table owned by someone else. end is seen as tok_eof
+      ///
+      SyntaxParser(const lexer::TokenTable& tokens, size_t begin, size_t end);
+      
+      virtual ~SyntaxParser() = default;
+      
+      ///
+      /// delete copy ctor and copy assignment
+      ///
+      SyntaxParser(const SyntaxParser&) = delete;
+      SyntaxParser& operator=(const SyntaxParser&) = delete;
+      
+      ///
+      /// Deal with the language constructs
+      ///
+      
+      int getNextToken();
+      
+      ///
+      /// lookahead and backtracking (token table only): position is the index of a token of the table
+      ///
+      int peekToken(size_t distance) const;
+      void rewind(size_t position);
+      
+      void setTokenPrecedence(unsigned char, int);
+      int getTokenPrecedence();
+      
+      ///
+      /// diagnostics, located at the current token, go to std::cerr unless redirected
+      ///
+      expression_t error(const char* str);
+      prototype_t errorP(const char* str);
+      void setErrorStream(std::ostream& stream);
+      
+      ///numbexpr := number
+      expression_t parseNumberExpr();
+      
+      ///parenexpr := '(' expression ')'
+      expression_t parseParentExpr();
+      
+      ///identifierexpr
+      ///   := identifier
+      //    := identifier '('expression')'
+      //    := identifier '['expression']'
+      expression_t parseIdentifierExpr();
+      
+      /// primary
+      ///   ::= identifierexpr
+      ///   ::= numberexpr
+      ///   ::= parenexpr
+      expression_t parsePrimaryExpression();
+      
+      /// unary operation
+      ///  ::= primary
+      ///  ::= '!' unary
+      expression_t parseUnary();
+      
+      /// binary operation
+      ///   ::= ('+' primary)*
+      expression_t parseBinOpRHS(int exprPrec, expression_t lhs);
+      
+      /// expression
+      ///   ::= primary binoprhs
+      ///
+      expression_t parseExpression();
+      
+      /// type annotation, type is left unchanged when there is none
+      ///   ::= (':' ('f64' | 'f32' | 'i64' | 'i32') ('[' ']')?)?
+      bool parseTypeAnnotation(ValueType& type, bool allowArray = false);
+      
+      /// type name, the ':' already eaten
+      ///   ::= ('f64' | 'f32' | 'i64' | 'i32') ('[' ']')?
+      bool parseTypeName(ValueType& type, bool allowArray);
+      
+      /// prototype, arrays are only allowed as arguments of functions
+      ///   ::= id '(' (id type?)* ')' annotation*
+      ///   ::= unary  LETTER number? (id type?) annotation*
+      ///   ::= binary LETTER number? (id type?, id type?) annotation*
+      /// annotation
+      ///   ::= type
+      ///   ::= ':' ('strict' | 'contract' | 'fast')
+      prototype_t parsePrototype();
+      
+      /// definition ::= 'def' prototype expression
+      function_t parseDefinition();
+      
+      /// toplevelexpr ::= expression
+      function_t parseTopLevelExpr();
+      
+      /// external ::= 'extern' prototype
+      prototype_t parseExtern();
+      
+      /// ifexpr ::= 'if' expression 'then' expression 'else' expression
+      expression_t parseIfExpr();
+      
+      /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
+      expression_t parseForExpr(Reduction reduction = Reduction::None);
+      
+      /// reduceexpr ::= 'reduce' ('+' | '*' | 'min' | 'max') identifier '=' expr ',' expr (',' expr)?
+      //  'in' expression
+      expression_t parseReduceExpr();
+      
+      /// varexpr ::= 'var' identifier type? ('=' expression)?
+      //  (',' identifier type? ('=' expression)?)* 'in' expression
+      expression_t parseVarExpr();
+      
+      ///
+      /// @brief: parse every item up to tok_eof. The precedence of a binary operator is
+      ///         visible right after its definition, as it is when definitions are code generated
+      ///         one by one. Diagnostics are stored in Error items instead of being printed
+      ///
+      void parseAll(std::vector<TopLevelItem>& items);
+   
+   protected:
+      
+      static const size_t noToken = static_cast<size_t>(-1);
+      
+      int curToken_;
+      std::unique_ptr<lexer::Lexer> lexer_;
+      std::unique_ptr<lexer::TokenTable> ownedTokens_;
+      const lexer::TokenTable* tokens_;           //when set the parser walks it instead of the lexer
+      size_t tokenIndex_;                         //current token in tokens_
+      size_t tokenEnd_;                           //first token of tokens_ not parsed
+      AST::ASTContext astContext_;                //nodes of the items being parsed
+      std::ostream* errorStream_;
+      
+      ///
+      /// @brief: operator precedence table, -1 for tokens that are not binary operators
+      ///
+      virtual int getOperatorPrecedence(unsigned char token) const;
+      virtual void setOperatorPrecedence(unsigned char token, int value);
+      
+      double currentNumber() const;
+      util::symbol_t currentSymbol() const;
+      std::uint64_t currentOffset() const;
+      std::uint32_t currentLength() const;
+   
+   private:
+      
+      precedence_table_t precedence_;
+   
+   };
+
+}
+
+#endif /* SyntaxParser_h */
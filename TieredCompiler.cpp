@@ -0,0 +1,201 @@
+//
+//  TieredCompiler.cpp
+//  Kaleidoscope-LLVM
+//
+//  tiered execution: definitions start unoptimized and counted, the hot ones are re-optimized in the background
+//
+
+#include "TieredCompiler.h"
+
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+namespace jit
+{
+   namespace
+   {
+      const auto pollInterval = std::chrono::milliseconds(10);
+      
+      ///
+      /// @brief: count the entries of the function and the back-edges of its loops (the branches
+      ///         to a block dominating the branch) in the global counterName
+      ///
+      void instrument(llvm::Function& function, const std::string& counterName)
+      {
+         auto& module = *function.getParent();
+         auto int64 = llvm::Type::getInt64Ty(module.getContext());
+         auto counter = new llvm::GlobalVariable(module, int64, false, llvm::GlobalValue::ExternalLinkage,
+                                                 llvm::ConstantInt::get(int64, 0), counterName);
+         counter->setAlignment(8);
+         
+         llvm::DominatorTree dominators(function);
+         std::vector<llvm::BasicBlock*> latches;
+         for (auto& block : function)
+            for (auto successor : llvm::successors(&block))
+               if (dominators.dominates(successor, &block))
+               {
+                  latches.push_back(&block);
+                  break;
+               }
+         
+         llvm::IRBuilder<> builder(&*function.getEntryBlock().getFirstInsertionPt());
+         optimizer::emitCounterAdd(builder, counter, builder.getInt64(1));
+         for (auto latch : latches)
+         {
+            builder.SetInsertPoint(latch->getTerminator());
+            optimizer::emitCounterAdd(builder, counter, builder.getInt64(1));
+         }
+      }
+   }
+   
+   TieredCompiler::TieredCompiler(JIT& jit, std::uint64_t hotThreshold) :
+   jit_(jit),
+   hotThreshold_(hotThreshold),
+   baselineOptimizer_(optimizer::OptimizationLevel::O0, &jit.getTargetMachine()),
+   hotTargetMachine_(llvm::EngineBuilder().selectTarget()),
+   stop_(false),
+   definitions_(0)
+   {
+      jit_.enableFastCodeGen();
+      hotTargetMachine_->setOptLevel(llvm::CodeGenOpt::Aggressive);
+      hotOptimizer_ = std::make_unique<optimizer::Optimizer>(optimizer::OptimizationLevel::O3, hotTargetMachine_.get());
+      worker_ = std::thread(&TieredCompiler::run, this);
+   }
+   
+   TieredCompiler::~TieredCompiler()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         stop_ = true;
+      }
+      wakeUp_.notify_one();
+      worker_.join();
+   }
+   
+   void TieredCompiler::addDefinition(std::unique_ptr<llvm::Module> module, const std::string& name)
+   {
+      auto function = module->getFunction(name);
+      if (!function || function->isDeclaration())
+         return;
+      
+      auto candidate = std::make_shared<Candidate>();
+      candidate->name = name;
+      candidate->version = name + "." + std::to_string(++definitions_);
+      candidate->promoted = false;
+      {
+         llvm::raw_string_ostream stream(candidate->bitcode);
+         llvm::WriteBitcodeToFile(module.get(), stream);
+      }
+      
+      //the body moves to version.tier0, its self calls go through the stub
+      function->setName(candidate->version + ".tier0");
+      auto stub = llvm::Function::Create(function->getFunctionType(), llvm::Function::ExternalLinkage, name, module.get());
+      function->replaceAllUsesWith(stub);
+      
+      //the profile of tier 0 weights the branches of the next tier
+      candidate->profileShape = optimizer::instrumentProfile(*function, candidate->version + ".profile");
+      instrument(*function, candidate->version + ".counter");
+      if (!baselineOptimizer_.optimizeModule(*module))
+         return;
+      
+      std::lock_guard<std::mutex> lock(mutex_);
+      
+      //linking tier 0 resolves its self calls: the stub must exist, its target comes next
+      jit_.setIndirection(name, 0);
+      jit_.addModule(module);
+      jit_.setIndirection(name, jit_.getSymbolAddress(candidate->version + ".tier0"));
+      
+      candidate->counter = reinterpret_cast<const std::atomic<std::uint64_t>*>(jit_.getSymbolAddress(candidate->version + ".counter"));
+      candidate->profile = reinterpret_cast<const std::atomic<std::uint64_t>*>(jit_.getSymbolAddress(candidate->version + ".profile"));
+      candidates_[name] = std::move(candidate);
+   }
+   
+   void TieredCompiler::run()
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!stop_)
+      {
+         if (wakeUp_.wait_for(lock, pollInterval, [this] { return stop_; }))
+            break;
+         
+         std::vector<std::shared_ptr<Candidate>> hot;
+         for (auto& candidate : candidates_)
+            if (!candidate.second->promoted &&
+                candidate.second->counter->load(std::memory_order_relaxed) >= hotThreshold_)
+            {
+               candidate.second->promoted = true;
+               hot.push_back(candidate.second);
+            }
+         
+         //the parser keeps adding definitions while the hot ones compile
+         lock.unlock();
+         for (const auto& candidate : hot)
+            promote(candidate);
+         lock.lock();
+      }
+   }
+   
+   void TieredCompiler::promote(const std::shared_ptr<Candidate>& candidate)
+   {
+      auto module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(candidate->bitcode, candidate->name), hotContext_);
+      if (!module)
+      {
+         llvm::consumeError(module.takeError());
+         return;
+      }
+      
+      //the self calls stay direct: this is the last tier
+      const auto tierName = candidate->version + ".tier2";
+      auto function = (*module)->getFunction(candidate->name);
+      function->setName(tierName);
+      
+      //tier 0 defined the rest already: its globals (a memoization table) are shared, the
+      //other functions (the body behind the table) are compiled again for this tier only
+      for (auto& global : (*module)->globals())
+         if (!global.isDeclaration())
+         {
+            global.setInitializer(nullptr);
+            global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+         }
+      for (auto& other : **module)
+         if (&other != function && !other.isDeclaration() && !other.hasAvailableExternallyLinkage())
+            other.setLinkage(llvm::GlobalValue::InternalLinkage);
+      
+      optimizer::annotateProfile(*function, optimizer::readProfile(candidate->profile, candidate->profileShape), true);
+      (*module)->setDataLayout(hotTargetMachine_->createDataLayout());
+      if (!hotOptimizer_->optimizeModule(**module))
+         return;
+      
+      auto object = llvm::orc::SimpleCompiler(*hotTargetMachine_)(**module);
+      
+      std::lock_guard<std::mutex> lock(mutex_);
+      
+      //redefined while compiling: the new definition has its own tier 0
+      const auto current = candidates_.find(candidate->name);
+      if (current == candidates_.end() || current->second != candidate)
+         return;
+      
+      jit_.addObject(std::move(object));
+      jit_.setIndirection(candidate->name, jit_.getSymbolAddress(tierName));
+      
+      //one write: the parser prints its results at the same time
+      std::string note;
+      llvm::raw_string_ostream(note) << "note: '" << candidate->name << "' hot after "
+                                     << candidate->counter->load(std::memory_order_relaxed)
+                                     << " calls and iterations, re-optimized at O3\n";
+      llvm::errs() << note;
+   }
+}
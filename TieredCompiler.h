@@ -0,0 +1,95 @@
+//
+//  TieredCompiler.h
+//  Kaleidoscope-LLVM
+//
+//  tiered execution: definitions start unoptimized and counted, the hot ones are re-optimized in the background
+//
+
+#ifndef TieredCompiler_h
+#define TieredCompiler_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "llvm/IR/LLVMContext.h"
+
+#include "JIT.h"
+#include "Optimizer.h"
+#include "Profile.h"
+
+namespace llvm {
+   class Module;
+   class TargetMachine;
+}
+
+namespace jit
+{
+   ///
+   /// @brief: a definition goes first to tier 0: no optimization, fast instruction selection and a
+   ///         counter of its calls and loop iterations. Callers (itself included) reach it through
+   ///         a stub named as the definition. A background thread polls the counters: a definition
+   ///         past the threshold is weighted with the profile of tier 0, optimized at O3 from its
+   ///         unoptimized IR, compiled with a target machine of its own and the stub pointed to the
+   ///         new code. The calls made from then on run the fast version, a call already running
+   ///         finishes in tier 0 (no on stack replacement)
+   ///
+   class TieredCompiler
+   {
+   public:
+      
+      explicit TieredCompiler(JIT& jit, std::uint64_t hotThreshold);
+      ~TieredCompiler();
+      TieredCompiler(const TieredCompiler&) = delete;
+      TieredCompiler& operator=(const TieredCompiler&) = delete;
+      
+      ///
+      /// @brief: compile the definition name of the (unoptimized) module in tier 0 and make it
+      ///         callable. A redefinition replaces the previous one, promoted or not
+      ///
+      void addDefinition(std::unique_ptr<llvm::Module> module, const std::string& name);
+   
+   private:
+      
+      ///
+      /// @brief: a tier 0 definition, candidate to the promotion
+      ///
+      struct Candidate
+      {
+         std::string name;
+         std::string version;                          //prefix of the symbols of its tiers: a redefinition has its own
+         std::string bitcode;                          //module before instrumentation
+         const std::atomic<std::uint64_t>* counter;    //calls and loop iterations in tier 0
+         const std::atomic<std::uint64_t>* profile;    //counters of the branches and calls of tier 0
+         optimizer::ProfileShape profileShape;
+         bool promoted;
+      };
+      
+      void run();
+      void promote(const std::shared_ptr<Candidate>& candidate);
+      
+      JIT& jit_;
+      const std::uint64_t hotThreshold_;
+      optimizer::Optimizer baselineOptimizer_;
+      
+      //owned by the background thread
+      llvm::LLVMContext hotContext_;
+      std::unique_ptr<llvm::TargetMachine> hotTargetMachine_;
+      std::unique_ptr<optimizer::Optimizer> hotOptimizer_;
+      
+      std::mutex mutex_;
+      std::condition_variable wakeUp_;
+      bool stop_;
+      unsigned definitions_;
+      std::map<std::string, std::shared_ptr<Candidate>> candidates_;
+      
+      std::thread worker_;
+   };
+}
+
+#endif /* TieredCompiler_h */
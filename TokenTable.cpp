@@ -0,0 +1,71 @@
+//
+//  TokenTable.cpp
+//  Kaleidoscope-LLVM
+//
+//  whole input lexed up front into parallel arrays
+//
+
+#include "TokenTable.h"
+#include "Lexer.h"
+
+#include <cassert>
+
+namespace lexer
+{
+   std::unique_ptr<TokenTable> TokenTable::lex(Lexer& lexer)
+   {
+      auto table = std::make_unique<TokenTable>();
+      
+      int token;
+      do
+      {
+         token = lexer.gettok();
+         
+         Payload payload;
+         payload.number = 0;
+         if (token == tok_number)
+            payload.number = lexer.getNum();
+         else if (token == tok_identifier)
+            payload.symbol = lexer.getSymbol();
+         
+         table->kinds_.push_back(static_cast<std::int16_t>(token));
+         table->offsets_.push_back(lexer.getTokenOffset());
+         table->lengths_.push_back(lexer.getTokenLength());
+         table->payloads_.push_back(payload);
+      } while (token != tok_eof);
+      
+      return table;
+   }
+   
+   std::size_t TokenTable::size() const
+   {
+      return kinds_.size();
+   }
+   
+   int TokenTable::getKind(std::size_t index) const
+   {
+      return kinds_[index];
+   }
+   
+   std::uint64_t TokenTable::getOffset(std::size_t index) const
+   {
+      return offsets_[index];
+   }
+   
+   std::uint32_t TokenTable::getLength(std::size_t index) const
+   {
+      return lengths_[index];
+   }
+   
+   double TokenTable::getNumber(std::size_t index) const
+   {
+      assert(kinds_[index] == tok_number);
+      return payloads_[index].number;
+   }
+   
+   util::symbol_t TokenTable::getSymbol(std::size_t index) const
+   {
+      assert(kinds_[index] == tok_identifier);
+      return payloads_[index].symbol;
+   }
+}
@@ -0,0 +1,60 @@
+//
+//  TokenTable.h
+//  Kaleidoscope-LLVM
+//
+//  whole input lexed up front into parallel arrays
+//
+
+#ifndef TokenTable_h
+#define TokenTable_h
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Interner.h"
+
+namespace lexer
+{
+   class Lexer;
+   
+   ///
+   /// @brief: compact token stream (structure of arrays): kind, source offset, length and payload
+   ///         of every token of the input. The last entry is always tok_eof
+   ///
+   class TokenTable
+   {
+   public:
+      
+      ///
+      /// @brief: payload of a token, the number of tok_number or the symbol of tok_identifier
+      ///
+      union Payload
+      {
+         double number;
+         util::symbol_t symbol;
+      };
+      
+      ///
+      /// @brief: run the lexer passed until the end of its input
+      ///
+      static std::unique_ptr<TokenTable> lex(Lexer& lexer);
+      
+      std::size_t size() const;
+      
+      int getKind(std::size_t index) const;
+      std::uint64_t getOffset(std::size_t index) const;
+      std::uint32_t getLength(std::size_t index) const;
+      double getNumber(std::size_t index) const;
+      util::symbol_t getSymbol(std::size_t index) const;
+      
+   private:
+      
+      std::vector<std::int16_t> kinds_;
+      std::vector<std::uint64_t> offsets_; //the mapped input may be larger than 4 GiB
+      std::vector<std::uint32_t> lengths_;
+      std::vector<Payload> payloads_;
+   };
+}
+
+#endif /* TokenTable_h */
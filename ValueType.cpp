@@ -0,0 +1,118 @@
+//
+//  ValueType.cpp
+//  Kaleidoscope-LLVM
+//
+//  numeric types of the values: double by default, optional annotations for the others
+//
+
+#include "ValueType.h"
+
+#include <cassert>
+
+#include "llvm/ADT/StringSwitch.h"
+
+namespace AST
+{
+   llvm::Optional<ValueType> parseValueType(llvm::StringRef name)
+   {
+      return llvm::StringSwitch<llvm::Optional<ValueType>>(name)
+         .Case("f64", ValueType::F64)
+         .Case("f32", ValueType::F32)
+         .Case("i64", ValueType::I64)
+         .Case("i32", ValueType::I32)
+         .Case("vec2", ValueType::Vec2)
+         .Case("vec4", ValueType::Vec4)
+         .Case("vec8", ValueType::Vec8)
+         .Default(llvm::None);
+   }
+   
+   llvm::StringRef getValueTypeName(ValueType type)
+   {
+      switch (type)
+      {
+         case ValueType::F64:
+            return "f64";
+         case ValueType::F32:
+            return "f32";
+         case ValueType::I64:
+            return "i64";
+         case ValueType::I32:
+            return "i32";
+         case ValueType::Vec2:
+            return "vec2";
+         case ValueType::Vec4:
+            return "vec4";
+         case ValueType::Vec8:
+            return "vec8";
+         case ValueType::F64Array:
+            return "f64[]";
+         case ValueType::F32Array:
+            return "f32[]";
+         case ValueType::I64Array:
+            return "i64[]";
+         case ValueType::I32Array:
+            return "i32[]";
+         case ValueType::Auto:
+            break;
+      }
+      return "auto";
+   }
+   
+   bool isIntegerType(ValueType type)
+   {
+      return type == ValueType::I64 || type == ValueType::I32;
+   }
+   
+   bool isArrayType(ValueType type)
+   {
+      return type >= ValueType::F64Array;
+   }
+   
+   bool isVectorType(ValueType type)
+   {
+      return type == ValueType::Vec2 || type == ValueType::Vec4 || type == ValueType::Vec8;
+   }
+   
+   unsigned getVectorWidth(ValueType vectorType)
+   {
+      assert(isVectorType(vectorType) && "not a vector");
+      return 2u << (static_cast<unsigned>(vectorType) - static_cast<unsigned>(ValueType::Vec2));
+   }
+   
+   ValueType getArrayType(ValueType elementType)
+   {
+      assert(elementType < ValueType::Auto && "arrays of scalars only");
+      return static_cast<ValueType>(static_cast<unsigned>(elementType) + static_cast<unsigned>(ValueType::F64Array));
+   }
+   
+   ValueType getElementType(ValueType arrayType)
+   {
+      assert(isArrayType(arrayType) && "not an array");
+      return static_cast<ValueType>(static_cast<unsigned>(arrayType) - static_cast<unsigned>(ValueType::F64Array));
+   }
+   
+   llvm::Optional<FloatingPointMode> parseFloatingPointMode(llvm::StringRef name)
+   {
+      return llvm::StringSwitch<llvm::Optional<FloatingPointMode>>(name)
+         .Case("strict", FloatingPointMode::Strict)
+         .Case("contract", FloatingPointMode::Contract)
+         .Case("fast", FloatingPointMode::Fast)
+         .Default(llvm::None);
+   }
+   
+   llvm::StringRef getFloatingPointModeName(FloatingPointMode mode)
+   {
+      switch (mode)
+      {
+         case FloatingPointMode::Strict:
+            return "strict";
+         case FloatingPointMode::Contract:
+            return "contract";
+         case FloatingPointMode::Fast:
+            return "fast";
+         case FloatingPointMode::Session:
+            break;
+      }
+      return "session";
+   }
+}
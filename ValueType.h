@@ -0,0 +1,86 @@
+//
+//  ValueType.h
+//  Kaleidoscope-LLVM
+//
+//  numeric types of the values: double by default, optional annotations for the others
+//
+
+#ifndef ValueType_h
+#define ValueType_h
+
+#include <cstdint>
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace AST
+{
+   ///
+   /// @brief: type of an argument, a return value or a 'var' binding.
+   ///         Auto is only used by 'var' bindings without annotation: the binding takes
+   ///         the type of its initializer (double when there is none).
+   ///         Vectors are 2, 4 or 8 double lanes, operated lane by lane.
+   ///         Arrays (arguments only) are a pointer to the elements plus their count
+   ///
+   enum class ValueType : std::uint8_t
+   {
+      F64,
+      F32,
+      I64,
+      I32,
+      Auto,
+      Vec2,
+      Vec4,
+      Vec8,
+      F64Array,
+      F32Array,
+      I64Array,
+      I32Array
+   };
+   
+   ///
+   /// @brief: type named in an annotation ("f64", "f32", "i64", "i32", "vec2", "vec4", "vec8"),
+   ///         None for other names
+   ///
+   llvm::Optional<ValueType> parseValueType(llvm::StringRef name);
+   llvm::StringRef getValueTypeName(ValueType type);
+   
+   bool isIntegerType(ValueType type);
+   bool isArrayType(ValueType type);
+   bool isVectorType(ValueType type);
+   
+   ///
+   /// @brief: number of lanes of a vector type
+   ///
+   unsigned getVectorWidth(ValueType vectorType);
+   
+   ///
+   /// @brief: array of the scalar type passed, element type of the array type passed
+   ///
+   ValueType getArrayType(ValueType elementType);
+   ValueType getElementType(ValueType arrayType);
+   
+   ///
+   /// @brief: floating point semantics of a function. Strict keeps the IEEE result of every
+   ///         operation (the default), Contract lets a multiply and an add fuse in one rounding,
+   ///         Fast also reassociates and assumes no NaNs, infinities or signed zeros.
+   ///         Session is a function without annotation: it takes the mode of the session.
+   ///         'reduce' loops reassociate their accumulation in every mode
+   ///
+   enum class FloatingPointMode : std::uint8_t
+   {
+      Session,
+      Strict,
+      Contract,
+      Fast
+   };
+   
+   ///
+   /// @brief: mode named in an annotation or on the command line ("strict", "contract", "fast"),
+   ///         None for other names
+   ///
+   llvm::Optional<FloatingPointMode> parseFloatingPointMode(llvm::StringRef name);
+   llvm::StringRef getFloatingPointModeName(FloatingPointMode mode);
+}
+
+#endif /* ValueType_h */
@@ -6,12 +6,118 @@
 //  Copyright © 2016 Nicola Cabiddu. All rights reserved.
 //
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <string>
 #include "Driver.h"
 
 int main(int argc, const char * argv[]) {
    
    driver::DriverConfiguration cnf;
+   for (int i = 1; i < argc; ++i)
+   {
+      std::string arg = argv[i];
+      if (arg == "--bench-lexer")
+         cnf.benchmarkLexer_ = true;
+      else if (arg == "--prelex")
+         cnf.preLex_ = true;
+      else if (arg == "--flat-ast")
+         cnf.flatAST_ = true;
+      else if (arg == "--parallel-parse")
+         cnf.parallelParse_ = true;
+      else if (arg == "--no-ast-opt")
+         cnf.optimizeAST_ = false;
+      else if (arg == "--hash-cons")
+         cnf.hashConsing_ = true;
+      else if (arg == "--bounds-check")
+         cnf.boundsChecks_ = true;
+      else if (arg == "--whole-file")
+         cnf.wholeFile_ = true;
+      else if (arg.compare(0, 10, "--fp-mode=") == 0)
+      {
+         auto mode = AST::parseFloatingPointMode(arg.substr(10));
+         if (!mode)
+         {
+            std::cerr << "unknown floating point mode: expected --fp-mode=strict, contract or fast\n";
+            return 1;
+         }
+         cnf.floatingPointMode_ = *mode;
+      }
+      else if (arg == "-O0")
+         cnf.enableOpt_ = optimizer::OptimizationLevel::O0;
+      else if (arg == "-O1")
+         cnf.enableOpt_ = optimizer::OptimizationLevel::O1;
+      else if (arg == "-O2")
+         cnf.enableOpt_ = optimizer::OptimizationLevel::O2;
+      else if (arg == "-O3")
+         cnf.enableOpt_ = optimizer::OptimizationLevel::O3;
+      else if (arg == "--no-select")
+         cnf.selectThreshold_ = 0;
+      else if (arg.compare(0, 19, "--select-threshold=") == 0)
+      {
+         const char* cost = arg.c_str() + 19;
+         char* end = nullptr;
+         const auto threshold = std::strtoul(cost, &end, 10);
+         if (end == cost || *end != '\0')
+         {
+            std::cerr << "invalid select threshold: expected --select-threshold=<cost>\n";
+            return 1;
+         }
+         cnf.selectThreshold_ = static_cast<unsigned>(threshold);
+      }
+      else if (arg.compare(0, 19, "--profile-generate=") == 0)
+         cnf.profileGenerate_ = arg.substr(19);
+      else if (arg.compare(0, 14, "--profile-use=") == 0)
+         cnf.profileUse_ = arg.substr(14);
+      else if (arg == "--memoize")
+         cnf.memoTableSize_ = 4096;
+      else if (arg.compare(0, 10, "--memoize=") == 0)
+      {
+         const char* size = arg.c_str() + 10;
+         char* end = nullptr;
+         const auto entries = std::strtoul(size, &end, 10);
+         if (end == size || *end != '\0' || entries < 2 || entries > (1u << 24) || (entries & (entries - 1)))
+         {
+            std::cerr << "invalid memoization table: expected --memoize=<entries>, a power of 2 from 2 to 2^24\n";
+            return 1;
+         }
+         cnf.memoTableSize_ = static_cast<unsigned>(entries);
+      }
+      else if (arg == "--const-eval")
+         cnf.constEvalBudget_ = 1000000;
+      else if (arg.compare(0, 13, "--const-eval=") == 0)
+      {
+         const char* steps = arg.c_str() + 13;
+         char* end = nullptr;
+         const auto budget = std::strtoull(steps, &end, 10);
+         if (end == steps || *end != '\0' || budget == 0)
+         {
+            std::cerr << "invalid compile time evaluation budget: expected --const-eval=<steps>\n";
+            return 1;
+         }
+         //the budget counts down in a signed 64-bit global
+         cnf.constEvalBudget_ = std::min<unsigned long long>(budget, INT64_MAX);
+      }
+      else if (arg == "--tiered")
+         cnf.tiered_ = true;
+      else if (arg.compare(0, 16, "--hot-threshold=") == 0)
+      {
+         const char* count = arg.c_str() + 16;
+         char* end = nullptr;
+         const auto threshold = std::strtoull(count, &end, 10);
+         if (end == count || *end != '\0' || threshold == 0)
+         {
+            std::cerr << "invalid hot threshold: expected --hot-threshold=<count>\n";
+            return 1;
+         }
+         cnf.hotThreshold_ = threshold;
+      }
+      else
+         cnf.inputFile_ = arg;
+   }
+   
    driver::Driver driver{cnf};
    driver.go();
    